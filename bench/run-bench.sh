@@ -0,0 +1,36 @@
+#!/bin/sh
+
+emulator=${1:-}
+bench_dir=${2:-}
+
+if [ -z "$emulator" ] || [ -z "$bench_dir" ]; then
+    printf "Usage: %s <emulator> <bench-directory> [emulator-options...]\n" "$0" >&2
+    exit 2
+fi
+shift 2
+
+# Wall-clock milliseconds; needs a date(1) that knows %N.
+now_ms() {
+    echo $(($(date +%s%N) / 1000000))
+}
+
+failures=0
+
+for bench_elf in "$bench_dir"/*.elf; do
+    bench_name=$(basename "$bench_elf" .elf)
+    for pages in small thp hugetlb; do
+        start=$(now_ms)
+        "$emulator" "$@" --pages=$pages "$bench_elf"
+        result=$?
+        elapsed=$(($(now_ms) - start))
+
+        if [ "$result" -eq 0 ]; then
+            printf "%-16s --pages=%-8s %6d ms\n" "$bench_name" "$pages" "$elapsed"
+        else
+            printf "FAIL  %s --pages=%s (exit code: %d)\n" "$bench_name" "$pages" "$result"
+            failures=$((failures + 1))
+        fi
+    done
+done
+
+[ "$failures" -eq 0 ]
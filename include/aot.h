@@ -0,0 +1,218 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include "cpu.h"
+#include "decoder.h"
+#include "memory.h"
+#include "rv_context.h"
+#include "utils.h"
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Ahead-of-time translations are produced by tools/rv_aot.c: one host
+// function per guest block, linked into a runner built from src/main.c with
+// -DRV_AOT. Addresses without a translation run on the interpreter. Inside a
+// block, guest registers are host locals; cpu->regs is brought up to date
+// whenever the block returns, fails a memory access or calls the
+// interpreter.
+
+#define AOT_MAX_BLOCK_INSTRUCTIONS 64
+#define AOT_MAX_BLOCK_BYTES (AOT_MAX_BLOCK_INSTRUCTIONS * 4)
+
+// Returns how many guest instructions retired, fewer than the block's count
+// when it stops the guest or leaves early after a store into translated
+// code. As in rv_step, an instruction that stops the guest does not count.
+typedef uint32_t (*AotBlockFunction)(RvContext_t *context);
+
+typedef struct AotBlock {
+  uint32_t start_pc;
+  uint32_t end_pc;
+  uint32_t count; // Guest instructions, checked against the budget.
+  AotBlockFunction run;
+} AotBlock_t;
+
+// Executable bytes the translation was made from. They must match the loaded
+// program, or the runner ignores the translation.
+typedef struct AotSegment {
+  uint32_t vaddr;
+  uint32_t size;
+  uint64_t hash;
+} AotSegment_t;
+
+typedef struct AotProgram {
+  const AotBlock_t *blocks; // Sorted by start_pc.
+  size_t block_count;
+  const AotSegment_t *segments;
+  size_t segment_count;
+} AotProgram_t;
+
+typedef struct AotState {
+  const AotProgram_t *program;
+  uint32_t *slots; // Block index + 1 by start_pc hash; 0 is empty.
+  size_t slot_mask;
+  bool *disabled;
+  // Set when a store overwrote a translated block; generated code checks it
+  // after each store and leaves the block.
+  bool code_written;
+} AotState_t;
+
+// Runs the guest on the translation. Returns false, without running anything,
+// when the translation does not match the loaded program.
+bool rv_run_aot(RvContext_t *context, const AotProgram_t *program);
+
+// Helpers for generated code. Each matches the handler of the same name in
+// src/instructions.c or src/instructions_m.c.
+
+static inline uint32_t aot_add(uint32_t a, uint32_t b) { return a + b; }
+static inline uint32_t aot_sub(uint32_t a, uint32_t b) { return a - b; }
+static inline uint32_t aot_xor(uint32_t a, uint32_t b) { return a ^ b; }
+static inline uint32_t aot_or(uint32_t a, uint32_t b) { return a | b; }
+static inline uint32_t aot_and(uint32_t a, uint32_t b) { return a & b; }
+
+static inline uint32_t aot_sll(uint32_t a, uint32_t b) {
+  return a << (b & 0x1F);
+}
+
+static inline uint32_t aot_srl(uint32_t a, uint32_t b) {
+  return a >> (b & 0x1F);
+}
+
+static inline uint32_t aot_sra(uint32_t a, uint32_t b) {
+  return (uint32_t)((int32_t)a >> (b & 0x1F));
+}
+
+static inline uint32_t aot_slt(uint32_t a, uint32_t b) {
+  return (int32_t)a < (int32_t)b;
+}
+
+static inline uint32_t aot_sltu(uint32_t a, uint32_t b) { return a < b; }
+
+static inline uint32_t aot_mul(uint32_t a, uint32_t b) { return a * b; }
+
+static inline uint32_t aot_mulh(uint32_t a, uint32_t b) {
+  return (uint32_t)(((int64_t)(int32_t)a * (int64_t)(int32_t)b) >> 32);
+}
+
+static inline uint32_t aot_mulhsu(uint32_t a, uint32_t b) {
+  return (uint32_t)(((uint64_t)(int64_t)(int32_t)a * (uint64_t)b) >> 32);
+}
+
+static inline uint32_t aot_mulhu(uint32_t a, uint32_t b) {
+  return (uint32_t)(((uint64_t)a * (uint64_t)b) >> 32);
+}
+
+static inline uint32_t aot_div(uint32_t a, uint32_t b) {
+  if (b == 0)
+    return UINT32_MAX;
+  if ((int32_t)a == INT32_MIN && (int32_t)b == -1)
+    return a;
+  return (uint32_t)((int32_t)a / (int32_t)b);
+}
+
+static inline uint32_t aot_divu(uint32_t a, uint32_t b) {
+  return b == 0 ? UINT32_MAX : a / b;
+}
+
+static inline uint32_t aot_rem(uint32_t a, uint32_t b) {
+  if (b == 0)
+    return a;
+  if ((int32_t)a == INT32_MIN && (int32_t)b == -1)
+    return 0;
+  return (uint32_t)((int32_t)a % (int32_t)b);
+}
+
+static inline uint32_t aot_remu(uint32_t a, uint32_t b) {
+  return b == 0 ? a : a % b;
+}
+
+static inline bool aot_eq(uint32_t a, uint32_t b) { return a == b; }
+static inline bool aot_ne(uint32_t a, uint32_t b) { return a != b; }
+static inline bool aot_ltu(uint32_t a, uint32_t b) { return a < b; }
+static inline bool aot_geu(uint32_t a, uint32_t b) { return a >= b; }
+
+static inline bool aot_lt(uint32_t a, uint32_t b) {
+  return (int32_t)a < (int32_t)b;
+}
+
+static inline bool aot_ge(uint32_t a, uint32_t b) {
+  return (int32_t)a >= (int32_t)b;
+}
+
+// Memory errors stop the guest at the faulting instruction, as in
+// stop_on_memory_error.
+static inline bool aot_stop(CPU_t *cpu, uint32_t pc) {
+  cpu->pc = pc;
+  cpu->exit_code = 1;
+  cpu->halt = true;
+  cpu->faulted = true;
+  return false;
+}
+
+static inline bool aot_lb(RvContext_t *context, uint32_t pc, uint32_t addr,
+                          uint32_t *value) {
+  uint8_t byte;
+  if (!read_byte(context->memory, addr, &byte))
+    return aot_stop(context->cpu, pc);
+  *value = (uint32_t)sign_extend(byte, 8);
+  return true;
+}
+
+static inline bool aot_lh(RvContext_t *context, uint32_t pc, uint32_t addr,
+                          uint32_t *value) {
+  uint16_t half;
+  if (!read_half(context->memory, addr, &half))
+    return aot_stop(context->cpu, pc);
+  *value = (uint32_t)sign_extend(half, 16);
+  return true;
+}
+
+static inline bool aot_lw(RvContext_t *context, uint32_t pc, uint32_t addr,
+                          uint32_t *value) {
+  if (!read_word(context->memory, addr, value))
+    return aot_stop(context->cpu, pc);
+  return true;
+}
+
+static inline bool aot_lbu(RvContext_t *context, uint32_t pc, uint32_t addr,
+                           uint32_t *value) {
+  uint8_t byte;
+  if (!read_byte(context->memory, addr, &byte))
+    return aot_stop(context->cpu, pc);
+  *value = byte;
+  return true;
+}
+
+static inline bool aot_lhu(RvContext_t *context, uint32_t pc, uint32_t addr,
+                           uint32_t *value) {
+  uint16_t half;
+  if (!read_half(context->memory, addr, &half))
+    return aot_stop(context->cpu, pc);
+  *value = half;
+  return true;
+}
+
+static inline bool aot_sb(RvContext_t *context, uint32_t pc, uint32_t addr,
+                          uint32_t value) {
+  if (!write_byte(context->memory, addr, (uint8_t)value))
+    return aot_stop(context->cpu, pc);
+  return true;
+}
+
+static inline bool aot_sh(RvContext_t *context, uint32_t pc, uint32_t addr,
+                          uint32_t value) {
+  if (!write_half(context->memory, addr, (uint16_t)value))
+    return aot_stop(context->cpu, pc);
+  return true;
+}
+
+static inline bool aot_sw(RvContext_t *context, uint32_t pc, uint32_t addr,
+                          uint32_t value) {
+  if (!write_word(context->memory, addr, value))
+    return aot_stop(context->cpu, pc);
+  return true;
+}
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define ASYNC_IO_BATCH_SIZE 64
+#define ASYNC_IO_BATCH_BYTES (1024 * 1024)
+#define ASYNC_IO_WORKERS 4
+
+typedef enum { ASYNC_IO_URING, ASYNC_IO_THREADS } AsyncIoBackend;
+
+typedef struct AsyncRequest {
+  int fd;
+  char *data;
+  size_t length;
+  int32_t result;
+} AsyncRequest_t;
+
+// Writes are queued in `pending` and submitted as one batch while the guest
+// keeps running. Only one batch is in flight at a time, and requests for the
+// same fd inside a batch complete in order, so each fd sees writes in guest
+// order.
+typedef struct AsyncBatch {
+  AsyncRequest_t requests[ASYNC_IO_BATCH_SIZE];
+  size_t count;
+  size_t bytes;
+} AsyncBatch_t;
+
+typedef struct AsyncRing {
+  int fd;
+  unsigned int entries;
+  void *sq_map;
+  size_t sq_map_size;
+  void *cq_map;
+  size_t cq_map_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned int *sq_head;
+  unsigned int *sq_tail;
+  unsigned int *sq_mask;
+  unsigned int *sq_array;
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int *cq_mask;
+  struct io_uring_cqe *cqes;
+} AsyncRing_t;
+
+typedef struct AsyncWorkers {
+  pthread_t threads[ASYNC_IO_WORKERS];
+  size_t thread_count;
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t done;
+  // Each fd in the in-flight batch is one chain, claimed whole by a worker.
+  int chain_fds[ASYNC_IO_BATCH_SIZE];
+  size_t chain_count;
+  size_t next_chain;
+  size_t chains_left;
+  bool stopping;
+} AsyncWorkers_t;
+
+typedef struct AsyncIo {
+  AsyncIoBackend backend;
+  AsyncRing_t ring;
+  AsyncWorkers_t workers;
+  AsyncBatch_t batches[2];
+  AsyncBatch_t *pending;
+  AsyncBatch_t *in_flight;
+  size_t in_flight_left;
+} AsyncIo_t;
+
+bool init_async_io(AsyncIo_t *io, bool allow_io_uring);
+void free_async_io(AsyncIo_t *io);
+const char *async_io_backend_name(const AsyncIo_t *io);
+
+bool async_io_write(AsyncIo_t *io, int fd, const void *data, size_t length);
+bool async_io_writev(AsyncIo_t *io, int fd, const struct iovec *iov,
+                     int iovcnt);
+void async_io_drain(AsyncIo_t *io);
+ssize_t async_io_read(AsyncIo_t *io, int fd, void *buffer, size_t count);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef BBV_H
+#define BBV_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Basic-block vectors for SimPoint. Execution is cut into intervals of a
+// fixed number of instructions, and each interval becomes one line listing,
+// for every block that ran in it, the block's id and the instructions it
+// retired: "T:id:count :id:count ...". Ids number blocks from 1 in order of
+// first execution. The block engines report each block they run and the
+// interpreter each instruction, so an interval ends at the first block
+// boundary at or past its length and any overshoot counts toward the next.
+
+#define BBV_DEFAULT_INTERVAL 100000000ull
+#define BBV_INITIAL_BLOCKS 1024
+
+typedef struct BbvBlock {
+  uint32_t pc;
+  uint64_t count; // Instructions retired in the current interval.
+} BbvBlock_t;
+
+typedef struct Bbv {
+  FILE *file;
+  uint64_t interval;
+  uint64_t retired; // Instructions counted in the current interval.
+  uint64_t intervals;
+  BbvBlock_t *blocks; // Indexed by id - 1.
+  uint32_t block_count;
+  uint32_t capacity;
+  uint32_t *slots; // Open-addressed by pc: block ids, 0 when empty.
+  size_t slot_mask;
+  uint32_t *touched; // Ids with a nonzero count, in first-use order.
+  uint32_t touched_count;
+  bool failed;
+} Bbv_t;
+
+bool bbv_open(Bbv_t *bbv, const char *path, uint64_t interval);
+// Writes the last, partial interval and closes the file. Returns false when
+// any of the file could not be written.
+bool bbv_close(Bbv_t *bbv);
+// Counts `instructions` retired by the block starting at `pc`; a block that
+// retired none is left out.
+void bbv_record(Bbv_t *bbv, uint32_t pc, uint32_t instructions);
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include "decoder.h"
+#include "rv_context.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BLOCK_MAX_INSTRUCTIONS 64
+#define BLOCK_CACHE_CAPACITY 8192
+#define BLOCK_CACHE_INSTRUCTION_CAPACITY (BLOCK_CACHE_CAPACITY * 16)
+#define BLOCK_CACHE_HASH_SIZE 16384
+#define BLOCK_CACHE_PAGE_HASH_SIZE 1024
+#define RETURN_STACK_DEPTH 32
+#define BLOCK_CACHE_LOOP_CAPACITY 1024
+#define LOOP_MAX_INDUCTIONS 4
+// Executions after which a block is rewritten into micro-ops; see
+// src/block_optimizer.c.
+#define BLOCK_HOT_THRESHOLD 32
+
+// Bump whenever decoding or block formation changes, so that block cache
+// files written by an older emulator are ignored.
+#define BLOCK_CACHE_FILE_VERSION 1
+
+// Slot in Block_t.links used for the taken target and for the address right
+// after the block (fallthrough, or the return address of a call).
+#define BLOCK_LINK_TARGET 0
+#define BLOCK_LINK_FALLTHROUGH 1
+
+typedef enum {
+  BLOCK_EXIT_FALLTHROUGH,
+  BLOCK_EXIT_DIRECT,
+  BLOCK_EXIT_INDIRECT,
+} BlockExit;
+
+typedef struct BlockInstruction {
+  InstructionHandler handler;
+  uint32_t inst;
+  uint8_t len;
+} BlockInstruction_t;
+
+typedef enum {
+  UOP_HANDLER, // Runs insn->handler, exactly as the cold tier would.
+  UOP_CONST,   // rd = imm
+  UOP_ADD,
+  UOP_SUB,
+  UOP_SLL,
+  UOP_SLT,
+  UOP_SLTU,
+  UOP_XOR,
+  UOP_SRL,
+  UOP_SRA,
+  UOP_OR,
+  UOP_AND,
+  UOP_MUL,
+  UOP_MULH,
+  UOP_MULHSU,
+  UOP_MULHU,
+  UOP_DIV,
+  UOP_DIVU,
+  UOP_REM,
+  UOP_REMU,
+} MicroOpKind;
+
+// Register operations never have rd == x0; those are dropped. The second
+// operand is rs2, or imm when has_imm is set.
+typedef struct MicroOp {
+  uint8_t kind;
+  uint8_t rd;
+  uint8_t rs1;
+  uint8_t rs2;
+  bool has_imm;
+  uint32_t imm;
+  uint32_t pc;
+  const BlockInstruction_t *insn;
+} MicroOp_t;
+
+// A block that branches back to its own start and each time around copies
+// or fills one element of memory; see src/block_optimizer.c. Registers are
+// read at the block start. Element i is at src + src_offset + i * width.
+typedef struct LoopIdiom {
+  uint8_t width; // Bytes per element: 1, 2 or 4.
+  bool copy;     // Elements are loaded into load_rd, else value_reg is stored.
+  bool load_signed;
+  uint8_t load_rd;
+  uint8_t src_reg;
+  int32_t src_offset;
+  uint8_t dst_reg;
+  int32_t dst_offset;
+  uint8_t value_reg;
+  // The loop runs while counter_reg, after its step, differs from bound_reg.
+  uint8_t counter_reg;
+  int32_t counter_step;
+  uint8_t bound_reg;
+  // Registers stepped by a constant addi each iteration, counter included.
+  uint8_t induction_count;
+  uint8_t induction_regs[LOOP_MAX_INDUCTIONS];
+  int32_t induction_steps[LOOP_MAX_INDUCTIONS];
+} LoopIdiom_t;
+
+typedef struct Block {
+  uint32_t start_pc;
+  uint32_t end_pc;
+  uint32_t count;
+  BlockInstruction_t *insns;
+
+  BlockExit exit;
+  bool pushes_return;
+  bool pops_return;
+
+  uint32_t link_pc[2];
+  struct Block *links[2];
+  uint32_t indirect_pc;
+  struct Block *indirect_target;
+
+  // Invalidated blocks stay in the pool until the next flush, so stale
+  // links are detected through this flag rather than dangling.
+  bool invalid;
+  uint32_t exec_count;
+  // Optimized tier, set once the block is hot. uops_fall_through means the
+  // last instruction is not a handler, so pc must be set to end_pc.
+  MicroOp_t *uops;
+  uint32_t uop_count;
+  bool uops_fall_through;
+  const LoopIdiom_t *loop; // Set with uops when the block is such a loop.
+  struct Block *hash_next;
+  struct Block *page_next;
+} Block_t;
+
+typedef struct ReturnStackEntry {
+  uint32_t return_pc;
+  Block_t *caller;
+} ReturnStackEntry_t;
+
+typedef struct BlockCacheStats {
+  uint64_t builds;
+  uint64_t flushes;
+  uint64_t lookups;
+  uint64_t chained;
+  uint64_t return_hits;
+  uint64_t return_misses;
+  uint64_t indirect_hits;
+  uint64_t indirect_misses;
+  uint64_t invalidations;
+  uint64_t loaded;
+  uint64_t optimized;
+  uint64_t loops;     // Blocks recognized as copy or fill loops.
+  uint64_t loop_runs; // Times such a loop ran to its end on the host.
+} BlockCacheStats_t;
+
+typedef struct BlockCache {
+  Block_t *blocks;
+  size_t block_count;
+  BlockInstruction_t *insns;
+  size_t insn_count;
+  MicroOp_t *uops;
+  size_t uop_count;
+  LoopIdiom_t *loops;
+  size_t loop_count;
+  uint32_t hot_threshold; // 0 keeps every block in the cold tier.
+  Block_t **hash;
+  // Blocks by the guest page holding start_pc, for code write invalidation.
+  Block_t **page_hash;
+  Memory_t *memory;
+
+  ReturnStackEntry_t return_stack[RETURN_STACK_DEPTH];
+  unsigned int return_top;
+  unsigned int return_depth;
+
+  BlockCacheStats_t stats;
+} BlockCache_t;
+
+bool init_block_cache(BlockCache_t *cache);
+void free_block_cache(BlockCache_t *cache);
+void block_cache_flush(BlockCache_t *cache);
+void block_cache_invalidate(BlockCache_t *cache, uint32_t addr, size_t size);
+
+// Saves the blocks still matching guest memory to `path`, tagged with `key`
+// (normally ElfInfo_t.exec_hash).
+bool block_cache_save(BlockCache_t *cache, Memory_t *memory, const char *path,
+                      uint64_t key);
+// Adds the blocks saved under `key` whose guest bytes are unchanged. Returns
+// false when the file is missing, stale or corrupt; blocks read before a
+// corrupt record stay in the cache and are valid.
+bool block_cache_load(BlockCache_t *cache, Memory_t *memory, const char *path,
+                      uint64_t key);
+
+Block_t *block_cache_lookup(BlockCache_t *cache, RvContext_t *context,
+                            uint32_t pc);
+Block_t *block_cache_next(BlockCache_t *cache, RvContext_t *context,
+                          Block_t *prev, uint32_t pc);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef BLOCK_OPTIMIZER_H
+#define BLOCK_OPTIMIZER_H
+
+#include "block_cache.h"
+#include "rv_context.h"
+
+#include <stdbool.h>
+
+// Rewrites a hot block into micro-ops (Block_t.uops). Returns false, leaving
+// the block in the cold tier, if it is invalid or the cache is out of room.
+bool block_optimize(BlockCache_t *cache, Block_t *block);
+
+// Runs a block's micro-ops, with the same effect on cpu and memory as
+// running its instructions one by one, and returns how many of those
+// instructions retired; one that stops the guest does not count.
+uint32_t block_execute_optimized(const Block_t *block, RvContext_t *context);
+
+// Runs every iteration of a block with a LoopIdiom_t, starting at its head,
+// as one bulk copy or fill and charges them to the instruction count, then
+// leaves pc after the block. Returns false, changing nothing, when the loop
+// has to run instruction by instruction instead.
+bool block_execute_loop(const Block_t *block, RvContext_t *context);
+
+#endif
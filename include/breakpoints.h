@@ -0,0 +1,45 @@
+#ifndef BREAKPOINTS_H
+#define BREAKPOINTS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Guest addresses to stop at, as an open-addressed hash set so that the
+// engines can test every block start cheaply.
+
+#define BREAKPOINTS_INITIAL_SLOTS 64
+// Instructions are at least 2-byte aligned, so no breakpoint has this pc.
+#define BREAKPOINTS_EMPTY 1u
+
+typedef struct Breakpoints {
+  uint32_t *slots;
+  size_t slot_mask;
+  size_t count;
+} Breakpoints_t;
+
+bool init_breakpoints(Breakpoints_t *breakpoints);
+void free_breakpoints(Breakpoints_t *breakpoints);
+// Returns false when `pc` is misaligned or the set cannot grow.
+bool breakpoints_insert(Breakpoints_t *breakpoints, uint32_t pc);
+void breakpoints_remove(Breakpoints_t *breakpoints, uint32_t pc);
+
+static inline size_t breakpoints_slot(const Breakpoints_t *breakpoints,
+                                      uint32_t pc) {
+  return (pc >> 1) & breakpoints->slot_mask;
+}
+
+static inline bool breakpoints_contains(const Breakpoints_t *breakpoints,
+                                        uint32_t pc) {
+  if (breakpoints->count == 0)
+    return false;
+  for (size_t i = breakpoints_slot(breakpoints, pc);;
+       i = (i + 1) & breakpoints->slot_mask) {
+    if (breakpoints->slots[i] == pc)
+      return true;
+    if (breakpoints->slots[i] == BREAKPOINTS_EMPTY)
+      return false;
+  }
+}
+
+#endif
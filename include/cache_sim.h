@@ -0,0 +1,90 @@
+#ifndef CACHE_SIM_H
+#define CACHE_SIM_H
+
+#include "cpu.h"
+#include "memory.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// A set-associative L1I/L1D/L2 cache model fed by guest fetches, loads and
+// stores through a memory observer. Both L1s miss into the shared L2. Every
+// level allocates on a miss, stores included, and replaces the least
+// recently used way. Hits and misses are counted per level, per instruction
+// pc and per data region.
+
+// Data regions are guest pages.
+#define CACHE_SIM_REGION_SHIFT 12
+#define CACHE_SIM_INITIAL_ENTRIES 1024
+
+typedef enum CacheLevelIndex {
+  CACHE_L1I,
+  CACHE_L1D,
+  CACHE_L2,
+  CACHE_LEVELS,
+} CacheLevelIndex;
+
+typedef struct CacheConfig {
+  uint32_t size; // Bytes.
+  uint32_t ways;
+  uint32_t line; // Bytes.
+} CacheConfig_t;
+
+typedef struct CacheLevel {
+  CacheConfig_t config;
+  uint32_t set_mask;
+  uint32_t line_shift;
+  uint32_t *tags; // Line number plus one per way, set by set; 0 is empty.
+  uint64_t *used; // When each way was last touched, for LRU.
+  uint64_t clock;
+  uint64_t hits;
+  uint64_t misses;
+} CacheLevel_t;
+
+typedef struct CacheCounts {
+  uint64_t accesses;
+  uint64_t l1_misses;
+  uint64_t l2_misses;
+} CacheCounts_t;
+
+typedef struct CacheSimEntry {
+  uint32_t key; // A pc, or a region number.
+  bool used;
+  CacheCounts_t fetch; // Fetches of the instruction at a pc.
+  CacheCounts_t data;  // Loads and stores by a pc, or within a region.
+} CacheSimEntry_t;
+
+// Open-addressed by key, kept at most half full.
+typedef struct CacheSimTable {
+  CacheSimEntry_t *entries;
+  size_t mask;
+  size_t count;
+} CacheSimTable_t;
+
+typedef struct CacheSim {
+  CacheLevel_t levels[CACHE_LEVELS];
+  const CPU_t *cpu; // Data accesses are charged to cpu->pc.
+  CacheSimTable_t pcs;
+  CacheSimTable_t regions;
+  bool failed; // A table could not grow; later counts are dropped.
+} CacheSim_t;
+
+void cache_sim_default_config(CacheConfig_t configs[CACHE_LEVELS]);
+// Parses "l1i=SIZE:WAYS:LINE,l1d=...,l2=..." over `configs`; levels not
+// named keep their values. SIZE may end in k or m.
+bool cache_sim_parse(const char *spec, CacheConfig_t configs[CACHE_LEVELS]);
+
+bool init_cache_sim(CacheSim_t *sim, const CacheConfig_t configs[CACHE_LEVELS],
+                    const CPU_t *cpu);
+void free_cache_sim(CacheSim_t *sim);
+// Installs the model as `memory`'s observer.
+void cache_sim_attach(CacheSim_t *sim, Memory_t *memory);
+// `access` is MEMORY_PROT_READ, MEMORY_PROT_WRITE or MEMORY_PROT_EXEC.
+void cache_sim_access(CacheSim_t *sim, uint32_t addr, size_t size,
+                      uint8_t access);
+// Prints per-level totals and the `top` pcs and regions with most misses.
+void cache_sim_report(const CacheSim_t *sim, FILE *out, size_t top);
+
+#endif
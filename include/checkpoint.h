@@ -0,0 +1,38 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "cpu.h"
+#include "memory.h"
+#include "syscall.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A snapshot of a guest between two instructions: its registers and pc and
+// a memory image (see memory_save_image). Restoring one over a freshly
+// loaded program resumes the guest there, so detailed analysis can start
+// at a representative point instead of at the entry point. Host state is
+// not captured: descriptors the guest opened beyond stdin, stdout and
+// stderr are closed in the restored guest.
+
+#define CHECKPOINT_MAGIC 0x4b435652u // "RVCK"
+#define CHECKPOINT_VERSION 1
+
+typedef struct CheckpointHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;      // Identifies the program, as ElfInfo_t.exec_hash.
+  uint64_t position; // Instructions retired before the checkpoint.
+  uint32_t regs[32];
+  uint32_t pc;
+  uint32_t padding;
+} CheckpointHeader_t;
+
+bool checkpoint_save(const char *path, const CPU_t *cpu,
+                     const Memory_t *memory, const SyscallState_t *syscalls,
+                     uint64_t key, uint64_t position);
+// Fails when the checkpoint was taken of another program than `key`.
+bool checkpoint_restore(const char *path, CPU_t *cpu, Memory_t *memory,
+                        uint64_t key, uint64_t *position);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// AFL-compatible edge coverage. Every control transfer bumps the map byte
+// for the pair (previous location, new location), where a location is a
+// hash of the guest pc, as in AFL's QEMU mode. The interpreter records an
+// edge in each branch and jump handler; the block engines record one per
+// block entered instead.
+
+#define COVERAGE_MAP_SIZE (1u << 16)
+// Set by afl-fuzz to the System V shared memory segment holding the map.
+#define COVERAGE_SHM_ENV "__AFL_SHM_ID"
+// afl-fuzz sends fork requests on this descriptor and reads replies on the
+// next one.
+#define COVERAGE_FORKSRV_FD 198
+
+typedef struct Coverage {
+  uint8_t *map;
+  uint32_t prev_location;
+  bool shared;      // map is afl-fuzz's segment rather than our own.
+  bool block_edges; // The running engine records block entries itself.
+} Coverage_t;
+
+// Attaches to afl-fuzz's map when COVERAGE_SHM_ENV is set, otherwise
+// allocates a private, zeroed map.
+bool init_coverage(Coverage_t *coverage);
+void free_coverage(Coverage_t *coverage);
+// Writes the raw map to `path`.
+bool coverage_save(const Coverage_t *coverage, const char *path);
+
+// Serves afl-fuzz's fork server protocol: the caller is forked once per
+// input and this returns in each child. Returns at once when no fork server
+// pipe is open, as when afl-fuzz runs with AFL_NO_FORKSRV or without afl.
+// afl-fuzz counts a run as a crash only when a signal ends it, so callers
+// should end guest faults with one.
+void coverage_fork_server(void);
+
+static inline void coverage_edge(Coverage_t *coverage, uint32_t pc) {
+  uint32_t location = ((pc >> 4) ^ (pc << 8)) & (COVERAGE_MAP_SIZE - 1);
+  coverage->map[location ^ coverage->prev_location]++;
+  coverage->prev_location = location >> 1;
+}
+
+#endif
@@ -11,6 +11,7 @@ typedef struct CPU {
   uint32_t current_inst_len;
   int exit_code;
   bool halt;
+  bool faulted; // Stopped by a memory fault or an illegal instruction.
 } CPU_t;
 
 void init_cpu(CPU_t *cpu);
@@ -5,6 +5,9 @@
 
 #include <stdint.h>
 
+typedef void (*InstructionHandler)(uint32_t inst, RvContext_t *context);
+
+InstructionHandler decode_instruction(uint32_t inst);
 void decode_and_execute(uint32_t inst, RvContext_t *context);
 
 #endif
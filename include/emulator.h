@@ -3,6 +3,9 @@
 
 #include "rv_context.h"
 
+#include <stdbool.h>
+#include <stdint.h>
+
 typedef enum { RV_STEP_EXECUTED, RV_STEP_STOPPED } RvStepStatus;
 
 typedef struct {
@@ -15,4 +18,24 @@ typedef struct {
 
 RvStepResult rv_step(RvContext_t *context);
 
+// Runs until the guest halts or a limit in context stops it, and records
+// why in context->stop_reason. Uses predecoded blocks when context->blocks
+// is set, and single-steps through rv_step otherwise.
+void rv_run(RvContext_t *context);
+
+typedef enum { RV_RUN_BLOCK, RV_RUN_STEP, RV_RUN_STOP } RvRunCheck;
+
+// Checks the breakpoints and limits in context before running `count` more
+// instructions from cpu->pc. Returns RV_RUN_STEP when only single steps
+// still fit the instruction budget, and RV_RUN_STOP, after halting the
+// guest, when it must stop. Engines call this once per block.
+RvRunCheck rv_check_limits(RvContext_t *context, uint32_t count);
+
+// Stops rv_run on context at the first block boundary after `milliseconds`
+// of wall-clock time, using SIGALRM; a process has one deadline at a time.
+bool rv_set_deadline(RvContext_t *context, uint64_t milliseconds);
+
+// Disarms the deadline timer and detaches it from context.
+void rv_clear_deadline(RvContext_t *context);
+
 #endif
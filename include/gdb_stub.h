@@ -0,0 +1,39 @@
+#ifndef GDB_STUB_H
+#define GDB_STUB_H
+
+#include "breakpoints.h"
+#include "rv_context.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A gdb remote serial protocol server for one guest: registers, memory,
+// single-step, continue and software breakpoints. Breakpoints live in a
+// Breakpoints_t that rv_run checks at block starts, so the guest runs on
+// predecoded blocks between them.
+
+#define GDB_PACKET_SIZE 4096
+// Instructions run between checks for an interrupt (Ctrl-C) from gdb.
+#define GDB_RUN_SLICE (1u << 20)
+
+typedef struct GdbStub {
+  int fd;
+  RvContext_t *context;
+  Breakpoints_t breakpoints;
+  uint64_t instruction_limit; // The context's own limit, restored on exit.
+  char packet[GDB_PACKET_SIZE];
+  char reply[GDB_PACKET_SIZE];
+  size_t reply_length;
+} GdbStub_t;
+
+// Waits for gdb on `address`, a TCP port on 127.0.0.1 or else a Unix socket
+// path, and serves it until gdb detaches or kills the guest or the guest
+// exits. After a detach the guest runs on to its end. Returns false when
+// the socket cannot be set up.
+bool gdb_serve(RvContext_t *context, const char *address);
+
+// Serves gdb on the connected socket `fd`, as gdb_serve.
+bool gdb_serve_fd(RvContext_t *context, int fd);
+
+#endif
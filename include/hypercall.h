@@ -0,0 +1,66 @@
+#ifndef HYPERCALL_H
+#define HYPERCALL_H
+
+#include "rv_context.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Host kernels the guest calls through the custom-0 and custom-1 opcodes.
+// A hypercall is an R-type instruction with rd, rs1 and rs2 all x0; its
+// number is funct3 * 128 + funct7, plus 1024 under custom-1:
+//
+//   .insn r 0x0b, 0, 0, x0, x0, x0   # hypercall 0 (HYPERCALL_HASH)
+//
+// Arguments are in a0-a7, as for a function call, and the kernel leaves
+// its results there, normally in a0 and a1. Kernels work on guest buffers
+// in place through hypercall_buffer. Calling a number nobody registered
+// is an illegal instruction.
+
+#define HYPERCALL_COUNT 2048
+#define HYPERCALL_CUSTOM_1_BASE 1024
+
+// Registered by hypercall_register_builtins.
+//
+// HYPERCALL_HASH(addr, size): the 64-bit FNV-1a hash of the buffer, low
+// word in a0 and high word in a1.
+#define HYPERCALL_HASH 0
+// HYPERCALL_MATMUL(c, a, b, rows, inner, columns): c = a * b on row-major
+// int32 matrices, wrapping on overflow. c must not overlap a or b.
+#define HYPERCALL_MATMUL 1
+
+// `args` points at the guest's a0-a7. Returns false, after reporting why,
+// to stop the guest with exit code 1.
+typedef bool (*HypercallKernel)(RvContext_t *context, uint32_t *args,
+                                void *arg);
+
+typedef struct HypercallEntry {
+  HypercallKernel kernel;
+  void *arg;
+  const char *name;
+} HypercallEntry_t;
+
+typedef struct Hypercalls {
+  HypercallEntry_t *entries; // HYPERCALL_COUNT, indexed by number.
+} Hypercalls_t;
+
+bool init_hypercalls(Hypercalls_t *hypercalls);
+void free_hypercalls(Hypercalls_t *hypercalls);
+// Returns false when `number` is out of range or already taken.
+bool hypercall_register(Hypercalls_t *hypercalls, uint32_t number,
+                        const char *name, HypercallKernel kernel, void *arg);
+bool hypercall_register_builtins(Hypercalls_t *hypercalls);
+
+// Returns the host address of `size` guest bytes at `addr` when the guest
+// itself may access all of them with `prot`, otherwise reports the fault
+// and returns NULL. Buffers asked for with MEMORY_PROT_WRITE count as
+// written, so code cached from them is dropped.
+uint8_t *hypercall_buffer(RvContext_t *context, uint32_t addr, size_t size,
+                          uint8_t prot);
+
+uint32_t hypercall_number(uint32_t inst);
+// The handler for both opcodes; runs context->hypercalls' kernel.
+void handle_hypercall(uint32_t inst, RvContext_t *context);
+
+#endif
@@ -48,6 +48,7 @@ void handle_or(uint32_t inst, RvContext_t *context);
 void handle_and(uint32_t inst, RvContext_t *context);
 
 void handle_fence(uint32_t inst, RvContext_t *context);
+void handle_fence_i(uint32_t inst, RvContext_t *context);
 void handle_ecall(uint32_t inst, RvContext_t *context);
 void handle_ebreak(uint32_t inst, RvContext_t *context);
 void handle_illegal_instruction(uint32_t inst, RvContext_t *context);
@@ -0,0 +1,60 @@
+#ifndef INTERCEPT_H
+#define INTERCEPT_H
+
+#include "rv_context.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Runs well-known guest libc routines on the host. The program's symbol
+// table gives the entry point of each routine on the allowlist; a call that
+// lands on one runs the host's (vectorized) libc routine directly on guest
+// memory, sets a0 and returns to ra, as one retired instruction. Calls are
+// seen in the jal and jalr handlers, which every engine but ahead-of-time
+// code runs, and at block entry in ahead-of-time runners. A call whose
+// arguments the guest could not access itself, such as an unterminated
+// string or a read-only destination, runs the guest routine instead so that
+// it faults as it would have. Cache and timing models do not see the work.
+
+#define INTERCEPT_MAX_ENTRIES 32
+
+typedef enum InterceptRoutine {
+  INTERCEPT_MEMCPY,
+  INTERCEPT_MEMSET,
+  INTERCEPT_MEMMOVE,
+  INTERCEPT_STRLEN,
+  INTERCEPT_STRCMP,
+  INTERCEPT_MEMCMP,
+  INTERCEPT_ROUTINES,
+} InterceptRoutine;
+
+#define INTERCEPT_ALL ((1u << INTERCEPT_ROUTINES) - 1)
+
+typedef struct Intercepts {
+  uint32_t allowed; // Bit per InterceptRoutine.
+  uint32_t pcs[INTERCEPT_MAX_ENTRIES];
+  uint8_t routines[INTERCEPT_MAX_ENTRIES];
+  size_t count;
+  uint32_t low_pc; // Bounds of pcs, to turn most calls away quickly.
+  uint32_t high_pc;
+  uint64_t calls[INTERCEPT_ROUTINES];
+} Intercepts_t;
+
+// Parses a comma-separated list of routine names into a mask. An empty list
+// or name is an error, like an unknown name, rather than an empty mask.
+bool intercept_parse(const char *list, uint32_t *allowed);
+void init_intercepts(Intercepts_t *intercepts, uint32_t allowed);
+// Adds the entry points of allowed routines defined in the ELF file's
+// symbol table and returns how many it found.
+size_t intercept_load_symbols(Intercepts_t *intercepts, const char *path);
+// Adds `pc` as an entry point of `routine`.
+bool intercept_add(Intercepts_t *intercepts, uint32_t pc,
+                   InterceptRoutine routine);
+
+// Runs the routine entered at `target` when there is one and its arguments
+// are accessible, leaving the result in a0. The caller then continues at
+// ra. Returns false when the guest code has to run.
+bool intercept_call(RvContext_t *context, uint32_t target);
+
+#endif
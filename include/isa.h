@@ -0,0 +1,36 @@
+#ifndef ISA_H
+#define ISA_H
+
+#include "utils.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Compile-time ISA configuration. The Makefile defines RV_HAS_M and RV_HAS_C
+// from ISA (default rv32imc). Code tests these constants in ordinary `if`s,
+// so every configuration is still type-checked while the compiler removes
+// the branches for extensions that are left out.
+
+#ifdef RV_HAS_M
+#define RV_ISA_HAS_M 1
+#else
+#define RV_ISA_HAS_M 0
+#endif
+
+#ifdef RV_HAS_C
+#define RV_ISA_HAS_C 1
+#else
+#define RV_ISA_HAS_C 0
+#endif
+
+// Identifies the configuration in files that hold decoded instructions.
+#define RV_ISA_ID (RV_ISA_HAS_M | RV_ISA_HAS_C << 1)
+
+// Without C, instructions are 4-byte aligned and every parcel is 32 bits.
+#define RV_INSTRUCTION_ALIGN (RV_ISA_HAS_C ? 2 : 4)
+
+static inline bool rv_is_compressed(uint16_t half) {
+  return RV_ISA_HAS_C && is_compressed(half);
+}
+
+#endif
@@ -4,13 +4,24 @@
 #include "cpu.h"
 #include "memory.h"
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define EI_CLASS 4
 #define ELFCLASS32 1
 #define ET_EXEC 2
 #define EM_RISCV 243
+#define EF_RISCV_RVC 0x0001
 #define PT_LOAD 1
+#define PF_X 0x1
+#define PF_W 0x2
+#define PF_R 0x4
+#define SHT_SYMTAB 2
+#define SHN_UNDEF 0
+#define STT_NOTYPE 0
+#define STT_FUNC 2
+#define ELF32_ST_TYPE(info) ((info) & 0xf)
 
 typedef struct Elf32_Ehdr {
   unsigned char e_ident[16];
@@ -40,6 +51,46 @@ typedef struct Elf32_Phdr {
   uint32_t p_align;
 } Elf32_Phdr_t;
 
-void load_elf(CPU_t *cpu, Memory_t *memory, const char *filename);
+typedef struct Elf32_Shdr {
+  uint32_t sh_name;
+  uint32_t sh_type;
+  uint32_t sh_flags;
+  uint32_t sh_addr;
+  uint32_t sh_offset;
+  uint32_t sh_size;
+  uint32_t sh_link;
+  uint32_t sh_info;
+  uint32_t sh_addralign;
+  uint32_t sh_entsize;
+} Elf32_Shdr_t;
+
+typedef struct Elf32_Sym {
+  uint32_t st_name;
+  uint32_t st_value;
+  uint32_t st_size;
+  unsigned char st_info;
+  unsigned char st_other;
+  uint16_t st_shndx;
+} Elf32_Sym_t;
+
+// What the loader saw of the program, beyond what it put in cpu and memory.
+typedef struct ElfInfo {
+  size_t exec_segment_count;
+  // hash_bytes over each executable segment's address, size and loaded
+  // contents; identifies the program's code across runs.
+  uint64_t exec_hash;
+} ElfInfo_t;
+
+// `info` may be NULL.
+void load_elf(CPU_t *cpu, Memory_t *memory, const char *filename,
+              ElfInfo_t *info);
+
+typedef void (*ElfFunctionVisitor)(void *arg, const char *name,
+                                   uint32_t addr);
+// Calls `visit` for each defined function in the symbol table of
+// `filename`. Returns false, without a message, when the file has no
+// readable symbol table, as after strip.
+bool elf_visit_functions(const char *filename, ElfFunctionVisitor visit,
+                         void *arg);
 
 #endif
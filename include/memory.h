@@ -4,24 +4,174 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #define MEMORY_SIZE_BYTES (16 * 1024 * 1024)
+#define GUEST_PAGE_SIZE 4096
+#define STACK_RESERVE_BYTES (1024 * 1024)
+#define MEMORY_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// Page protection bits use the guest PROT_* values.
+#define MEMORY_PROT_READ 0x1
+#define MEMORY_PROT_WRITE 0x2
+#define MEMORY_PROT_EXEC 0x4
+#define MEMORY_PROT_MASK 0x7
+// Set on pages owned by a guest mmap; munmap only releases these.
+#define MEMORY_PAGE_MAPPED 0x8
+// Set on pages holding predecoded code; writes to them call code_write.
+#define MEMORY_PAGE_CODE 0x10
+// Set on pages whose contents or flags changed since the baseline.
+#define MEMORY_PAGE_DIRTY 0x20
+
+// Direct-mapped, one table per access kind. An entry only exists for a page
+// that lies wholly inside guest memory and grants that access, so a hit is a
+// single tag compare. Write entries also skip pages holding code, which
+// keeps the code_write check off the store fast path.
+#define MEMORY_TLB_ENTRIES 64
+#define MEMORY_TLB_INVALID UINT32_MAX
+
+typedef struct MemoryTlbEntry {
+  uint32_t tag;  // Guest page number, or MEMORY_TLB_INVALID.
+  uint8_t *host; // Host address of the page's first byte.
+} MemoryTlbEntry_t;
+
+typedef struct MemoryTlb {
+  MemoryTlbEntry_t read[MEMORY_TLB_ENTRIES];
+  MemoryTlbEntry_t write[MEMORY_TLB_ENTRIES];
+  MemoryTlbEntry_t exec[MEMORY_TLB_ENTRIES];
+} MemoryTlb_t;
+
+// How the host backs guest memory. A request that the host cannot meet
+// falls back to the next kind down.
+typedef enum MemoryBacking {
+  MEMORY_BACKING_SMALL,   // Host base pages.
+  MEMORY_BACKING_THP,     // Huge page aligned, advised for transparent huge
+                          // pages. Needs at least one huge page of memory.
+  MEMORY_BACKING_HUGETLB, // Explicit huge pages from the hugetlbfs pool.
+                          // Needs a whole number of huge pages.
+} MemoryBacking;
+
+#define MEMORY_BASELINE_ZERO UINT32_MAX
+
+// Guest memory as it was when captured, for resetting between runs.
+typedef struct MemoryBaseline {
+  uint8_t *flags;  // Page flags, without MEMORY_PAGE_CODE.
+  uint32_t *slots; // Per page: index into data, or MEMORY_BASELINE_ZERO.
+  uint8_t *data;   // Copies of the pages that were not all zero.
+  uint32_t program_break;
+} MemoryBaseline_t;
+
+typedef void (*MemoryWriteHook)(void *arg, uint32_t addr, size_t size);
+// Sees each guest load, store and instruction fetch; `access` is one of
+// MEMORY_PROT_READ, MEMORY_PROT_WRITE and MEMORY_PROT_EXEC.
+typedef void (*MemoryObserver)(void *arg, uint32_t addr, size_t size,
+                               uint8_t access);
 
 typedef struct Memory {
   uint8_t *data;
   size_t size;
+  MemoryBacking backing; // What the host actually provided.
   uint32_t base;
   uint32_t program_break;
+  // One entry per guest page, counted from the page containing base.
+  uint8_t *pages;
+  size_t page_count;
+  // Protection of pages outside any guest mapping; munmap restores it.
+  uint8_t default_prot;
+  // Filled by const accessors too, so it lives outside the struct.
+  MemoryTlb_t *tlb;
+  // Pages marked MEMORY_PAGE_DIRTY, each listed once.
+  uint32_t *dirty;
+  size_t dirty_count;
+  MemoryBaseline_t *baseline;
+  MemoryWriteHook code_write;
+  void *code_write_arg;
+  MemoryObserver observer;
+  void *observer_arg;
 } Memory_t;
 
+// Backs memory with transparent huge pages when it is large enough.
 bool init_memory(Memory_t *memory, size_t size);
+bool init_memory_backed(Memory_t *memory, size_t size, MemoryBacking backing);
+const char *memory_backing_name(MemoryBacking backing);
 void free_memory(Memory_t *memory);
 
 bool validate_mem_access(const Memory_t *memory, uint32_t addr, size_t size);
 bool validate_alignment(uint32_t addr, size_t size);
+// Bypasses page protection; for syscalls, the loader and the debugger.
 bool memory_get_pointer(Memory_t *memory, uint32_t addr, size_t size,
                         uint8_t **pointer);
 
+// Returns the host address of `size` bytes at `addr` when every page they
+// touch grants all of `prot`, filling the TLB for that access; otherwise
+// reports the fault and returns NULL.
+uint8_t *memory_access(const Memory_t *memory, uint32_t addr, size_t size,
+                       uint8_t prot);
+// As memory_access, but only answers whether the access is allowed.
+bool memory_allows(const Memory_t *memory, uint32_t addr, size_t size,
+                   uint8_t prot);
+
+// Returns the host address of `addr` when its page has an entry in `tlb`,
+// otherwise NULL. The access must not cross into the next page.
+static inline uint8_t *memory_tlb_lookup(const MemoryTlbEntry_t *tlb,
+                                         uint32_t addr) {
+  uint32_t page = addr / GUEST_PAGE_SIZE;
+  const MemoryTlbEntry_t *entry = &tlb[page % MEMORY_TLB_ENTRIES];
+  if (entry->tag != page)
+    return NULL;
+  return entry->host + addr % GUEST_PAGE_SIZE;
+}
+
+bool memory_is_page_range(const Memory_t *memory, uint32_t addr,
+                          uint32_t size);
+bool memory_range_is_free(const Memory_t *memory, uint32_t addr,
+                          uint32_t size);
+bool memory_find_free(const Memory_t *memory, uint32_t low, uint32_t high,
+                      uint32_t size, uint32_t *addr);
+bool memory_map_anonymous(Memory_t *memory, uint32_t addr, uint32_t size,
+                          uint8_t prot);
+bool memory_map_file(Memory_t *memory, uint32_t addr, uint32_t size,
+                     uint8_t prot, int fd, uint64_t offset, bool shared);
+void memory_unmap(Memory_t *memory, uint32_t addr, uint32_t size);
+void memory_protect(Memory_t *memory, uint32_t addr, uint32_t size,
+                    uint8_t prot);
+// Sets the protection of every page outside a guest mapping, and the one
+// munmap leaves behind, to `prot`.
+void memory_set_default_prot(Memory_t *memory, uint8_t prot);
+// Add or remove `prot` on every page overlapping [addr, addr + size), which
+// need not be page aligned; the loader uses them for segments that share a
+// page.
+void memory_grant(Memory_t *memory, uint32_t addr, uint32_t size,
+                  uint8_t prot);
+void memory_revoke(Memory_t *memory, uint32_t addr, uint32_t size,
+                   uint8_t prot);
+void memory_flush_tlb(const Memory_t *memory);
+
+void memory_set_code_hook(Memory_t *memory, MemoryWriteHook hook, void *arg);
+// While an observer is set the TLB stays empty, so every access takes the
+// slow path that reports it and the fast path is untouched otherwise.
+void memory_set_observer(Memory_t *memory, MemoryObserver observer,
+                         void *arg);
+void memory_mark_code(Memory_t *memory, uint32_t addr, size_t size);
+void memory_clear_code(Memory_t *memory);
+void memory_mark_written(Memory_t *memory, uint32_t addr, size_t size);
+
+// Records the current contents, page flags and program break, typically
+// right after load_elf, and starts tracking dirty pages from there.
+bool memory_capture_baseline(Memory_t *memory);
+// Restores the captured state in time proportional to the pages changed
+// since the capture or the last reset. Cached code on those pages is
+// dropped through the code_write hook.
+void memory_reset_to_baseline(Memory_t *memory);
+
+// Writes the contents, page flags, default protection and program break to
+// `fp`, skipping pages that are all zero.
+bool memory_save_image(const Memory_t *memory, FILE *fp);
+// Replaces all of that with an image saved from memory of the same layout.
+// Cached code is not dropped: load before building any. On failure memory
+// is left partly loaded.
+bool memory_load_image(Memory_t *memory, FILE *fp);
+
 bool read_byte(const Memory_t *memory, uint32_t addr, uint8_t *value);
 bool read_half(const Memory_t *memory, uint32_t addr, uint16_t *value);
 bool read_word(const Memory_t *memory, uint32_t addr, uint32_t *value);
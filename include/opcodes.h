@@ -12,5 +12,7 @@
 #define OPCODE_OP 0b0110011
 #define OPCODE_MISC_MEM 0b0001111
 #define OPCODE_SYSTEM 0b1110011
+#define OPCODE_CUSTOM_0 0b0001011
+#define OPCODE_CUSTOM_1 0b0101011
 
 #endif
\ No newline at end of file
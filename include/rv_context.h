@@ -4,9 +4,52 @@
 #include "cpu.h"
 #include "memory.h"
 
+#include <signal.h>
+#include <stdint.h>
+
+struct AotState;
+struct Bbv;
+struct BlockCache;
+struct Breakpoints;
+struct Coverage;
+struct Hypercalls;
+struct Intercepts;
+struct SyscallState;
+struct Timing;
+
+// Why rv_run returned.
+typedef enum {
+  RV_STOP_HALTED,     // The guest exited or faulted; see cpu->exit_code.
+  RV_STOP_BUDGET,     // instruction_limit instructions retired.
+  RV_STOP_DEADLINE,   // The deadline set by rv_set_deadline passed.
+  RV_STOP_BREAKPOINT, // cpu->pc is in breakpoints.
+} RvStopReason;
+
 typedef struct RvContext {
   CPU_t *cpu;
   Memory_t *memory;
+  struct BlockCache *blocks;
+  struct SyscallState *syscalls;
+  struct AotState *aot;
+  struct Coverage *coverage; // Edge map to update, or NULL.
+  struct Bbv *bbv;           // Basic-block vectors to update, or NULL.
+  struct Intercepts *intercepts; // Guest routines run on the host, or NULL.
+  struct Hypercalls *hypercalls; // Kernels for custom opcodes, or NULL.
+  // Pipeline model charged by the interpreter, or NULL. Predecoded and
+  // translated blocks do not feed it.
+  struct Timing *timing;
+
+  // Limits checked by rv_run at block boundaries. A limit that stops the
+  // guest sets cpu->halt and leaves cpu->exit_code alone; clear cpu->halt to
+  // resume.
+  uint64_t instruction_limit; // 0 for no limit.
+  uint64_t instructions_retired;
+  volatile sig_atomic_t *deadline_expired; // Set by rv_set_deadline.
+  // The guest stops before running an instruction at one of these; step it
+  // with rv_step to go on. Predecoded blocks end before breakpoints, but
+  // ahead-of-time translations only stop at breakpoints on block starts.
+  struct Breakpoints *breakpoints;
+  RvStopReason stop_reason;
 } RvContext_t;
 
 #endif
@@ -1,12 +1,80 @@
 #ifndef SYSCALL_H
 #define SYSCALL_H
 
+#include "async_io.h"
 #include "cpu.h"
 #include "memory.h"
 
-void handle_sys_read(CPU_t *cpu, Memory_t *memory);
-void handle_sys_write(CPU_t *cpu, Memory_t *memory);
-void handle_sys_exit(CPU_t *cpu);
+#define SYSCALL_OPENAT 56
+#define SYSCALL_CLOSE 57
+#define SYSCALL_LSEEK 62
+#define SYSCALL_READ 63
+#define SYSCALL_WRITE 64
+#define SYSCALL_READV 65
+#define SYSCALL_WRITEV 66
+#define SYSCALL_FSTAT 80
+#define SYSCALL_FSYNC 82
+#define SYSCALL_FDATASYNC 83
+#define SYSCALL_EXIT 93
+#define SYSCALL_CLOCK_GETTIME 113
+#define SYSCALL_BRK 214
+#define SYSCALL_MUNMAP 215
+#define SYSCALL_MMAP 222
+#define SYSCALL_MPROTECT 226
+#define SYSCALL_GETRANDOM 278
+#define SYSCALL_CLOCK_GETTIME64 403
+
+#define SYSCALL_MAX_FDS 64
+#define SYSCALL_OUTPUT_BUFFER_SIZE (64 * 1024)
+
+typedef enum {
+  // Every guest write is a host write, as the guest observes it.
+  SYSCALL_IO_STRICT,
+  // Guest writes are coalesced per descriptor and flushed when the buffer
+  // fills, before reads, seeks, stats and closes, on fsync and on exit.
+  SYSCALL_IO_BUFFERED,
+  // Guest writes are copied and submitted in batches through `async`; reads
+  // and other descriptor operations wait for earlier writes first.
+  SYSCALL_IO_ASYNC,
+} SyscallIoMode;
+
+typedef struct OutputBuffer {
+  char *data;
+  size_t length;
+} OutputBuffer_t;
+
+struct SyscallLog;
+
+// Guest file descriptors index host_fds; closed entries hold -1.
+typedef struct SyscallState {
+  int host_fds[SYSCALL_MAX_FDS];
+  SyscallIoMode io_mode;
+  OutputBuffer_t output[SYSCALL_MAX_FDS];
+  struct AsyncIo *async;
+  struct SyscallLog *log; // Records or replays syscalls when set.
+} SyscallState_t;
+
+void init_syscall_state(SyscallState_t *state);
+void free_syscall_state(SyscallState_t *state);
+void syscall_flush_output(SyscallState_t *state);
+
+void handle_sys_openat(CPU_t *cpu, Memory_t *memory, SyscallState_t *state);
+void handle_sys_close(CPU_t *cpu, SyscallState_t *state);
+void handle_sys_lseek(CPU_t *cpu, SyscallState_t *state);
+void handle_sys_read(CPU_t *cpu, Memory_t *memory, SyscallState_t *state);
+void handle_sys_write(CPU_t *cpu, Memory_t *memory, SyscallState_t *state);
+void handle_sys_readv(CPU_t *cpu, Memory_t *memory, SyscallState_t *state);
+void handle_sys_writev(CPU_t *cpu, Memory_t *memory, SyscallState_t *state);
+void handle_sys_fstat(CPU_t *cpu, Memory_t *memory, SyscallState_t *state);
+void handle_sys_fsync(CPU_t *cpu, SyscallState_t *state, bool data_only);
+void handle_sys_exit(CPU_t *cpu, SyscallState_t *state);
+void handle_sys_clock_gettime(CPU_t *cpu, Memory_t *memory,
+                              SyscallState_t *state, bool time64);
 void handle_sys_brk(CPU_t *cpu, Memory_t *memory);
+void handle_sys_mmap(CPU_t *cpu, Memory_t *memory, SyscallState_t *state);
+void handle_sys_munmap(CPU_t *cpu, Memory_t *memory);
+void handle_sys_mprotect(CPU_t *cpu, Memory_t *memory);
+void handle_sys_getrandom(CPU_t *cpu, Memory_t *memory,
+                          SyscallState_t *state);
 
 #endif
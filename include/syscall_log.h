@@ -0,0 +1,82 @@
+#ifndef SYSCALL_LOG_H
+#define SYSCALL_LOG_H
+
+#include "cpu.h"
+#include "memory.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Everything the host hands the guest through ECALL, logged so that a run can
+// be repeated exactly. A log is a header and then one record per syscall:
+// its number and result, followed by each range of guest memory it filled
+// and the bytes it left there. Recording only appends. Replay answers the
+// syscalls that touch host descriptors, clocks or randomness from the log
+// without running them; the rest only change emulator state, so they run
+// again and their results are checked against the log.
+
+#define SYSCALL_LOG_MAGIC 0x4c535652u // "RVSL"
+#define SYSCALL_LOG_VERSION 1
+
+typedef enum { SYSCALL_LOG_RECORD, SYSCALL_LOG_REPLAY } SyscallLogMode;
+
+typedef struct SyscallLogHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key; // Identifies the program, as ElfInfo_t.exec_hash.
+} SyscallLogHeader_t;
+
+typedef struct SyscallLogRecord {
+  uint32_t number; // a7
+  uint32_t result; // a0 after the syscall.
+  uint32_t output_count;
+} SyscallLogRecord_t;
+
+// Followed by `size` bytes.
+typedef struct SyscallLogOutput {
+  uint32_t addr;
+  uint32_t size;
+} SyscallLogOutput_t;
+
+typedef struct SyscallLog {
+  FILE *file;
+  SyscallLogMode mode;
+  uint64_t syscalls; // Syscalls recorded or replayed so far.
+  bool failed;       // Recording lost part of the log.
+  // Recording: ranges the current syscall filled, written when it ends.
+  SyscallLogOutput_t *outputs;
+  size_t output_count;
+  size_t output_capacity;
+  // Replay: a record already read by syscall_log_peek.
+  SyscallLogRecord_t next;
+  bool has_next;
+} SyscallLog_t;
+
+// Replay fails when the log was recorded for another `key`.
+bool syscall_log_open(SyscallLog_t *log, const char *path, SyscallLogMode mode,
+                      uint64_t key);
+// Returns false when the log could not be written completely.
+bool syscall_log_close(SyscallLog_t *log);
+
+// True when replay answers syscall `number` from the log instead of running
+// it.
+bool syscall_log_replaces(const SyscallLog_t *log, uint32_t number);
+
+// While recording, notes that the current syscall filled `size` bytes at
+// `addr`.
+void syscall_log_output(SyscallLog_t *log, uint32_t addr, size_t size);
+
+// While replaying, reads the logged result of syscall `number` ahead of
+// syscall_log_finish. Returns false when the log does not continue with it.
+bool syscall_log_peek(SyscallLog_t *log, uint32_t number, uint32_t *result);
+
+// Ends syscall `number`. Recording logs a0 and the filled memory. Replay
+// copies the logged memory back, then sets a0 when the syscall did not run,
+// or checks it when it did; a log that ends early or diverges halts the
+// guest.
+void syscall_log_finish(SyscallLog_t *log, CPU_t *cpu, Memory_t *memory,
+                        uint32_t number, bool executed);
+
+#endif
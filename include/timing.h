@@ -0,0 +1,71 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// A cycle-approximate model of a single-issue, in-order RV32 pipeline. Every
+// retired instruction costs one cycle plus:
+//  - the extra latency of a multiply or divide, which block the pipeline;
+//  - a load-use stall when it reads the register a load just wrote;
+//  - a redirect penalty when it is a taken jump or a correctly predicted
+//    taken branch, or a mispredict penalty when it is a mispredicted branch
+//    or an indirect jump, which the model has no target predictor for.
+// The interpreter's branch and jump handlers report outcomes through
+// timing_branch and rv_step retires instructions through timing_retire;
+// both are skipped when no model is attached.
+
+typedef enum TimingPredictor {
+  TIMING_PREDICT_NOT_TAKEN, // Static: every branch falls through.
+  TIMING_PREDICT_BIMODAL,   // Two-bit counters indexed by pc.
+  TIMING_PREDICT_GSHARE,    // Two-bit counters indexed by pc ^ history.
+} TimingPredictor;
+
+typedef struct TimingConfig {
+  TimingPredictor predictor;
+  uint32_t entries;      // Predictor counters; a power of two.
+  uint32_t history_bits; // Global history length for gshare.
+  uint32_t mul_latency;  // Cycles for mul, mulh, mulhsu and mulhu.
+  uint32_t div_latency;  // Cycles for div, divu, rem and remu.
+  uint32_t load_use;     // Stall cycles for a load's result used next.
+  uint32_t taken;        // Cycles lost fetching from a taken target.
+  uint32_t mispredict;   // Cycles lost flushing a mispredicted path.
+} TimingConfig_t;
+
+typedef struct Timing {
+  TimingConfig_t config;
+  uint8_t *counters; // Two-bit saturating counters; 2 and up predict taken.
+  uint32_t history;
+  uint32_t load_rd; // Register the last retired load wrote, or 0.
+
+  uint64_t cycles;
+  uint64_t instructions;
+  uint64_t muldiv_cycles;
+  uint64_t load_use_stalls;
+  uint64_t branches;
+  uint64_t mispredicts;
+  uint64_t jumps;
+  uint64_t redirect_cycles; // Taken and mispredict penalties together.
+} Timing_t;
+
+void timing_default_config(TimingConfig_t *config);
+// Parses comma-separated key=value pairs over `config`: predictor=
+// not-taken|bimodal|gshare, and entries, history, mul, div, load-use,
+// taken and mispredict as counts.
+bool timing_parse(const char *spec, TimingConfig_t *config);
+
+bool init_timing(Timing_t *timing, const TimingConfig_t *config);
+void free_timing(Timing_t *timing);
+
+// Reports a control transfer at `pc`: a conditional branch and whether it
+// was taken, or an unconditional jump, direct or not.
+void timing_branch(Timing_t *timing, uint32_t pc, bool conditional,
+                   bool taken, bool indirect);
+// Charges one retired instruction, after expansion from compressed form.
+void timing_retire(Timing_t *timing, uint32_t inst);
+
+// Prints cycles, IPC and where the stall cycles went.
+void timing_report(const Timing_t *timing, FILE *out);
+
+#endif
@@ -2,8 +2,12 @@
 #define UTILS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+// Initial value for hash_bytes (64-bit FNV-1a).
+#define HASH_SEED 0xcbf29ce484222325ULL
+
 uint8_t get_opcode(uint32_t inst);
 uint8_t get_funct3(uint32_t inst);
 uint8_t get_funct7(uint32_t inst);
@@ -31,4 +35,7 @@ uint32_t build_j_type(uint32_t opcode, uint32_t rd, int32_t imm);
 
 bool is_compressed(uint16_t half);
 
+// Folds `size` bytes into `hash`; start from HASH_SEED.
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t size);
+
 #endif
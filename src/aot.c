@@ -0,0 +1,158 @@
+#include "aot.h"
+
+#include "bbv.h"
+#include "coverage.h"
+#include "emulator.h"
+#include "intercept.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool program_matches(Memory_t *memory, const AotProgram_t *program) {
+  for (size_t i = 0; i < program->segment_count; i++) {
+    const AotSegment_t *segment = &program->segments[i];
+    uint8_t *bytes;
+    if (!memory_get_pointer(memory, segment->vaddr, segment->size, &bytes) ||
+        hash_bytes(HASH_SEED, bytes, segment->size) != segment->hash)
+      return false;
+  }
+  return true;
+}
+
+static size_t slot_index(uint32_t pc, size_t mask) {
+  return ((pc >> 1) * 0x9E3779B1u) & mask;
+}
+
+static bool init_aot_state(AotState_t *state, const AotProgram_t *program) {
+  memset(state, 0, sizeof(*state));
+  state->program = program;
+
+  size_t slot_count = 16;
+  while (slot_count < program->block_count * 2)
+    slot_count *= 2;
+  state->slot_mask = slot_count - 1;
+  state->slots = (uint32_t *)calloc(slot_count, sizeof(uint32_t));
+  state->disabled = (bool *)calloc(program->block_count + 1, sizeof(bool));
+  if (!state->slots || !state->disabled) {
+    perror("Error: Failed to allocate AOT state");
+    free(state->slots);
+    free(state->disabled);
+    return false;
+  }
+
+  for (size_t i = 0; i < program->block_count; i++) {
+    size_t slot = slot_index(program->blocks[i].start_pc, state->slot_mask);
+    while (state->slots[slot] != 0)
+      slot = (slot + 1) & state->slot_mask;
+    state->slots[slot] = (uint32_t)i + 1;
+  }
+  return true;
+}
+
+static void free_aot_state(AotState_t *state) {
+  free(state->slots);
+  free(state->disabled);
+  memset(state, 0, sizeof(*state));
+}
+
+static const AotBlock_t *find_block(const AotState_t *state, uint32_t pc) {
+  const AotBlock_t *blocks = state->program->blocks;
+  size_t slot = slot_index(pc, state->slot_mask);
+  while (state->slots[slot] != 0) {
+    size_t index = state->slots[slot] - 1;
+    if (blocks[index].start_pc == pc)
+      return state->disabled[index] ? NULL : &blocks[index];
+    slot = (slot + 1) & state->slot_mask;
+  }
+  return NULL;
+}
+
+// Overwritten blocks run on the interpreter from then on. A block is at most
+// AOT_MAX_BLOCK_BYTES long, so only blocks starting that far below the write
+// can overlap it.
+static void code_write_hook(void *arg, uint32_t addr, size_t size) {
+  AotState_t *state = (AotState_t *)arg;
+  const AotBlock_t *blocks = state->program->blocks;
+  uint32_t low = addr > AOT_MAX_BLOCK_BYTES ? addr - AOT_MAX_BLOCK_BYTES : 0;
+  uint32_t end = addr + (uint32_t)size;
+
+  size_t first = 0;
+  size_t last = state->program->block_count;
+  while (first < last) {
+    size_t middle = first + (last - first) / 2;
+    if (blocks[middle].start_pc < low)
+      first = middle + 1;
+    else
+      last = middle;
+  }
+
+  for (size_t i = first;
+       i < state->program->block_count && blocks[i].start_pc < end; i++) {
+    if (addr < blocks[i].end_pc && !state->disabled[i]) {
+      state->disabled[i] = true;
+      state->code_written = true;
+    }
+  }
+}
+
+bool rv_run_aot(RvContext_t *context, const AotProgram_t *program) {
+  CPU_t *cpu = context->cpu;
+  Memory_t *memory = context->memory;
+
+  if (!program_matches(memory, program)) {
+    fprintf(stderr, "Warning: AOT translation does not match the loaded "
+                    "program; ignoring it\n");
+    return false;
+  }
+
+  AotState_t state;
+  if (!init_aot_state(&state, program))
+    return false;
+
+  for (size_t i = 0; i < program->block_count; i++) {
+    const AotBlock_t *block = &program->blocks[i];
+    memory_mark_code(memory, block->start_pc,
+                     block->end_pc - block->start_pc);
+  }
+  memory_set_code_hook(memory, code_write_hook, &state);
+  context->aot = &state;
+
+  context->stop_reason = RV_STOP_HALTED;
+  if (context->coverage)
+    context->coverage->block_edges = true;
+  while (!cpu->halt) {
+    const AotBlock_t *block = find_block(&state, cpu->pc);
+    RvRunCheck check = rv_check_limits(context, block ? block->count : 1);
+    if (check == RV_RUN_STOP)
+      break;
+    // Translated calls jump straight to their target, so intercepted
+    // routines are caught on entry instead.
+    if (context->intercepts && cpu->regs[1] != cpu->pc &&
+        intercept_call(context, cpu->pc)) {
+      cpu->pc = cpu->regs[1];
+      continue;
+    }
+    if (block && check == RV_RUN_BLOCK) {
+      state.code_written = false;
+      if (context->coverage)
+        coverage_edge(context->coverage, block->start_pc);
+      uint32_t retired = block->run(context);
+      context->instructions_retired += retired;
+      if (context->bbv)
+        bbv_record(context->bbv, block->start_pc, retired);
+    } else {
+      RvStepResult result = rv_step(context);
+      if (result.status == RV_STEP_EXECUTED) {
+        context->instructions_retired++;
+        if (context->bbv)
+          bbv_record(context->bbv, result.pc, 1);
+      }
+    }
+  }
+
+  context->aot = NULL;
+  memory_set_code_hook(memory, NULL, NULL);
+  free_aot_state(&state);
+  return true;
+}
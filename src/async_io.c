@@ -0,0 +1,420 @@
+#include "async_io.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static bool write_all(int fd, const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t written = write(fd, data, length);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += written;
+    length -= (size_t)written;
+  }
+  return true;
+}
+
+static int io_uring_setup_syscall(unsigned int entries,
+                                  struct io_uring_params *params) {
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter_syscall(int fd, unsigned int to_submit,
+                                  unsigned int min_complete,
+                                  unsigned int flags) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                      NULL, 0);
+}
+
+static void free_ring(AsyncRing_t *ring) {
+  if (ring->sqes)
+    munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_map)
+    munmap(ring->cq_map, ring->cq_map_size);
+  if (ring->sq_map)
+    munmap(ring->sq_map, ring->sq_map_size);
+  if (ring->fd >= 0)
+    close(ring->fd);
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = -1;
+}
+
+static void *map_ring(int fd, size_t size, off_t offset) {
+  void *map =
+      mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+           offset);
+  return map == MAP_FAILED ? NULL : map;
+}
+
+// Sets up a raw io_uring. Writes at the current file position need
+// IORING_FEAT_RW_CUR_POS (Linux 5.6), so older kernels use the workers.
+static bool init_ring(AsyncRing_t *ring) {
+  memset(ring, 0, sizeof(*ring));
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  ring->fd = io_uring_setup_syscall(ASYNC_IO_BATCH_SIZE, &params);
+  if (ring->fd < 0 || !(params.features & IORING_FEAT_RW_CUR_POS)) {
+    free_ring(ring);
+    return false;
+  }
+
+  ring->entries = params.sq_entries;
+  ring->sq_map_size =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  ring->cq_map_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  ring->sq_map = map_ring(ring->fd, ring->sq_map_size, IORING_OFF_SQ_RING);
+  ring->cq_map = map_ring(ring->fd, ring->cq_map_size, IORING_OFF_CQ_RING);
+  ring->sqes = map_ring(ring->fd, ring->sqes_size, IORING_OFF_SQES);
+  if (!ring->sq_map || !ring->cq_map || !ring->sqes) {
+    free_ring(ring);
+    return false;
+  }
+
+  char *sq = (char *)ring->sq_map;
+  char *cq = (char *)ring->cq_map;
+  ring->sq_head = (unsigned int *)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned int *)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned int *)(sq + params.sq_off.array);
+  ring->cq_head = (unsigned int *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned int *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  return true;
+}
+
+static void queue_sqe(AsyncRing_t *ring, uint8_t opcode, int fd, void *data,
+                      size_t length, uint64_t user_data, uint8_t flags) {
+  unsigned int tail = *ring->sq_tail;
+  unsigned int index = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->flags = flags;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)data;
+  sqe->len = (uint32_t)length;
+  sqe->off = (uint64_t)-1;
+  sqe->user_data = user_data;
+
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static bool submit_sqes(AsyncRing_t *ring, unsigned int count) {
+  while (count > 0) {
+    int submitted = io_uring_enter_syscall(ring->fd, count, 0, 0);
+    if (submitted < 0) {
+      if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+        continue;
+      perror("Error: io_uring submission failed");
+      return false;
+    }
+    count -= (unsigned int)submitted;
+  }
+  return true;
+}
+
+static bool next_cqe(AsyncRing_t *ring, bool wait, struct io_uring_cqe *out) {
+  for (;;) {
+    unsigned int head = *ring->cq_head;
+    unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    if (head != tail) {
+      *out = ring->cqes[head & *ring->cq_mask];
+      __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+      return true;
+    }
+    if (!wait)
+      return false;
+    if (io_uring_enter_syscall(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+        errno != EINTR)
+      return false;
+  }
+}
+
+// Submits the batch as one io_uring_enter. Requests for the same fd are
+// queued back to back and linked so the kernel runs them in order.
+static void ring_submit_batch(AsyncIo_t *io, AsyncBatch_t *batch) {
+  bool queued[ASYNC_IO_BATCH_SIZE] = {false};
+
+  for (size_t i = 0; i < batch->count; i++) {
+    if (queued[i])
+      continue;
+
+    int fd = batch->requests[i].fd;
+    for (size_t j = i; j < batch->count; j++) {
+      if (queued[j] || batch->requests[j].fd != fd)
+        continue;
+
+      size_t next = j + 1;
+      while (next < batch->count && batch->requests[next].fd != fd)
+        next++;
+
+      AsyncRequest_t *request = &batch->requests[j];
+      queue_sqe(&io->ring, IORING_OP_WRITE, fd, request->data, request->length,
+                j, next < batch->count ? IOSQE_IO_LINK : 0);
+      queued[j] = true;
+    }
+  }
+
+  if (!submit_sqes(&io->ring, (unsigned int)batch->count)) {
+    for (size_t i = 0; i < batch->count; i++)
+      batch->requests[i].result = -ECANCELED;
+    io->in_flight_left = 0;
+  }
+}
+
+static void *worker_main(void *arg) {
+  AsyncIo_t *io = (AsyncIo_t *)arg;
+  AsyncWorkers_t *workers = &io->workers;
+
+  pthread_mutex_lock(&workers->lock);
+  for (;;) {
+    while (!workers->stopping && workers->next_chain == workers->chain_count)
+      pthread_cond_wait(&workers->work, &workers->lock);
+    if (workers->next_chain == workers->chain_count)
+      break;
+
+    int fd = workers->chain_fds[workers->next_chain++];
+    AsyncBatch_t *batch = io->in_flight;
+    pthread_mutex_unlock(&workers->lock);
+
+    for (size_t i = 0; i < batch->count; i++) {
+      AsyncRequest_t *request = &batch->requests[i];
+      if (request->fd != fd)
+        continue;
+      request->result = write_all(fd, request->data, request->length)
+                            ? (int32_t)request->length
+                            : -errno;
+    }
+
+    pthread_mutex_lock(&workers->lock);
+    if (--workers->chains_left == 0)
+      pthread_cond_broadcast(&workers->done);
+  }
+  pthread_mutex_unlock(&workers->lock);
+  return NULL;
+}
+
+static bool init_workers(AsyncIo_t *io) {
+  AsyncWorkers_t *workers = &io->workers;
+  memset(workers, 0, sizeof(*workers));
+  pthread_mutex_init(&workers->lock, NULL);
+  pthread_cond_init(&workers->work, NULL);
+  pthread_cond_init(&workers->done, NULL);
+
+  for (size_t i = 0; i < ASYNC_IO_WORKERS; i++) {
+    if (pthread_create(&workers->threads[i], NULL, worker_main, io) != 0)
+      break;
+    workers->thread_count++;
+  }
+  return workers->thread_count > 0;
+}
+
+static void free_workers(AsyncWorkers_t *workers) {
+  pthread_mutex_lock(&workers->lock);
+  workers->stopping = true;
+  pthread_cond_broadcast(&workers->work);
+  pthread_mutex_unlock(&workers->lock);
+
+  for (size_t i = 0; i < workers->thread_count; i++)
+    pthread_join(workers->threads[i], NULL);
+
+  pthread_cond_destroy(&workers->done);
+  pthread_cond_destroy(&workers->work);
+  pthread_mutex_destroy(&workers->lock);
+}
+
+static void workers_submit_batch(AsyncIo_t *io, AsyncBatch_t *batch) {
+  AsyncWorkers_t *workers = &io->workers;
+  pthread_mutex_lock(&workers->lock);
+
+  workers->chain_count = 0;
+  for (size_t i = 0; i < batch->count; i++) {
+    bool seen = false;
+    for (size_t j = 0; j < workers->chain_count; j++)
+      seen = seen || workers->chain_fds[j] == batch->requests[i].fd;
+    if (!seen)
+      workers->chain_fds[workers->chain_count++] = batch->requests[i].fd;
+  }
+  workers->next_chain = 0;
+  workers->chains_left = workers->chain_count;
+
+  pthread_cond_broadcast(&workers->work);
+  pthread_mutex_unlock(&workers->lock);
+}
+
+static void submit_pending(AsyncIo_t *io) {
+  if (io->pending->count == 0)
+    return;
+
+  AsyncBatch_t *batch = io->pending;
+  io->pending = io->in_flight;
+  io->in_flight = batch;
+  io->in_flight_left = batch->count;
+
+  if (io->backend == ASYNC_IO_URING)
+    ring_submit_batch(io, batch);
+  else
+    workers_submit_batch(io, batch);
+}
+
+static bool in_flight_complete(AsyncIo_t *io, bool wait) {
+  if (io->backend == ASYNC_IO_THREADS) {
+    AsyncWorkers_t *workers = &io->workers;
+    pthread_mutex_lock(&workers->lock);
+    while (wait && workers->chains_left > 0)
+      pthread_cond_wait(&workers->done, &workers->lock);
+    bool complete = workers->chains_left == 0;
+    pthread_mutex_unlock(&workers->lock);
+    return complete;
+  }
+
+  struct io_uring_cqe cqe;
+  while (io->in_flight_left > 0 && next_cqe(&io->ring, wait, &cqe)) {
+    io->in_flight->requests[cqe.user_data].result = cqe.res;
+    io->in_flight_left--;
+  }
+  return io->in_flight_left == 0;
+}
+
+// Retires the in-flight batch. A short write breaks an io_uring link and
+// cancels the rest of that fd's chain; those bytes are written here, in
+// order, before anything newer can be submitted.
+static bool finish_in_flight(AsyncIo_t *io, bool wait) {
+  AsyncBatch_t *batch = io->in_flight;
+  if (batch->count == 0)
+    return true;
+  if (!in_flight_complete(io, wait))
+    return false;
+
+  for (size_t i = 0; i < batch->count; i++) {
+    AsyncRequest_t *request = &batch->requests[i];
+    int32_t result = request->result;
+
+    if (result == -ECANCELED ||
+        (result >= 0 && (size_t)result < request->length)) {
+      size_t done = result > 0 ? (size_t)result : 0;
+      if (!write_all(request->fd, request->data + done, request->length - done))
+        result = -errno;
+      else
+        result = (int32_t)request->length;
+    }
+    if (result < 0)
+      fprintf(stderr, "Error: Asynchronous guest write failed: %s\n",
+              strerror(-result));
+
+    free(request->data);
+  }
+  batch->count = 0;
+  batch->bytes = 0;
+  return true;
+}
+
+bool init_async_io(AsyncIo_t *io, bool allow_io_uring) {
+  memset(io, 0, sizeof(*io));
+  io->ring.fd = -1;
+  io->pending = &io->batches[0];
+  io->in_flight = &io->batches[1];
+
+  if (allow_io_uring && init_ring(&io->ring)) {
+    io->backend = ASYNC_IO_URING;
+    return true;
+  }
+
+  io->backend = ASYNC_IO_THREADS;
+  if (!init_workers(io)) {
+    fprintf(stderr, "Error: Failed to start asynchronous I/O workers\n");
+    return false;
+  }
+  return true;
+}
+
+void free_async_io(AsyncIo_t *io) {
+  async_io_drain(io);
+  if (io->backend == ASYNC_IO_URING)
+    free_ring(&io->ring);
+  else
+    free_workers(&io->workers);
+}
+
+const char *async_io_backend_name(const AsyncIo_t *io) {
+  return io->backend == ASYNC_IO_URING ? "io_uring" : "threads";
+}
+
+bool async_io_write(AsyncIo_t *io, int fd, const void *data, size_t length) {
+  struct iovec iov = {.iov_base = (void *)data, .iov_len = length};
+  return async_io_writev(io, fd, &iov, 1);
+}
+
+// Copies the gathered data so the guest may reuse its buffers as soon as
+// this returns. Returns false only when the copy cannot be allocated.
+bool async_io_writev(AsyncIo_t *io, int fd, const struct iovec *iov,
+                     int iovcnt) {
+  size_t length = 0;
+  for (int i = 0; i < iovcnt; i++)
+    length += iov[i].iov_len;
+
+  char *copy = (char *)malloc(length > 0 ? length : 1);
+  if (!copy)
+    return false;
+  size_t offset = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    memcpy(copy + offset, iov[i].iov_base, iov[i].iov_len);
+    offset += iov[i].iov_len;
+  }
+
+  AsyncBatch_t *pending = io->pending;
+  if (pending->count == ASYNC_IO_BATCH_SIZE ||
+      (pending->count > 0 && pending->bytes + length > ASYNC_IO_BATCH_BYTES)) {
+    finish_in_flight(io, true);
+    submit_pending(io);
+  }
+
+  io->pending->requests[io->pending->count++] = (AsyncRequest_t){
+      .fd = fd, .data = copy, .length = length, .result = 0};
+  io->pending->bytes += length;
+
+  // Submit right away when the device is idle; batches only form while an
+  // earlier batch is still in flight.
+  if (finish_in_flight(io, false))
+    submit_pending(io);
+  return true;
+}
+
+void async_io_drain(AsyncIo_t *io) {
+  finish_in_flight(io, true);
+  submit_pending(io);
+  finish_in_flight(io, true);
+}
+
+ssize_t async_io_read(AsyncIo_t *io, int fd, void *buffer, size_t count) {
+  async_io_drain(io);
+  if (io->backend != ASYNC_IO_URING)
+    return read(fd, buffer, count);
+
+  queue_sqe(&io->ring, IORING_OP_READ, fd, buffer, count, 0, 0);
+  struct io_uring_cqe cqe;
+  if (!submit_sqes(&io->ring, 1) || !next_cqe(&io->ring, true, &cqe))
+    return -1;
+
+  if (cqe.res < 0) {
+    errno = -cqe.res;
+    return -1;
+  }
+  return cqe.res;
+}
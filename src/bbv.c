@@ -0,0 +1,131 @@
+#include "bbv.h"
+
+#include <stdlib.h>
+
+static size_t bbv_slot(const Bbv_t *bbv, uint32_t pc) {
+  return (size_t)((pc >> 1) * 0x9e3779b1u) & bbv->slot_mask;
+}
+
+bool bbv_open(Bbv_t *bbv, const char *path, uint64_t interval) {
+  *bbv = (Bbv_t){.interval = interval, .capacity = BBV_INITIAL_BLOCKS};
+  bbv->blocks = (BbvBlock_t *)malloc(bbv->capacity * sizeof(BbvBlock_t));
+  bbv->touched = (uint32_t *)malloc(bbv->capacity * sizeof(uint32_t));
+  bbv->slots = (uint32_t *)calloc(bbv->capacity * 2, sizeof(uint32_t));
+  bbv->slot_mask = bbv->capacity * 2 - 1;
+  if (!bbv->blocks || !bbv->touched || !bbv->slots) {
+    fprintf(stderr, "Error: Failed to allocate basic-block vectors\n");
+    bbv_close(bbv);
+    return false;
+  }
+
+  bbv->file = fopen(path, "w");
+  if (!bbv->file) {
+    perror("Error: Failed to open basic-block vector file");
+    bbv_close(bbv);
+    return false;
+  }
+  return true;
+}
+
+static void write_interval(Bbv_t *bbv) {
+  fputc('T', bbv->file);
+  for (uint32_t i = 0; i < bbv->touched_count; i++) {
+    uint32_t id = bbv->touched[i];
+    BbvBlock_t *block = &bbv->blocks[id - 1];
+    fprintf(bbv->file, ":%u:%llu ", id, (unsigned long long)block->count);
+    block->count = 0;
+  }
+  fputc('\n', bbv->file);
+  bbv->touched_count = 0;
+  bbv->intervals++;
+}
+
+bool bbv_close(Bbv_t *bbv) {
+  bool ok = !bbv->failed;
+  if (bbv->file) {
+    if (bbv->touched_count > 0)
+      write_interval(bbv);
+    ok = ok && !ferror(bbv->file);
+    if (fclose(bbv->file) != 0)
+      ok = false;
+    if (!ok)
+      fprintf(stderr, "Error: Failed to write basic-block vectors\n");
+  }
+  free(bbv->blocks);
+  free(bbv->touched);
+  free(bbv->slots);
+  *bbv = (Bbv_t){0};
+  return ok;
+}
+
+// Doubles the block arrays and the table, which stays at most half full.
+static bool grow(Bbv_t *bbv) {
+  uint32_t capacity = bbv->capacity * 2;
+  BbvBlock_t *blocks =
+      (BbvBlock_t *)realloc(bbv->blocks, capacity * sizeof(BbvBlock_t));
+  if (blocks)
+    bbv->blocks = blocks;
+  uint32_t *touched =
+      (uint32_t *)realloc(bbv->touched, capacity * sizeof(uint32_t));
+  if (touched)
+    bbv->touched = touched;
+  uint32_t *slots = (uint32_t *)calloc((size_t)capacity * 2, sizeof(uint32_t));
+  if (!blocks || !touched || !slots) {
+    free(slots);
+    return false;
+  }
+
+  free(bbv->slots);
+  bbv->slots = slots;
+  bbv->slot_mask = (size_t)capacity * 2 - 1;
+  bbv->capacity = capacity;
+  for (uint32_t id = 1; id <= bbv->block_count; id++) {
+    size_t i = bbv_slot(bbv, bbv->blocks[id - 1].pc);
+    while (bbv->slots[i] != 0)
+      i = (i + 1) & bbv->slot_mask;
+    bbv->slots[i] = id;
+  }
+  return true;
+}
+
+static BbvBlock_t *find_block(Bbv_t *bbv, uint32_t pc) {
+  size_t i = bbv_slot(bbv, pc);
+  for (; bbv->slots[i] != 0; i = (i + 1) & bbv->slot_mask) {
+    BbvBlock_t *block = &bbv->blocks[bbv->slots[i] - 1];
+    if (block->pc == pc)
+      return block;
+  }
+
+  if (bbv->block_count == bbv->capacity) {
+    if (!grow(bbv)) {
+      if (!bbv->failed)
+        fprintf(stderr, "Error: Out of memory for basic-block vectors\n");
+      bbv->failed = true;
+      return NULL;
+    }
+    return find_block(bbv, pc);
+  }
+  bbv->slots[i] = ++bbv->block_count;
+  BbvBlock_t *block = &bbv->blocks[bbv->block_count - 1];
+  *block = (BbvBlock_t){.pc = pc};
+  return block;
+}
+
+void bbv_record(Bbv_t *bbv, uint32_t pc, uint32_t instructions) {
+  // A block that stopped at its first instruction retired nothing; listing
+  // it would write a zero term, or list it twice once it runs again.
+  if (instructions == 0)
+    return;
+  BbvBlock_t *block = find_block(bbv, pc);
+  if (!block)
+    return;
+  if (block->count == 0)
+    bbv->touched[bbv->touched_count++] = (uint32_t)(block - bbv->blocks) + 1;
+  block->count += instructions;
+
+  bbv->retired += instructions;
+  if (bbv->retired >= bbv->interval) {
+    write_interval(bbv);
+    bbv->retired %= bbv->interval;
+  }
+}
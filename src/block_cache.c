@@ -0,0 +1,540 @@
+#include "block_cache.h"
+
+#include "breakpoints.h"
+#include "compressed_decoder.h"
+#include "fetch.h"
+#include "instructions/instructions.h"
+#include "isa.h"
+#include "opcodes.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static size_t hash_index(uint32_t pc) {
+  return (pc >> 1) & (BLOCK_CACHE_HASH_SIZE - 1);
+}
+
+static size_t page_hash_index(uint32_t page) {
+  return page & (BLOCK_CACHE_PAGE_HASH_SIZE - 1);
+}
+
+// x1 (ra) and x5 (t0) are the link registers named by the RISC-V return
+// address stack hints.
+static bool is_link_register(uint8_t reg) { return reg == 1 || reg == 5; }
+
+bool init_block_cache(BlockCache_t *cache) {
+  memset(cache, 0, sizeof(*cache));
+  cache->blocks = (Block_t *)calloc(BLOCK_CACHE_CAPACITY, sizeof(Block_t));
+  cache->insns = (BlockInstruction_t *)calloc(
+      BLOCK_CACHE_INSTRUCTION_CAPACITY, sizeof(BlockInstruction_t));
+  cache->uops = (MicroOp_t *)calloc(BLOCK_CACHE_INSTRUCTION_CAPACITY,
+                                    sizeof(MicroOp_t));
+  cache->loops =
+      (LoopIdiom_t *)calloc(BLOCK_CACHE_LOOP_CAPACITY, sizeof(LoopIdiom_t));
+  cache->hash = (Block_t **)calloc(BLOCK_CACHE_HASH_SIZE, sizeof(Block_t *));
+  cache->page_hash =
+      (Block_t **)calloc(BLOCK_CACHE_PAGE_HASH_SIZE, sizeof(Block_t *));
+  if (!cache->blocks || !cache->insns || !cache->uops || !cache->loops ||
+      !cache->hash || !cache->page_hash) {
+    perror("Error: Failed to allocate block cache");
+    free_block_cache(cache);
+    return false;
+  }
+  cache->hot_threshold = BLOCK_HOT_THRESHOLD;
+  return true;
+}
+
+void free_block_cache(BlockCache_t *cache) {
+  if (cache->memory && cache->memory->code_write_arg == cache)
+    memory_set_code_hook(cache->memory, NULL, NULL);
+  free(cache->blocks);
+  free(cache->insns);
+  free(cache->uops);
+  free(cache->loops);
+  free(cache->hash);
+  free(cache->page_hash);
+  memset(cache, 0, sizeof(*cache));
+}
+
+void block_cache_flush(BlockCache_t *cache) {
+  memset(cache->hash, 0, BLOCK_CACHE_HASH_SIZE * sizeof(Block_t *));
+  memset(cache->page_hash, 0, BLOCK_CACHE_PAGE_HASH_SIZE * sizeof(Block_t *));
+  if (cache->memory)
+    memory_clear_code(cache->memory);
+  cache->block_count = 0;
+  cache->insn_count = 0;
+  cache->uop_count = 0;
+  cache->loop_count = 0;
+  cache->return_top = 0;
+  cache->return_depth = 0;
+  cache->stats.flushes++;
+}
+
+// Stop a block before an instruction that cannot be fetched, so the fault is
+// reported by the interpreter only if execution actually reaches it.
+static bool can_fetch(Memory_t *memory, uint32_t pc) {
+  uint8_t *bytes;
+  if (pc % RV_INSTRUCTION_ALIGN != 0 ||
+      !memory_allows(memory, pc, 2, MEMORY_PROT_EXEC) ||
+      !memory_get_pointer(memory, pc, 2, &bytes))
+    return false;
+  return rv_is_compressed((uint16_t)(bytes[0] | bytes[1] << 8)) ||
+         memory_allows(memory, pc, 4, MEMORY_PROT_EXEC);
+}
+
+static void set_exit(Block_t *block, uint32_t inst, uint32_t pc) {
+  uint8_t rd = get_rd(inst);
+  uint8_t rs1 = get_rs1(inst);
+
+  switch (get_opcode(inst)) {
+  case OPCODE_BRANCH:
+    block->exit = BLOCK_EXIT_DIRECT;
+    block->link_pc[BLOCK_LINK_TARGET] = pc + get_imm_b(inst);
+    break;
+  case OPCODE_JAL:
+    block->exit = BLOCK_EXIT_DIRECT;
+    block->link_pc[BLOCK_LINK_TARGET] = pc + get_imm_j(inst);
+    block->pushes_return = is_link_register(rd);
+    break;
+  case OPCODE_JALR:
+    block->exit = BLOCK_EXIT_INDIRECT;
+    block->pushes_return = is_link_register(rd);
+    block->pops_return =
+        is_link_register(rs1) && (!is_link_register(rd) || rd != rs1);
+    break;
+  default:
+    break;
+  }
+}
+
+static bool ends_block(uint32_t inst, InstructionHandler handler) {
+  if (handler == handle_illegal_instruction || handler == handle_fence_i)
+    return true;
+
+  switch (get_opcode(inst)) {
+  case OPCODE_BRANCH:
+  case OPCODE_JAL:
+  case OPCODE_JALR:
+  case OPCODE_SYSTEM:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static void code_write_hook(void *arg, uint32_t addr, size_t size) {
+  block_cache_invalidate((BlockCache_t *)arg, addr, size);
+}
+
+static void unlink_block(BlockCache_t *cache, Block_t *block) {
+  Block_t **link = &cache->hash[hash_index(block->start_pc)];
+  while (*link && *link != block)
+    link = &(*link)->hash_next;
+  if (*link)
+    *link = block->hash_next;
+}
+
+// Drops every block overlapping [addr, addr + size). A block is shorter than
+// a page, so it starts either in the written pages or in the one before.
+void block_cache_invalidate(BlockCache_t *cache, uint32_t addr, size_t size) {
+  if (size == 0)
+    return;
+
+  uint32_t end = addr + (uint32_t)size;
+  uint32_t first_page = addr / GUEST_PAGE_SIZE;
+  uint32_t last_page = (end - 1) / GUEST_PAGE_SIZE;
+  if (first_page > 0)
+    first_page--;
+
+  for (uint32_t page = first_page; page <= last_page; page++) {
+    Block_t **link = &cache->page_hash[page_hash_index(page)];
+    while (*link) {
+      Block_t *block = *link;
+      if (block->start_pc < end && addr < block->end_pc) {
+        *link = block->page_next;
+        unlink_block(cache, block);
+        block->invalid = true;
+        cache->stats.invalidations++;
+      } else {
+        link = &block->page_next;
+      }
+    }
+  }
+}
+
+static bool cache_has_room(const BlockCache_t *cache, uint32_t count) {
+  return cache->block_count < BLOCK_CACHE_CAPACITY &&
+         cache->insn_count + count <= BLOCK_CACHE_INSTRUCTION_CAPACITY;
+}
+
+static Block_t *alloc_block(BlockCache_t *cache, uint32_t pc) {
+  Block_t *block = &cache->blocks[cache->block_count++];
+  memset(block, 0, sizeof(*block));
+  block->start_pc = pc;
+  block->insns = &cache->insns[cache->insn_count];
+  return block;
+}
+
+// Publishes a block whose instructions, exit and end_pc are filled in.
+static void add_block(BlockCache_t *cache, Memory_t *memory, Block_t *block) {
+  block->link_pc[BLOCK_LINK_FALLTHROUGH] = block->end_pc;
+  if (block->exit == BLOCK_EXIT_FALLTHROUGH)
+    block->link_pc[BLOCK_LINK_TARGET] = block->end_pc;
+
+  cache->insn_count += block->count;
+  size_t index = hash_index(block->start_pc);
+  block->hash_next = cache->hash[index];
+  cache->hash[index] = block;
+
+  size_t page = page_hash_index(block->start_pc / GUEST_PAGE_SIZE);
+  block->page_next = cache->page_hash[page];
+  cache->page_hash[page] = block;
+
+  if (memory->code_write_arg != cache) {
+    memory_set_code_hook(memory, code_write_hook, cache);
+    cache->memory = memory;
+  }
+  memory_mark_code(memory, block->start_pc, block->end_pc - block->start_pc);
+}
+
+// Blocks end before breakpoints, so that the engines only need to check
+// them at block starts.
+static Block_t *build_block(BlockCache_t *cache, Memory_t *memory,
+                            const Breakpoints_t *breakpoints, uint32_t pc) {
+  if (!can_fetch(memory, pc))
+    return NULL;
+
+  if (!cache_has_room(cache, BLOCK_MAX_INSTRUCTIONS))
+    block_cache_flush(cache);
+
+  Block_t *block = alloc_block(cache, pc);
+  uint32_t inst_pc = pc;
+  while (block->count < BLOCK_MAX_INSTRUCTIONS && can_fetch(memory, inst_pc)) {
+    if (breakpoints && block->count > 0 &&
+        breakpoints_contains(breakpoints, inst_pc))
+      break;
+
+    FetchResult_t fetch = fetch_instruction(memory, inst_pc);
+    uint32_t inst = fetch.inst;
+    if (RV_ISA_HAS_C && fetch.len == 2)
+      inst = expand_compressed((uint16_t)fetch.inst);
+
+    BlockInstruction_t *insn = &block->insns[block->count++];
+    insn->handler = decode_instruction(inst);
+    insn->inst = inst;
+    insn->len = (uint8_t)fetch.len;
+
+    uint32_t next_pc = inst_pc + (uint32_t)fetch.len;
+    if (ends_block(inst, insn->handler)) {
+      set_exit(block, inst, inst_pc);
+      inst_pc = next_pc;
+      break;
+    }
+    inst_pc = next_pc;
+  }
+
+  block->end_pc = inst_pc;
+  add_block(cache, memory, block);
+  cache->stats.builds++;
+  return block;
+}
+
+Block_t *block_cache_lookup(BlockCache_t *cache, RvContext_t *context,
+                            uint32_t pc) {
+  cache->stats.lookups++;
+  for (Block_t *block = cache->hash[hash_index(pc)]; block;
+       block = block->hash_next) {
+    if (block->start_pc == pc)
+      return block;
+  }
+  return build_block(cache, context->memory, context->breakpoints, pc);
+}
+
+static Block_t *follow_direct(BlockCache_t *cache, RvContext_t *context,
+                              Block_t *prev, uint32_t pc) {
+  int slot = -1;
+  if (pc == prev->link_pc[BLOCK_LINK_TARGET])
+    slot = BLOCK_LINK_TARGET;
+  else if (pc == prev->link_pc[BLOCK_LINK_FALLTHROUGH])
+    slot = BLOCK_LINK_FALLTHROUGH;
+
+  if (slot >= 0 && prev->links[slot] && !prev->links[slot]->invalid) {
+    cache->stats.chained++;
+    return prev->links[slot];
+  }
+
+  uint64_t flushes = cache->stats.flushes;
+  Block_t *next = block_cache_lookup(cache, context, pc);
+  if (slot >= 0 && flushes == cache->stats.flushes)
+    prev->links[slot] = next;
+  return next;
+}
+
+static Block_t *follow_return(BlockCache_t *cache, RvContext_t *context,
+                              uint32_t pc) {
+  if (cache->return_depth == 0) {
+    cache->stats.return_misses++;
+    return block_cache_lookup(cache, context, pc);
+  }
+
+  cache->return_top = (cache->return_top + RETURN_STACK_DEPTH - 1) %
+                      RETURN_STACK_DEPTH;
+  cache->return_depth--;
+  ReturnStackEntry_t *entry = &cache->return_stack[cache->return_top];
+
+  if (entry->return_pc != pc) {
+    cache->stats.return_misses++;
+    return block_cache_lookup(cache, context, pc);
+  }
+
+  // The caller's fallthrough link doubles as the cached return target.
+  Block_t *caller = entry->caller;
+  Block_t *target = caller->links[BLOCK_LINK_FALLTHROUGH];
+  if (target && !target->invalid) {
+    cache->stats.return_hits++;
+    return target;
+  }
+
+  cache->stats.return_misses++;
+  uint64_t flushes = cache->stats.flushes;
+  Block_t *next = block_cache_lookup(cache, context, pc);
+  if (flushes == cache->stats.flushes)
+    caller->links[BLOCK_LINK_FALLTHROUGH] = next;
+  return next;
+}
+
+static Block_t *follow_indirect(BlockCache_t *cache, RvContext_t *context,
+                                Block_t *prev, uint32_t pc) {
+  if (prev->indirect_target && !prev->indirect_target->invalid &&
+      prev->indirect_pc == pc) {
+    cache->stats.indirect_hits++;
+    return prev->indirect_target;
+  }
+
+  cache->stats.indirect_misses++;
+  uint64_t flushes = cache->stats.flushes;
+  Block_t *next = block_cache_lookup(cache, context, pc);
+  if (next && flushes == cache->stats.flushes) {
+    prev->indirect_pc = pc;
+    prev->indirect_target = next;
+  }
+  return next;
+}
+
+static void push_return(BlockCache_t *cache, Block_t *caller) {
+  ReturnStackEntry_t *entry = &cache->return_stack[cache->return_top];
+  entry->return_pc = caller->end_pc;
+  entry->caller = caller;
+  cache->return_top = (cache->return_top + 1) % RETURN_STACK_DEPTH;
+  if (cache->return_depth < RETURN_STACK_DEPTH)
+    cache->return_depth++;
+}
+
+Block_t *block_cache_next(BlockCache_t *cache, RvContext_t *context,
+                          Block_t *prev, uint32_t pc) {
+  uint64_t flushes = cache->stats.flushes;
+  Block_t *next;
+  if (prev->exit == BLOCK_EXIT_INDIRECT) {
+    if (prev->pops_return)
+      next = follow_return(cache, context, pc);
+    else
+      next = follow_indirect(cache, context, prev, pc);
+  } else {
+    next = follow_direct(cache, context, prev, pc);
+  }
+
+  // A flush while resolving the target also discarded prev. A call that
+  // comes straight back was run on the host and has no return to predict.
+  if (prev->pushes_return && pc != prev->end_pc &&
+      flushes == cache->stats.flushes)
+    push_return(cache, prev);
+  return next;
+}
+
+// On-disk format: a header, then per block a record followed by `count`
+// instructions. Handlers are host pointers, so they are decoded again on
+// load; a hash of the block's guest bytes guards against code that differs
+// from what the block was built from.
+
+#define BLOCK_CACHE_FILE_MAGIC 0x43425652u // "RVBC"
+
+typedef struct BlockFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint32_t block_count;
+  uint32_t isa; // RV_ISA_ID of the emulator that decoded the blocks.
+} BlockFileHeader_t;
+
+typedef struct BlockFileRecord {
+  uint32_t start_pc;
+  uint32_t end_pc;
+  uint32_t count;
+  uint32_t padding;
+  uint64_t bytes_hash;
+} BlockFileRecord_t;
+
+typedef struct BlockFileInstruction {
+  uint32_t inst;
+  uint32_t len;
+} BlockFileInstruction_t;
+
+static bool hash_guest_bytes(Memory_t *memory, uint32_t start, uint32_t end,
+                             uint64_t *hash) {
+  uint8_t *bytes;
+  if (end <= start || !memory_get_pointer(memory, start, end - start, &bytes))
+    return false;
+  *hash = hash_bytes(HASH_SEED, bytes, end - start);
+  return true;
+}
+
+// A block is saved only if memory still holds the code it was built from;
+// writes the code hook does not see, such as a mapping replaced underneath
+// it, leave the block valid but stale.
+static bool block_matches_memory(Memory_t *memory, const Block_t *block) {
+  uint32_t pc = block->start_pc;
+  for (uint32_t i = 0; i < block->count; i++) {
+    const BlockInstruction_t *insn = &block->insns[i];
+    if (!can_fetch(memory, pc))
+      return false;
+    FetchResult_t fetch = fetch_instruction(memory, pc);
+    uint32_t inst = fetch.inst;
+    if (RV_ISA_HAS_C && fetch.len == 2)
+      inst = expand_compressed((uint16_t)fetch.inst);
+    if ((uint32_t)fetch.len != insn->len || inst != insn->inst)
+      return false;
+    pc += (uint32_t)fetch.len;
+  }
+  return pc == block->end_pc;
+}
+
+static bool write_blocks(BlockCache_t *cache, Memory_t *memory, FILE *fp,
+                         uint64_t key) {
+  BlockFileHeader_t header = {.magic = BLOCK_CACHE_FILE_MAGIC,
+                              .version = BLOCK_CACHE_FILE_VERSION,
+                              .key = key,
+                              .isa = RV_ISA_ID};
+  if (fwrite(&header, sizeof(header), 1, fp) != 1)
+    return false;
+
+  for (size_t i = 0; i < cache->block_count; i++) {
+    const Block_t *block = &cache->blocks[i];
+    BlockFileRecord_t record = {.start_pc = block->start_pc,
+                                .end_pc = block->end_pc,
+                                .count = block->count};
+    if (block->invalid || !block_matches_memory(memory, block) ||
+        !hash_guest_bytes(memory, block->start_pc, block->end_pc,
+                          &record.bytes_hash))
+      continue;
+
+    if (fwrite(&record, sizeof(record), 1, fp) != 1)
+      return false;
+    for (uint32_t j = 0; j < block->count; j++) {
+      BlockFileInstruction_t insn = {.inst = block->insns[j].inst,
+                                     .len = block->insns[j].len};
+      if (fwrite(&insn, sizeof(insn), 1, fp) != 1)
+        return false;
+    }
+    header.block_count++;
+  }
+
+  return fseek(fp, 0, SEEK_SET) == 0 &&
+         fwrite(&header, sizeof(header), 1, fp) == 1;
+}
+
+bool block_cache_save(BlockCache_t *cache, Memory_t *memory, const char *path,
+                      uint64_t key) {
+  char temp_path[4096];
+  int length = snprintf(temp_path, sizeof(temp_path), "%s.%ld.tmp", path,
+                        (long)getpid());
+  if (length < 0 || (size_t)length >= sizeof(temp_path)) {
+    fprintf(stderr, "Error: Block cache path is too long: %s\n", path);
+    return false;
+  }
+
+  FILE *fp = fopen(temp_path, "wb");
+  if (!fp) {
+    perror("Error: Failed to create block cache file");
+    return false;
+  }
+
+  bool ok = write_blocks(cache, memory, fp, key);
+  if (fclose(fp) != 0)
+    ok = false;
+  // Renaming over the old file keeps concurrent runs from reading a
+  // partially written cache.
+  if (ok && rename(temp_path, path) != 0)
+    ok = false;
+  if (!ok) {
+    fprintf(stderr, "Error: Failed to write block cache file %s\n", path);
+    unlink(temp_path);
+  }
+  return ok;
+}
+
+static bool read_block(BlockCache_t *cache, Memory_t *memory, FILE *fp,
+                       const BlockFileRecord_t *record) {
+  if (record->count == 0 || record->count > BLOCK_MAX_INSTRUCTIONS)
+    return false;
+
+  BlockFileInstruction_t insns[BLOCK_MAX_INSTRUCTIONS];
+  if (fread(insns, sizeof(insns[0]), record->count, fp) != record->count)
+    return false;
+
+  uint64_t bytes_hash;
+  if (!hash_guest_bytes(memory, record->start_pc, record->end_pc,
+                        &bytes_hash) ||
+      bytes_hash != record->bytes_hash ||
+      !cache_has_room(cache, record->count))
+    return true;
+
+  uint32_t pc = record->start_pc;
+  for (uint32_t i = 0; i < record->count; i++) {
+    if (insns[i].len != 2 && insns[i].len != 4)
+      return false;
+    pc += insns[i].len;
+  }
+  if (pc != record->end_pc)
+    return false;
+
+  Block_t *block = alloc_block(cache, record->start_pc);
+  pc = record->start_pc;
+  for (uint32_t i = 0; i < record->count; i++) {
+    BlockInstruction_t *insn = &block->insns[block->count++];
+    insn->handler = decode_instruction(insns[i].inst);
+    insn->inst = insns[i].inst;
+    insn->len = (uint8_t)insns[i].len;
+    if (ends_block(insn->inst, insn->handler))
+      set_exit(block, insn->inst, pc);
+    pc += insns[i].len;
+  }
+  block->end_pc = pc;
+  add_block(cache, memory, block);
+  cache->stats.loaded++;
+  return true;
+}
+
+bool block_cache_load(BlockCache_t *cache, Memory_t *memory, const char *path,
+                      uint64_t key) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp)
+    return false;
+
+  BlockFileHeader_t header;
+  bool ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+            header.magic == BLOCK_CACHE_FILE_MAGIC &&
+            header.version == BLOCK_CACHE_FILE_VERSION &&
+            header.isa == RV_ISA_ID && header.key == key;
+
+  for (uint32_t i = 0; ok && i < header.block_count; i++) {
+    BlockFileRecord_t record;
+    ok = fread(&record, sizeof(record), 1, fp) == 1 &&
+         read_block(cache, memory, fp, &record);
+  }
+
+  fclose(fp);
+  return ok;
+}
@@ -0,0 +1,462 @@
+#include "block_optimizer.h"
+
+#include "aot.h"
+#include "bbv.h"
+#include "breakpoints.h"
+#include "coverage.h"
+#include "hypercall.h"
+#include "instructions/instructions.h"
+#include "instructions/instructions_m.h"
+#include "utils.h"
+
+#include <string.h>
+
+// The optimized tier replaces register-only instructions with micro-ops that
+// carry their operands predecoded and write cpu->regs directly. Within a
+// block it folds operations on known constants (lui/addi chains, auipc),
+// drops writes to x0 and drops writes overwritten before they are read.
+// Everything else, including every instruction that can fault or leave the
+// block, still runs its handler, so both tiers stop in the same state.
+//
+// A block that loops back to itself and does nothing but copy or fill one
+// element per iteration, as inlined and -O2 memcpy and memset loops do, is
+// also described as a LoopIdiom_t:
+//
+//   loop: lbu t0, 0(a1)        loop: sw   zero, 0(a0)
+//         sb  t0, 0(a0)              addi a0, a0, 4
+//         addi a1, a1, 1             bne  a0, a2, loop
+//         addi a0, a0, 1
+//         bne a1, a2, loop
+//
+// Besides the load and the store it may only hold addi r, r, imm steps and
+// the closing bne, and both pointers must advance by the element size.
+// block_execute_loop then computes the trip count from the bne operands and
+// runs the rest of the loop as one host memcpy or memset, unless that could
+// differ from running it: the ranges overlap or cover the loop's own code,
+// an access would fault or is misaligned, or the counter never meets the
+// bound.
+
+typedef struct OptimizerRule {
+  InstructionHandler handler;
+  MicroOpKind kind;
+} OptimizerRule_t;
+
+static const OptimizerRule_t register_rules[] = {
+    {handle_add, UOP_ADD},       {handle_sub, UOP_SUB},
+    {handle_sll, UOP_SLL},       {handle_slt, UOP_SLT},
+    {handle_sltu, UOP_SLTU},     {handle_xor, UOP_XOR},
+    {handle_srl, UOP_SRL},       {handle_sra, UOP_SRA},
+    {handle_or, UOP_OR},         {handle_and, UOP_AND},
+    {handle_mul, UOP_MUL},       {handle_mulh, UOP_MULH},
+    {handle_mulhsu, UOP_MULHSU}, {handle_mulhu, UOP_MULHU},
+    {handle_div, UOP_DIV},       {handle_divu, UOP_DIVU},
+    {handle_rem, UOP_REM},       {handle_remu, UOP_REMU},
+};
+
+static const OptimizerRule_t immediate_rules[] = {
+    {handle_addi, UOP_ADD}, {handle_slti, UOP_SLT},
+    {handle_sltiu, UOP_SLTU}, {handle_xori, UOP_XOR},
+    {handle_ori, UOP_OR},   {handle_andi, UOP_AND},
+    {handle_slli, UOP_SLL}, {handle_srli, UOP_SRL},
+    {handle_srai, UOP_SRA},
+};
+
+#define RULE_COUNT(rules) (sizeof(rules) / sizeof((rules)[0]))
+
+static bool find_rule(const OptimizerRule_t *rules, size_t count,
+                      InstructionHandler handler, MicroOpKind *kind) {
+  for (size_t i = 0; i < count; i++) {
+    if (rules[i].handler == handler) {
+      *kind = rules[i].kind;
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline uint32_t evaluate(MicroOpKind kind, uint32_t a, uint32_t b) {
+  switch (kind) {
+  case UOP_ADD:
+    return aot_add(a, b);
+  case UOP_SUB:
+    return aot_sub(a, b);
+  case UOP_SLL:
+    return aot_sll(a, b);
+  case UOP_SLT:
+    return aot_slt(a, b);
+  case UOP_SLTU:
+    return aot_sltu(a, b);
+  case UOP_XOR:
+    return aot_xor(a, b);
+  case UOP_SRL:
+    return aot_srl(a, b);
+  case UOP_SRA:
+    return aot_sra(a, b);
+  case UOP_OR:
+    return aot_or(a, b);
+  case UOP_AND:
+    return aot_and(a, b);
+  case UOP_MUL:
+    return aot_mul(a, b);
+  case UOP_MULH:
+    return aot_mulh(a, b);
+  case UOP_MULHSU:
+    return aot_mulhsu(a, b);
+  case UOP_MULHU:
+    return aot_mulhu(a, b);
+  case UOP_DIV:
+    return aot_div(a, b);
+  case UOP_DIVU:
+    return aot_divu(a, b);
+  case UOP_REM:
+    return aot_rem(a, b);
+  case UOP_REMU:
+    return aot_remu(a, b);
+  default:
+    return b;
+  }
+}
+
+// Fills `uop` for one instruction. Register operations whose sources are
+// known constants become UOP_CONST; `known` and `values` track constants
+// across the block, with x0 always known to be zero.
+static void lower_instruction(const BlockInstruction_t *insn, uint32_t pc,
+                              bool known[32], uint32_t values[32],
+                              MicroOp_t *uop) {
+  uint32_t inst = insn->inst;
+  memset(uop, 0, sizeof(*uop));
+  uop->kind = UOP_HANDLER;
+  uop->rd = get_rd(inst);
+  uop->rs1 = get_rs1(inst);
+  uop->rs2 = get_rs2(inst);
+  uop->pc = pc;
+  uop->insn = insn;
+
+  MicroOpKind kind;
+  if (insn->handler == handle_lui || insn->handler == handle_auipc) {
+    uop->kind = UOP_CONST;
+    uop->imm = get_imm_u(inst);
+    if (insn->handler == handle_auipc)
+      uop->imm += pc;
+  } else if (find_rule(register_rules, RULE_COUNT(register_rules),
+                       insn->handler, &kind)) {
+    uop->kind = kind;
+    if (known[uop->rs1] && known[uop->rs2]) {
+      uop->kind = UOP_CONST;
+      uop->imm = evaluate(kind, values[uop->rs1], values[uop->rs2]);
+    }
+  } else if (find_rule(immediate_rules, RULE_COUNT(immediate_rules),
+                       insn->handler, &kind)) {
+    uop->kind = kind;
+    uop->has_imm = true;
+    uop->imm = (uint32_t)get_imm_i(inst);
+    if (known[uop->rs1]) {
+      uop->kind = UOP_CONST;
+      uop->imm = evaluate(kind, values[uop->rs1], uop->imm);
+    }
+  }
+
+  // Handlers may write rd; the rd field of stores and branches holds
+  // immediate bits, so forgetting it is merely conservative.
+  if (uop->rd != 0) {
+    known[uop->rd] = uop->kind == UOP_CONST;
+    values[uop->rd] = uop->imm;
+  }
+  // Hypercalls return results in a0-a7 without naming them in rd.
+  if (insn->handler == handle_hypercall) {
+    for (uint8_t reg = 10; reg <= 17; reg++)
+      known[reg] = false;
+  }
+}
+
+static uint32_t register_bit(uint8_t reg) { return UINT32_C(1) << reg; }
+
+// Handlers read any register and may stop the guest, after which every
+// register is observable, so they keep all earlier writes live. So does the
+// end of the block.
+static uint32_t remove_dead_writes(MicroOp_t *uops, uint32_t count) {
+  uint32_t live = UINT32_MAX;
+  bool dead[BLOCK_MAX_INSTRUCTIONS] = {false};
+
+  for (uint32_t i = count; i-- > 0;) {
+    const MicroOp_t *uop = &uops[i];
+    if (uop->kind == UOP_HANDLER) {
+      live = UINT32_MAX;
+      continue;
+    }
+    if (!(live & register_bit(uop->rd))) {
+      dead[i] = true;
+      continue;
+    }
+    live &= ~register_bit(uop->rd);
+    if (uop->kind != UOP_CONST) {
+      live |= register_bit(uop->rs1);
+      if (!uop->has_imm)
+        live |= register_bit(uop->rs2);
+    }
+  }
+
+  uint32_t kept = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    if (!dead[i])
+      uops[kept++] = uops[i];
+  }
+  return kept;
+}
+
+static uint8_t load_width(InstructionHandler handler, bool *is_signed) {
+  *is_signed = handler == handle_lb || handler == handle_lh;
+  if (handler == handle_lb || handler == handle_lbu)
+    return 1;
+  if (handler == handle_lh || handler == handle_lhu)
+    return 2;
+  return handler == handle_lw ? 4 : 0;
+}
+
+static uint8_t store_width(InstructionHandler handler) {
+  if (handler == handle_sb)
+    return 1;
+  if (handler == handle_sh)
+    return 2;
+  return handler == handle_sw ? 4 : 0;
+}
+
+// Fills `loop` when `block` is a copy or fill loop as described above.
+static bool recognize_loop(const Block_t *block, LoopIdiom_t *loop) {
+  if (block->exit != BLOCK_EXIT_DIRECT ||
+      block->link_pc[BLOCK_LINK_TARGET] != block->start_pc ||
+      block->insns[block->count - 1].handler != handle_bne)
+    return false;
+
+  memset(loop, 0, sizeof(*loop));
+  int32_t steps[32] = {0};
+  uint32_t stepped = 0;
+  uint32_t loaded = 0;
+  bool stored = false;
+  uint8_t loaded_width = 0;
+
+  for (uint32_t i = 0; i + 1 < block->count; i++) {
+    uint32_t inst = block->insns[i].inst;
+    InstructionHandler handler = block->insns[i].handler;
+    uint8_t rd = get_rd(inst);
+    uint8_t rs1 = get_rs1(inst);
+    bool is_signed;
+    uint8_t width;
+
+    if (handler == handle_addi && rd == rs1 && rd != 0) {
+      steps[rd] += get_imm_i(inst);
+      stepped |= register_bit(rd);
+    } else if ((width = load_width(handler, &is_signed)) != 0) {
+      if (loaded || stored || rd == 0)
+        return false;
+      loaded = register_bit(rd);
+      loaded_width = width;
+      loop->load_signed = is_signed;
+      loop->load_rd = rd;
+      loop->src_reg = rs1;
+      loop->src_offset = steps[rs1] + get_imm_i(inst);
+    } else if ((width = store_width(handler)) != 0) {
+      if (stored)
+        return false;
+      stored = true;
+      loop->width = width;
+      loop->dst_reg = get_rs1(inst);
+      loop->dst_offset = steps[loop->dst_reg] + get_imm_s(inst);
+      loop->value_reg = get_rs2(inst);
+      loop->copy = loaded && loop->value_reg == loop->load_rd;
+    } else {
+      return false;
+    }
+  }
+
+  // The loaded register must only carry elements from the load to the
+  // store, and everything else the loop reads must be a step or invariant.
+  uint32_t written = stepped | loaded;
+  if (!stored || (loaded && (!loop->copy || loaded_width != loop->width)) ||
+      (loaded & stepped) || steps[loop->dst_reg] != loop->width ||
+      (loop->copy && steps[loop->src_reg] != loop->width) ||
+      (!loop->copy && (written & register_bit(loop->value_reg))))
+    return false;
+
+  uint32_t branch = block->insns[block->count - 1].inst;
+  loop->counter_reg = get_rs1(branch);
+  loop->bound_reg = get_rs2(branch);
+  if (!(stepped & register_bit(loop->counter_reg))) {
+    loop->counter_reg = get_rs2(branch);
+    loop->bound_reg = get_rs1(branch);
+  }
+  loop->counter_step = steps[loop->counter_reg];
+  if (loop->counter_step == 0 || (written & register_bit(loop->bound_reg)))
+    return false;
+
+  for (uint8_t reg = 1; reg < 32; reg++) {
+    if (!(stepped & register_bit(reg)) || steps[reg] == 0)
+      continue;
+    if (loop->induction_count == LOOP_MAX_INDUCTIONS)
+      return false;
+    loop->induction_regs[loop->induction_count] = reg;
+    loop->induction_steps[loop->induction_count] = steps[reg];
+    loop->induction_count++;
+  }
+  return true;
+}
+
+bool block_optimize(BlockCache_t *cache, Block_t *block) {
+  if (block->invalid || block->uops ||
+      cache->uop_count + block->count > BLOCK_CACHE_INSTRUCTION_CAPACITY)
+    return false;
+
+  bool known[32] = {true};
+  uint32_t values[32] = {0};
+  MicroOp_t *uops = &cache->uops[cache->uop_count];
+  uint32_t count = 0;
+  uint32_t pc = block->start_pc;
+
+  for (uint32_t i = 0; i < block->count; i++) {
+    const BlockInstruction_t *insn = &block->insns[i];
+    MicroOp_t *uop = &uops[count];
+    lower_instruction(insn, pc, known, values, uop);
+    pc += insn->len;
+    if (uop->kind != UOP_HANDLER && uop->rd == 0)
+      continue;
+    count++;
+  }
+
+  const BlockInstruction_t *last = &block->insns[block->count - 1];
+  block->uops_fall_through =
+      count == 0 || uops[count - 1].kind != UOP_HANDLER ||
+      uops[count - 1].insn != last;
+  block->uop_count = remove_dead_writes(uops, count);
+  block->uops = uops;
+  cache->uop_count += block->uop_count;
+  cache->stats.optimized++;
+
+  if (cache->loop_count < BLOCK_CACHE_LOOP_CAPACITY &&
+      recognize_loop(block, &cache->loops[cache->loop_count])) {
+    block->loop = &cache->loops[cache->loop_count++];
+    cache->stats.loops++;
+  }
+  return true;
+}
+
+// Whether [a, a + a_size) and [b, b + b_size) share a byte.
+static bool ranges_overlap(uint32_t a, uint64_t a_size, uint32_t b,
+                           uint64_t b_size) {
+  return a < b + b_size && b < a + a_size;
+}
+
+bool block_execute_loop(const Block_t *block, RvContext_t *context) {
+  const LoopIdiom_t *loop = block->loop;
+  CPU_t *cpu = context->cpu;
+  Memory_t *memory = context->memory;
+  uint32_t *regs = cpu->regs;
+
+  // These count or watch every iteration.
+  if (context->coverage || context->bbv || context->breakpoints ||
+      memory->observer)
+    return false;
+
+  // The trip count n solves counter + n * step == bound, modulo 2^32.
+  uint32_t distance = regs[loop->bound_reg] - regs[loop->counter_reg];
+  uint32_t step = (uint32_t)loop->counter_step;
+  if (loop->counter_step < 0) {
+    distance = 0u - distance;
+    step = 0u - step;
+  }
+  if (distance == 0 || distance % step != 0)
+    return false;
+  uint32_t trips = distance / step;
+
+  uint64_t instructions = (uint64_t)trips * block->count;
+  if (context->instruction_limit != 0 &&
+      context->instruction_limit - context->instructions_retired <
+          instructions)
+    return false;
+
+  uint64_t size = (uint64_t)trips * loop->width;
+  uint32_t dst = regs[loop->dst_reg] + (uint32_t)loop->dst_offset;
+  uint32_t src = regs[loop->src_reg] + (uint32_t)loop->src_offset;
+  uint8_t *dst_host;
+  uint8_t *src_host;
+  if (size > UINT32_MAX || dst % loop->width != 0 ||
+      !memory_allows(memory, dst, size, MEMORY_PROT_WRITE) ||
+      !memory_get_pointer(memory, dst, size, &dst_host) ||
+      ranges_overlap(dst, size, block->start_pc,
+                     block->end_pc - block->start_pc))
+    return false;
+  if (loop->copy &&
+      (src % loop->width != 0 ||
+       !memory_allows(memory, src, size, MEMORY_PROT_READ) ||
+       !memory_get_pointer(memory, src, size, &src_host) ||
+       ranges_overlap(dst, size, src, size)))
+    return false;
+
+  if (loop->copy) {
+    memcpy(dst_host, src_host, size);
+    // The loaded register ends up holding the last element.
+    uint32_t last = 0;
+    for (uint8_t i = loop->width; i-- > 0;)
+      last = last << 8 | src_host[size - loop->width + i];
+    if (loop->load_signed) {
+      uint32_t sign = UINT32_C(1) << (loop->width * 8 - 1);
+      last = (last ^ sign) - sign;
+    }
+    regs[loop->load_rd] = last;
+  } else {
+    uint32_t value = regs[loop->value_reg];
+    uint8_t element[4];
+    for (uint8_t i = 0; i < loop->width; i++)
+      element[i] = (uint8_t)(value >> (i * 8));
+    if (loop->width == 1 || value == element[0] * UINT32_C(0x01010101) ||
+        (loop->width == 2 && element[0] == element[1])) {
+      memset(dst_host, element[0], size);
+    } else {
+      for (uint64_t offset = 0; offset < size; offset += loop->width)
+        memcpy(dst_host + offset, element, loop->width);
+    }
+  }
+  memory_mark_written(memory, dst, size);
+
+  for (uint8_t i = 0; i < loop->induction_count; i++)
+    regs[loop->induction_regs[i]] +=
+        trips * (uint32_t)loop->induction_steps[i];
+  cpu->pc = block->end_pc;
+  context->instructions_retired += instructions;
+  context->blocks->stats.loop_runs++;
+  return true;
+}
+
+uint32_t block_execute_optimized(const Block_t *block,
+                                 RvContext_t *context) {
+  CPU_t *cpu = context->cpu;
+  uint32_t *regs = cpu->regs;
+
+  for (uint32_t i = 0; i < block->uop_count; i++) {
+    const MicroOp_t *uop = &block->uops[i];
+    switch (uop->kind) {
+    case UOP_HANDLER:
+      cpu->pc = uop->pc;
+      cpu->current_inst_len = uop->insn->len;
+      cpu->next_pc = uop->pc + uop->insn->len;
+      uop->insn->handler(uop->insn->inst, context);
+      if (cpu->halt)
+        return (uint32_t)(uop->insn - block->insns);
+      cpu->pc = cpu->next_pc;
+      // A store into this block's own code ends it, as in the cold tier.
+      if (block->invalid)
+        return (uint32_t)(uop->insn - block->insns) + 1;
+      break;
+    case UOP_CONST:
+      regs[uop->rd] = uop->imm;
+      break;
+    default:
+      regs[uop->rd] = evaluate(uop->kind, regs[uop->rs1],
+                               uop->has_imm ? uop->imm : regs[uop->rs2]);
+      break;
+    }
+  }
+
+  if (block->uops_fall_through)
+    cpu->pc = block->end_pc;
+  return block->count;
+}
@@ -0,0 +1,89 @@
+#include "breakpoints.h"
+
+#include <stdlib.h>
+
+static uint32_t *alloc_slots(size_t count) {
+  uint32_t *slots = (uint32_t *)malloc(count * sizeof(uint32_t));
+  if (!slots)
+    return NULL;
+  for (size_t i = 0; i < count; i++)
+    slots[i] = BREAKPOINTS_EMPTY;
+  return slots;
+}
+
+bool init_breakpoints(Breakpoints_t *breakpoints) {
+  breakpoints->slots = alloc_slots(BREAKPOINTS_INITIAL_SLOTS);
+  breakpoints->slot_mask = BREAKPOINTS_INITIAL_SLOTS - 1;
+  breakpoints->count = 0;
+  return breakpoints->slots != NULL;
+}
+
+void free_breakpoints(Breakpoints_t *breakpoints) {
+  free(breakpoints->slots);
+  breakpoints->slots = NULL;
+  breakpoints->count = 0;
+}
+
+static void place(Breakpoints_t *breakpoints, uint32_t pc) {
+  size_t i = breakpoints_slot(breakpoints, pc);
+  while (breakpoints->slots[i] != BREAKPOINTS_EMPTY)
+    i = (i + 1) & breakpoints->slot_mask;
+  breakpoints->slots[i] = pc;
+}
+
+// Keeps the table at most half full.
+static bool grow(Breakpoints_t *breakpoints) {
+  size_t old_size = breakpoints->slot_mask + 1;
+  uint32_t *old_slots = breakpoints->slots;
+  uint32_t *slots = alloc_slots(old_size * 2);
+  if (!slots)
+    return false;
+
+  breakpoints->slots = slots;
+  breakpoints->slot_mask = old_size * 2 - 1;
+  for (size_t i = 0; i < old_size; i++) {
+    if (old_slots[i] != BREAKPOINTS_EMPTY)
+      place(breakpoints, old_slots[i]);
+  }
+  free(old_slots);
+  return true;
+}
+
+bool breakpoints_insert(Breakpoints_t *breakpoints, uint32_t pc) {
+  if (pc & 1)
+    return false;
+  if (breakpoints_contains(breakpoints, pc))
+    return true;
+  if ((breakpoints->count + 1) * 2 > breakpoints->slot_mask + 1 &&
+      !grow(breakpoints))
+    return false;
+
+  place(breakpoints, pc);
+  breakpoints->count++;
+  return true;
+}
+
+// Backward-shift deletion: later entries of the probe run move up so that
+// lookups never stop early at the freed slot.
+void breakpoints_remove(Breakpoints_t *breakpoints, uint32_t pc) {
+  size_t mask = breakpoints->slot_mask;
+  size_t i = breakpoints_slot(breakpoints, pc);
+  while (breakpoints->slots[i] != pc) {
+    if (breakpoints->slots[i] == BREAKPOINTS_EMPTY)
+      return;
+    i = (i + 1) & mask;
+  }
+
+  size_t hole = i;
+  for (size_t j = (hole + 1) & mask; breakpoints->slots[j] != BREAKPOINTS_EMPTY;
+       j = (j + 1) & mask) {
+    size_t home = breakpoints_slot(breakpoints, breakpoints->slots[j]);
+    // Move the entry into the hole unless its home lies in (hole, j].
+    if (((j - home) & mask) >= ((j - hole) & mask)) {
+      breakpoints->slots[hole] = breakpoints->slots[j];
+      hole = j;
+    }
+  }
+  breakpoints->slots[hole] = BREAKPOINTS_EMPTY;
+  breakpoints->count--;
+}
@@ -0,0 +1,335 @@
+#include "cache_sim.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const level_names[CACHE_LEVELS] = {"L1I", "L1D", "L2"};
+static const char *const level_keys[CACHE_LEVELS] = {"l1i", "l1d", "l2"};
+
+void cache_sim_default_config(CacheConfig_t configs[CACHE_LEVELS]) {
+  configs[CACHE_L1I] = (CacheConfig_t){16 * 1024, 2, 32};
+  configs[CACHE_L1D] = (CacheConfig_t){16 * 1024, 4, 32};
+  configs[CACHE_L2] = (CacheConfig_t){128 * 1024, 8, 64};
+}
+
+static bool is_power_of_two(uint32_t value) {
+  return value != 0 && (value & (value - 1)) == 0;
+}
+
+// Lines of at least four bytes keep line numbers plus one from overflowing.
+static bool valid_config(const CacheConfig_t *config) {
+  if (config->ways == 0 || !is_power_of_two(config->line) || config->line < 4)
+    return false;
+  uint64_t set_bytes = (uint64_t)config->ways * config->line;
+  return config->size % set_bytes == 0 &&
+         is_power_of_two((uint32_t)(config->size / set_bytes));
+}
+
+// Parses a decimal count with an optional k or m suffix.
+static bool parse_size(const char *text, char **end, uint32_t *value) {
+  if (*text < '0' || *text > '9')
+    return false;
+  unsigned long long parsed = strtoull(text, end, 10);
+  if (**end == 'k' || **end == 'K') {
+    parsed *= 1024;
+    (*end)++;
+  } else if (**end == 'm' || **end == 'M') {
+    parsed *= 1024 * 1024;
+    (*end)++;
+  }
+  if (parsed > UINT32_MAX)
+    return false;
+  *value = (uint32_t)parsed;
+  return true;
+}
+
+static bool parse_level(const char *text, char **end, CacheConfig_t *config) {
+  CacheConfig_t parsed;
+  bool valid = parse_size(text, end, &parsed.size) && **end == ':' &&
+               parse_size(*end + 1, end, &parsed.ways) && **end == ':' &&
+               parse_size(*end + 1, end, &parsed.line) &&
+               (**end == ',' || **end == '\0') && valid_config(&parsed);
+  if (valid)
+    *config = parsed;
+  return valid;
+}
+
+bool cache_sim_parse(const char *spec, CacheConfig_t configs[CACHE_LEVELS]) {
+  const char *p = spec;
+  while (*p) {
+    int level = -1;
+    for (int i = 0; i < CACHE_LEVELS && level < 0; i++) {
+      size_t length = strlen(level_keys[i]);
+      if (strncmp(p, level_keys[i], length) == 0 && p[length] == '=')
+        level = i;
+    }
+    char *end;
+    if (level < 0 ||
+        !parse_level(p + strlen(level_keys[level]) + 1, &end,
+                     &configs[level])) {
+      fprintf(stderr, "Error: Invalid cache level in '%s'\n", spec);
+      return false;
+    }
+    p = *end == ',' ? end + 1 : end;
+  }
+  return true;
+}
+
+static bool init_level(CacheLevel_t *level, const CacheConfig_t *config) {
+  uint32_t sets = config->size / (config->ways * config->line);
+  size_t ways = (size_t)sets * config->ways;
+  level->config = *config;
+  level->set_mask = sets - 1;
+  level->line_shift = (uint32_t)__builtin_ctz(config->line);
+  level->tags = (uint32_t *)calloc(ways, sizeof(uint32_t));
+  level->used = (uint64_t *)calloc(ways, sizeof(uint64_t));
+  level->clock = 0;
+  level->hits = 0;
+  level->misses = 0;
+  return level->tags && level->used;
+}
+
+static void free_level(CacheLevel_t *level) {
+  free(level->tags);
+  free(level->used);
+  level->tags = NULL;
+  level->used = NULL;
+}
+
+static bool init_table(CacheSimTable_t *table) {
+  table->entries = (CacheSimEntry_t *)calloc(CACHE_SIM_INITIAL_ENTRIES,
+                                             sizeof(CacheSimEntry_t));
+  table->mask = CACHE_SIM_INITIAL_ENTRIES - 1;
+  table->count = 0;
+  return table->entries != NULL;
+}
+
+bool init_cache_sim(CacheSim_t *sim, const CacheConfig_t configs[CACHE_LEVELS],
+                    const CPU_t *cpu) {
+  memset(sim, 0, sizeof(*sim));
+  sim->cpu = cpu;
+  bool ok = init_table(&sim->pcs) && init_table(&sim->regions);
+  for (int i = 0; i < CACHE_LEVELS; i++)
+    ok = ok && valid_config(&configs[i]) &&
+         init_level(&sim->levels[i], &configs[i]);
+  if (!ok) {
+    fprintf(stderr, "Error: Failed to allocate cache simulator\n");
+    free_cache_sim(sim);
+  }
+  return ok;
+}
+
+void free_cache_sim(CacheSim_t *sim) {
+  for (int i = 0; i < CACHE_LEVELS; i++)
+    free_level(&sim->levels[i]);
+  free(sim->pcs.entries);
+  free(sim->regions.entries);
+  sim->pcs.entries = NULL;
+  sim->regions.entries = NULL;
+}
+
+static size_t table_slot(const CacheSimTable_t *table, uint32_t key) {
+  return (size_t)((key * 0x9e3779b1u) >> 7) & table->mask;
+}
+
+static CacheSimEntry_t *probe(CacheSimTable_t *table, uint32_t key) {
+  size_t i = table_slot(table, key);
+  while (table->entries[i].used && table->entries[i].key != key)
+    i = (i + 1) & table->mask;
+  return &table->entries[i];
+}
+
+// Keeps the table at most half full.
+static bool grow(CacheSimTable_t *table) {
+  size_t old_size = table->mask + 1;
+  CacheSimEntry_t *old_entries = table->entries;
+  CacheSimEntry_t *entries =
+      (CacheSimEntry_t *)calloc(old_size * 2, sizeof(CacheSimEntry_t));
+  if (!entries)
+    return false;
+
+  table->entries = entries;
+  table->mask = old_size * 2 - 1;
+  for (size_t i = 0; i < old_size; i++) {
+    if (old_entries[i].used)
+      *probe(table, old_entries[i].key) = old_entries[i];
+  }
+  free(old_entries);
+  return true;
+}
+
+static CacheSimEntry_t *lookup(CacheSim_t *sim, CacheSimTable_t *table,
+                               uint32_t key) {
+  CacheSimEntry_t *entry = probe(table, key);
+  if (entry->used)
+    return entry;
+  if ((table->count + 1) * 2 > table->mask + 1) {
+    if (!grow(table)) {
+      if (!sim->failed)
+        fprintf(stderr, "Warning: Cache simulator is out of memory; "
+                        "per-pc and per-region counts are incomplete\n");
+      sim->failed = true;
+      return NULL;
+    }
+    entry = probe(table, key);
+  }
+  entry->key = key;
+  entry->used = true;
+  table->count++;
+  return entry;
+}
+
+// Returns true on a hit. A miss fills the least recently used way of the
+// set; ways never filled have the oldest stamp.
+static bool level_access(CacheLevel_t *level, uint32_t addr) {
+  uint32_t tag = (addr >> level->line_shift) + 1;
+  size_t first = (size_t)((tag - 1) & level->set_mask) * level->config.ways;
+  size_t last = first + level->config.ways;
+  size_t victim = first;
+  level->clock++;
+  for (size_t i = first; i < last; i++) {
+    if (level->tags[i] == tag) {
+      level->used[i] = level->clock;
+      level->hits++;
+      return true;
+    }
+    if (level->used[i] < level->used[victim])
+      victim = i;
+  }
+  level->tags[victim] = tag;
+  level->used[victim] = level->clock;
+  level->misses++;
+  return false;
+}
+
+static void count(CacheCounts_t *counts, bool l1_miss, bool l2_miss) {
+  counts->accesses++;
+  counts->l1_misses += l1_miss;
+  counts->l2_misses += l2_miss;
+}
+
+void cache_sim_access(CacheSim_t *sim, uint32_t addr, size_t size,
+                      uint8_t access) {
+  bool fetch = access == MEMORY_PROT_EXEC;
+  CacheLevel_t *l1 = &sim->levels[fetch ? CACHE_L1I : CACHE_L1D];
+  CacheLevel_t *l2 = &sim->levels[CACHE_L2];
+
+  // An access that straddles lines touches each of them.
+  uint32_t line = l1->config.line;
+  uint32_t start = addr & ~(line - 1);
+  uint32_t end = addr + (uint32_t)(size ? size - 1 : 0);
+  bool l1_miss = false;
+  bool l2_miss = false;
+  for (uint32_t at = start;; at += line) {
+    if (!level_access(l1, at)) {
+      l1_miss = true;
+      if (!level_access(l2, at))
+        l2_miss = true;
+    }
+    if (end - at < line)
+      break;
+  }
+
+  uint32_t pc = fetch ? addr : sim->cpu ? sim->cpu->pc : 0;
+  CacheSimEntry_t *entry = lookup(sim, &sim->pcs, pc);
+  if (entry)
+    count(fetch ? &entry->fetch : &entry->data, l1_miss, l2_miss);
+  if (fetch)
+    return;
+  entry = lookup(sim, &sim->regions, addr >> CACHE_SIM_REGION_SHIFT);
+  if (entry)
+    count(&entry->data, l1_miss, l2_miss);
+}
+
+static void observe(void *arg, uint32_t addr, size_t size, uint8_t access) {
+  cache_sim_access((CacheSim_t *)arg, addr, size, access);
+}
+
+void cache_sim_attach(CacheSim_t *sim, Memory_t *memory) {
+  memory_set_observer(memory, observe, sim);
+}
+
+static uint64_t misses(const CacheSimEntry_t *entry) {
+  return entry->fetch.l1_misses + entry->fetch.l2_misses +
+         entry->data.l1_misses + entry->data.l2_misses;
+}
+
+// Most misses first, then by key so reports are stable.
+static int compare_entries(const void *a, const void *b) {
+  const CacheSimEntry_t *left = *(const CacheSimEntry_t *const *)a;
+  const CacheSimEntry_t *right = *(const CacheSimEntry_t *const *)b;
+  uint64_t left_misses = misses(left);
+  uint64_t right_misses = misses(right);
+  if (left_misses != right_misses)
+    return left_misses > right_misses ? -1 : 1;
+  return left->key < right->key ? -1 : left->key > right->key;
+}
+
+// Returns the table's entries sorted by compare_entries, or NULL.
+static const CacheSimEntry_t **sorted_entries(const CacheSimTable_t *table) {
+  const CacheSimEntry_t **sorted = (const CacheSimEntry_t **)malloc(
+      (table->count + 1) * sizeof(CacheSimEntry_t *));
+  if (!sorted)
+    return NULL;
+  size_t n = 0;
+  for (size_t i = 0; i <= table->mask; i++) {
+    if (table->entries[i].used)
+      sorted[n++] = &table->entries[i];
+  }
+  qsort(sorted, n, sizeof(sorted[0]), compare_entries);
+  return sorted;
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+  return whole ? 100.0 * (double)part / (double)whole : 0.0;
+}
+
+void cache_sim_report(const CacheSim_t *sim, FILE *out, size_t top) {
+  fprintf(out, "Cache simulation\n");
+  fprintf(out, "  level       size  ways  line      accesses        misses"
+               "  miss rate\n");
+  for (int i = 0; i < CACHE_LEVELS; i++) {
+    const CacheLevel_t *level = &sim->levels[i];
+    uint64_t accesses = level->hits + level->misses;
+    fprintf(out, "  %-5s  %6u KiB  %4u  %4u  %12llu  %12llu  %8.2f%%\n",
+            level_names[i], level->config.size / 1024, level->config.ways,
+            level->config.line, (unsigned long long)accesses,
+            (unsigned long long)level->misses,
+            percent(level->misses, accesses));
+  }
+
+  const CacheSimEntry_t **pcs = sorted_entries(&sim->pcs);
+  if (pcs) {
+    size_t n = sim->pcs.count < top ? sim->pcs.count : top;
+    fprintf(out, "Top %zu pcs by misses\n", n);
+    fprintf(out, "  pc              fetches  L1I miss  L2 miss      data"
+                 "  L1D miss  L2 miss\n");
+    for (size_t i = 0; i < n; i++)
+      fprintf(out, "  0x%08x  %11llu  %8llu  %7llu  %8llu  %8llu  %7llu\n",
+              pcs[i]->key, (unsigned long long)pcs[i]->fetch.accesses,
+              (unsigned long long)pcs[i]->fetch.l1_misses,
+              (unsigned long long)pcs[i]->fetch.l2_misses,
+              (unsigned long long)pcs[i]->data.accesses,
+              (unsigned long long)pcs[i]->data.l1_misses,
+              (unsigned long long)pcs[i]->data.l2_misses);
+    free(pcs);
+  }
+
+  const CacheSimEntry_t **regions = sorted_entries(&sim->regions);
+  if (regions) {
+    size_t n = sim->regions.count < top ? sim->regions.count : top;
+    fprintf(out, "Top %zu data regions (%u-byte) by misses\n", n,
+            1u << CACHE_SIM_REGION_SHIFT);
+    fprintf(out, "  region         accesses  L1D miss  L2 miss  miss rate\n");
+    for (size_t i = 0; i < n; i++) {
+      const CacheCounts_t *data = &regions[i]->data;
+      fprintf(out, "  0x%08x  %11llu  %8llu  %7llu  %8.2f%%\n",
+              regions[i]->key << CACHE_SIM_REGION_SHIFT,
+              (unsigned long long)data->accesses,
+              (unsigned long long)data->l1_misses,
+              (unsigned long long)data->l2_misses,
+              percent(data->l1_misses, data->accesses));
+    }
+    free(regions);
+  }
+}
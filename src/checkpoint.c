@@ -0,0 +1,69 @@
+#include "checkpoint.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+bool checkpoint_save(const char *path, const CPU_t *cpu,
+                     const Memory_t *memory, const SyscallState_t *syscalls,
+                     uint64_t key, uint64_t position) {
+  for (int fd = STDERR_FILENO + 1; fd < SYSCALL_MAX_FDS; fd++) {
+    if (syscalls->host_fds[fd] >= 0)
+      fprintf(stderr,
+              "Warning: Checkpoint %s leaves out open guest descriptor %d\n",
+              path, fd);
+  }
+
+  FILE *fp = fopen(path, "wb");
+  if (!fp) {
+    perror("Error: Failed to create checkpoint");
+    return false;
+  }
+
+  CheckpointHeader_t header = {.magic = CHECKPOINT_MAGIC,
+                               .version = CHECKPOINT_VERSION,
+                               .key = key,
+                               .position = position,
+                               .pc = cpu->pc};
+  memcpy(header.regs, cpu->regs, sizeof(header.regs));
+  bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+            memory_save_image(memory, fp);
+  if (fclose(fp) != 0)
+    ok = false;
+  if (!ok) {
+    fprintf(stderr, "Error: Failed to write checkpoint %s\n", path);
+    unlink(path);
+  }
+  return ok;
+}
+
+bool checkpoint_restore(const char *path, CPU_t *cpu, Memory_t *memory,
+                        uint64_t key, uint64_t *position) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    perror("Error: Failed to open checkpoint");
+    return false;
+  }
+
+  CheckpointHeader_t header;
+  bool ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+            header.magic == CHECKPOINT_MAGIC &&
+            header.version == CHECKPOINT_VERSION;
+  if (ok && header.key != key) {
+    fprintf(stderr, "Error: Checkpoint was taken of another program\n");
+    fclose(fp);
+    return false;
+  }
+  ok = ok && memory_load_image(memory, fp);
+  fclose(fp);
+  if (!ok) {
+    fprintf(stderr, "Error: Invalid checkpoint: %s\n", path);
+    return false;
+  }
+
+  memcpy(cpu->regs, header.regs, sizeof(cpu->regs));
+  cpu->regs[0] = 0;
+  cpu->pc = header.pc;
+  *position = header.position;
+  return true;
+}
@@ -0,0 +1,104 @@
+#include "coverage.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static bool attach_shared(Coverage_t *coverage, const char *id_text) {
+  char *end;
+  errno = 0;
+  long id = strtol(id_text, &end, 10);
+  if (errno != 0 || *id_text == '\0' || *end != '\0' || id < 0) {
+    fprintf(stderr, "Error: Invalid %s: %s\n", COVERAGE_SHM_ENV, id_text);
+    return false;
+  }
+
+  void *map = shmat((int)id, NULL, 0);
+  if (map == (void *)-1) {
+    perror("Error: Failed to attach the coverage map");
+    return false;
+  }
+  coverage->map = (uint8_t *)map;
+  coverage->shared = true;
+  return true;
+}
+
+bool init_coverage(Coverage_t *coverage) {
+  coverage->map = NULL;
+  coverage->prev_location = 0;
+  coverage->shared = false;
+  coverage->block_edges = false;
+
+  const char *id_text = getenv(COVERAGE_SHM_ENV);
+  if (id_text)
+    return attach_shared(coverage, id_text);
+
+  coverage->map = (uint8_t *)calloc(1, COVERAGE_MAP_SIZE);
+  if (!coverage->map) {
+    perror("Error: Failed to allocate the coverage map");
+    return false;
+  }
+  return true;
+}
+
+void free_coverage(Coverage_t *coverage) {
+  if (coverage->shared)
+    shmdt(coverage->map);
+  else
+    free(coverage->map);
+  coverage->map = NULL;
+}
+
+bool coverage_save(const Coverage_t *coverage, const char *path) {
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    perror("Error: Failed to open coverage file");
+    return false;
+  }
+
+  bool ok = fwrite(coverage->map, 1, COVERAGE_MAP_SIZE, file) ==
+            COVERAGE_MAP_SIZE;
+  if (fclose(file) != 0)
+    ok = false;
+  if (!ok)
+    fprintf(stderr, "Error: Failed to write coverage file %s\n", path);
+  return ok;
+}
+
+static bool read_message(uint32_t *value) {
+  return read(COVERAGE_FORKSRV_FD, value, 4) == 4;
+}
+
+static bool write_message(uint32_t value) {
+  return write(COVERAGE_FORKSRV_FD + 1, &value, 4) == 4;
+}
+
+// The parent never returns: it lives until afl-fuzz closes the pipes.
+void coverage_fork_server(void) {
+  if (!write_message(0))
+    return;
+
+  for (;;) {
+    uint32_t was_killed;
+    if (!read_message(&was_killed))
+      _exit(EXIT_SUCCESS);
+
+    pid_t child = fork();
+    if (child < 0)
+      _exit(EXIT_FAILURE);
+    if (child == 0) {
+      close(COVERAGE_FORKSRV_FD);
+      close(COVERAGE_FORKSRV_FD + 1);
+      return;
+    }
+
+    int status;
+    if (!write_message((uint32_t)child) || waitpid(child, &status, 0) < 0 ||
+        !write_message((uint32_t)status))
+      _exit(EXIT_FAILURE);
+  }
+}
@@ -11,6 +11,7 @@ void init_cpu(CPU_t *cpu) {
 
   cpu->exit_code = 0;
   cpu->halt = false;
+  cpu->faulted = false;
 }
 
 uint32_t read_reg(CPU_t *cpu, unsigned int idx) {
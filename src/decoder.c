@@ -1,241 +1,228 @@
 #include "decoder.h"
 
+#include "hypercall.h"
 #include "instructions/instructions.h"
 #include "instructions/instructions_m.h"
+#include "isa.h"
 #include "opcodes.h"
 #include "utils.h"
 
-typedef void (*OpcodeHandler)(uint32_t inst, RvContext_t *context);
+typedef InstructionHandler (*OpcodeDecoder)(uint32_t inst);
 
-static void decode_jalr(uint32_t inst, RvContext_t *context) {
+static InstructionHandler decode_lui(uint32_t inst) {
+  (void)inst;
+  return handle_lui;
+}
+
+static InstructionHandler decode_auipc(uint32_t inst) {
+  (void)inst;
+  return handle_auipc;
+}
+
+static InstructionHandler decode_jal(uint32_t inst) {
+  (void)inst;
+  return handle_jal;
+}
+
+static InstructionHandler decode_jalr(uint32_t inst) {
   if (get_funct3(inst) == 0)
-    handle_jalr(inst, context);
-  else
-    handle_illegal_instruction(inst, context);
+    return handle_jalr;
+  return handle_illegal_instruction;
 }
 
-static void decode_branch(uint32_t inst, RvContext_t *context) {
+static InstructionHandler decode_branch(uint32_t inst) {
   switch (get_funct3(inst)) {
   case 0b000:
-    handle_beq(inst, context);
-    break;
+    return handle_beq;
   case 0b001:
-    handle_bne(inst, context);
-    break;
+    return handle_bne;
   case 0b100:
-    handle_blt(inst, context);
-    break;
+    return handle_blt;
   case 0b101:
-    handle_bge(inst, context);
-    break;
+    return handle_bge;
   case 0b110:
-    handle_bltu(inst, context);
-    break;
+    return handle_bltu;
   case 0b111:
-    handle_bgeu(inst, context);
-    break;
+    return handle_bgeu;
   default:
-    handle_illegal_instruction(inst, context);
-    break;
+    return handle_illegal_instruction;
   }
 }
 
-static void decode_load(uint32_t inst, RvContext_t *context) {
+static InstructionHandler decode_load(uint32_t inst) {
   switch (get_funct3(inst)) {
   case 0b000:
-    handle_lb(inst, context);
-    break;
+    return handle_lb;
   case 0b001:
-    handle_lh(inst, context);
-    break;
+    return handle_lh;
   case 0b010:
-    handle_lw(inst, context);
-    break;
+    return handle_lw;
   case 0b100:
-    handle_lbu(inst, context);
-    break;
+    return handle_lbu;
   case 0b101:
-    handle_lhu(inst, context);
-    break;
+    return handle_lhu;
   default:
-    handle_illegal_instruction(inst, context);
-    break;
+    return handle_illegal_instruction;
   }
 }
 
-static void decode_store(uint32_t inst, RvContext_t *context) {
+static InstructionHandler decode_store(uint32_t inst) {
   switch (get_funct3(inst)) {
   case 0b000:
-    handle_sb(inst, context);
-    break;
+    return handle_sb;
   case 0b001:
-    handle_sh(inst, context);
-    break;
+    return handle_sh;
   case 0b010:
-    handle_sw(inst, context);
-    break;
+    return handle_sw;
   default:
-    handle_illegal_instruction(inst, context);
-    break;
+    return handle_illegal_instruction;
   }
 }
 
-static void decode_op_imm(uint32_t inst, RvContext_t *context) {
+static InstructionHandler decode_op_imm(uint32_t inst) {
   switch (get_funct3(inst)) {
   case 0b000:
-    handle_addi(inst, context);
-    break;
+    return handle_addi;
   case 0b001:
     if (get_funct7(inst) == 0b0000000)
-      handle_slli(inst, context);
-    else
-      handle_illegal_instruction(inst, context);
-    break;
+      return handle_slli;
+    return handle_illegal_instruction;
   case 0b010:
-    handle_slti(inst, context);
-    break;
+    return handle_slti;
   case 0b011:
-    handle_sltiu(inst, context);
-    break;
+    return handle_sltiu;
   case 0b100:
-    handle_xori(inst, context);
-    break;
+    return handle_xori;
   case 0b101:
     if (get_funct7(inst) == 0b0000000)
-      handle_srli(inst, context);
-    else if (get_funct7(inst) == 0b0100000)
-      handle_srai(inst, context);
-    else
-      handle_illegal_instruction(inst, context);
-    break;
+      return handle_srli;
+    if (get_funct7(inst) == 0b0100000)
+      return handle_srai;
+    return handle_illegal_instruction;
   case 0b110:
-    handle_ori(inst, context);
-    break;
+    return handle_ori;
   case 0b111:
-    handle_andi(inst, context);
-    break;
+    return handle_andi;
   }
+
+  return handle_illegal_instruction;
 }
 
-static void decode_m_extension(uint32_t inst, RvContext_t *context) {
+static InstructionHandler decode_m_extension(uint32_t inst) {
   switch (get_funct3(inst)) {
   case 0b000:
-    handle_mul(inst, context);
-    break;
+    return handle_mul;
   case 0b001:
-    handle_mulh(inst, context);
-    break;
+    return handle_mulh;
   case 0b010:
-    handle_mulhsu(inst, context);
-    break;
+    return handle_mulhsu;
   case 0b011:
-    handle_mulhu(inst, context);
-    break;
+    return handle_mulhu;
   case 0b100:
-    handle_div(inst, context);
-    break;
+    return handle_div;
   case 0b101:
-    handle_divu(inst, context);
-    break;
+    return handle_divu;
   case 0b110:
-    handle_rem(inst, context);
-    break;
+    return handle_rem;
   case 0b111:
-    handle_remu(inst, context);
-    break;
+    return handle_remu;
   }
+
+  return handle_illegal_instruction;
 }
 
-static void decode_base_op(uint32_t inst, RvContext_t *context) {
+static InstructionHandler decode_base_op(uint32_t inst) {
   switch (get_funct3(inst)) {
   case 0b000:
-    handle_add(inst, context);
-    break;
+    return handle_add;
   case 0b001:
-    handle_sll(inst, context);
-    break;
+    return handle_sll;
   case 0b010:
-    handle_slt(inst, context);
-    break;
+    return handle_slt;
   case 0b011:
-    handle_sltu(inst, context);
-    break;
+    return handle_sltu;
   case 0b100:
-    handle_xor(inst, context);
-    break;
+    return handle_xor;
   case 0b101:
-    handle_srl(inst, context);
-    break;
+    return handle_srl;
   case 0b110:
-    handle_or(inst, context);
-    break;
+    return handle_or;
   case 0b111:
-    handle_and(inst, context);
-    break;
+    return handle_and;
   }
+
+  return handle_illegal_instruction;
 }
 
-static void decode_op(uint32_t inst, RvContext_t *context) {
+static InstructionHandler decode_op(uint32_t inst) {
   switch (get_funct7(inst)) {
   case 0b0000000:
-    decode_base_op(inst, context);
-    break;
+    return decode_base_op(inst);
   case 0b0000001:
-    decode_m_extension(inst, context);
-    break;
+    if (RV_ISA_HAS_M)
+      return decode_m_extension(inst);
+    return handle_illegal_instruction;
   case 0b0100000:
     if (get_funct3(inst) == 0b000)
-      handle_sub(inst, context);
-    else if (get_funct3(inst) == 0b101)
-      handle_sra(inst, context);
-    else
-      handle_illegal_instruction(inst, context);
-    break;
+      return handle_sub;
+    if (get_funct3(inst) == 0b101)
+      return handle_sra;
+    return handle_illegal_instruction;
   default:
-    handle_illegal_instruction(inst, context);
-    break;
+    return handle_illegal_instruction;
   }
 }
 
-static void decode_misc_mem(uint32_t inst, RvContext_t *context) {
-  if (get_funct3(inst) == 0b000)
-    handle_fence(inst, context);
-  else
-    handle_illegal_instruction(inst, context);
+static InstructionHandler decode_misc_mem(uint32_t inst) {
+  switch (get_funct3(inst)) {
+  case 0b000:
+    return handle_fence;
+  case 0b001:
+    return handle_fence_i;
+  default:
+    return handle_illegal_instruction;
+  }
 }
 
-static void decode_system(uint32_t inst, RvContext_t *context) {
-  if (get_funct3(inst) != 0 || get_rd(inst) != 0 || get_rs1(inst) != 0) {
-    handle_illegal_instruction(inst, context);
-    return;
-  }
+static InstructionHandler decode_system(uint32_t inst) {
+  if (get_funct3(inst) != 0 || get_rd(inst) != 0 || get_rs1(inst) != 0)
+    return handle_illegal_instruction;
 
   switch (get_imm_i(inst)) {
   case 0:
-    handle_ecall(inst, context);
-    break;
+    return handle_ecall;
   case 1:
-    handle_ebreak(inst, context);
-    break;
+    return handle_ebreak;
   default:
-    handle_illegal_instruction(inst, context);
-    break;
+    return handle_illegal_instruction;
   }
 }
 
-static const OpcodeHandler opcode_table[128] = {
-    [OPCODE_LUI] = handle_lui,       [OPCODE_AUIPC] = handle_auipc,
-    [OPCODE_JAL] = handle_jal,       [OPCODE_JALR] = decode_jalr,
+// Both custom opcode spaces hold hypercalls; the register fields are
+// reserved.
+static InstructionHandler decode_custom(uint32_t inst) {
+  if (get_rd(inst) != 0 || get_rs1(inst) != 0 || get_rs2(inst) != 0)
+    return handle_illegal_instruction;
+  return handle_hypercall;
+}
+
+static const OpcodeDecoder opcode_table[128] = {
+    [OPCODE_LUI] = decode_lui,       [OPCODE_AUIPC] = decode_auipc,
+    [OPCODE_JAL] = decode_jal,       [OPCODE_JALR] = decode_jalr,
     [OPCODE_BRANCH] = decode_branch, [OPCODE_LOAD] = decode_load,
     [OPCODE_STORE] = decode_store,   [OPCODE_OP_IMM] = decode_op_imm,
     [OPCODE_OP] = decode_op,         [OPCODE_MISC_MEM] = decode_misc_mem,
-    [OPCODE_SYSTEM] = decode_system,
+    [OPCODE_SYSTEM] = decode_system, [OPCODE_CUSTOM_0] = decode_custom,
+    [OPCODE_CUSTOM_1] = decode_custom,
 };
 
+InstructionHandler decode_instruction(uint32_t inst) {
+  OpcodeDecoder decoder = opcode_table[get_opcode(inst)];
+  if (decoder)
+    return decoder(inst);
+  return handle_illegal_instruction;
+}
+
 void decode_and_execute(uint32_t inst, RvContext_t *context) {
-  OpcodeHandler handler = opcode_table[get_opcode(inst)];
-  if (handler)
-    handler(inst, context);
-  else
-    handle_illegal_instruction(inst, context);
+  decode_instruction(inst)(inst, context);
 }
@@ -1,8 +1,20 @@
 #include "emulator.h"
 
+#include "bbv.h"
+#include "block_cache.h"
+#include "block_optimizer.h"
+#include "breakpoints.h"
 #include "compressed_decoder.h"
+#include "coverage.h"
 #include "decoder.h"
 #include "fetch.h"
+#include "isa.h"
+#include "timing.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
 
 RvStepResult rv_step(RvContext_t *context) {
   CPU_t *cpu = context->cpu;
@@ -20,6 +32,7 @@ RvStepResult rv_step(RvContext_t *context) {
   if (!fetch.success) {
     cpu->exit_code = 1;
     cpu->halt = true;
+    cpu->faulted = true;
     return result;
   }
 
@@ -28,7 +41,7 @@ RvStepResult rv_step(RvContext_t *context) {
 
   uint32_t instruction = fetch.inst;
 
-  if (fetch.len == 2)
+  if (RV_ISA_HAS_C && fetch.len == 2)
     instruction = expand_compressed((uint16_t)fetch.inst);
 
   result.decoded_instruction = instruction;
@@ -41,8 +54,166 @@ RvStepResult rv_step(RvContext_t *context) {
   if (cpu->halt)
     return result;
 
+  if (context->timing)
+    timing_retire(context->timing, instruction);
   cpu->pc = cpu->next_pc;
   result.status = RV_STEP_EXECUTED;
 
   return result;
 }
+
+// Returns how many instructions retired. As in rv_step, one that stops the
+// guest does not count.
+static uint32_t execute_block(const Block_t *block, RvContext_t *context) {
+  CPU_t *cpu = context->cpu;
+
+  for (uint32_t i = 0; i < block->count; i++) {
+    const BlockInstruction_t *insn = &block->insns[i];
+    cpu->current_inst_len = insn->len;
+    cpu->next_pc = cpu->pc + insn->len;
+
+    insn->handler(insn->inst, context);
+
+    if (cpu->halt)
+      return i;
+    cpu->pc = cpu->next_pc;
+
+    // A store into this block's own code ends it; the rest is re-decoded.
+    if (block->invalid)
+      return i + 1;
+  }
+  return block->count;
+}
+
+static volatile sig_atomic_t deadline_expired;
+
+static void on_deadline(int signal) {
+  (void)signal;
+  deadline_expired = 1;
+}
+
+RvRunCheck rv_check_limits(RvContext_t *context, uint32_t count) {
+  RvStopReason reason;
+  if (context->breakpoints &&
+      breakpoints_contains(context->breakpoints, context->cpu->pc)) {
+    reason = RV_STOP_BREAKPOINT;
+  } else if (context->deadline_expired && *context->deadline_expired) {
+    reason = RV_STOP_DEADLINE;
+  } else if (context->instruction_limit == 0 ||
+             context->instruction_limit - context->instructions_retired >=
+                 count) {
+    return RV_RUN_BLOCK;
+  } else if (context->instructions_retired < context->instruction_limit) {
+    return RV_RUN_STEP;
+  } else {
+    reason = RV_STOP_BUDGET;
+  }
+
+  context->stop_reason = reason;
+  context->cpu->halt = true;
+  return RV_RUN_STOP;
+}
+
+bool rv_set_deadline(RvContext_t *context, uint64_t milliseconds) {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = on_deadline;
+  sigemptyset(&action.sa_mask);
+  // Host system calls made for the guest restart instead of failing.
+  action.sa_flags = SA_RESTART;
+
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  timer.it_value.tv_sec = (time_t)(milliseconds / 1000);
+  timer.it_value.tv_usec = (suseconds_t)(milliseconds % 1000 * 1000);
+  if (milliseconds == 0)
+    timer.it_value.tv_usec = 1;
+
+  deadline_expired = 0;
+  if (sigaction(SIGALRM, &action, NULL) != 0 ||
+      setitimer(ITIMER_REAL, &timer, NULL) != 0) {
+    perror("Error: Failed to arm the deadline timer");
+    return false;
+  }
+  context->deadline_expired = &deadline_expired;
+  return true;
+}
+
+void rv_clear_deadline(RvContext_t *context) {
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_REAL, &timer, NULL);
+  context->deadline_expired = NULL;
+}
+
+// Single-steps one instruction for an engine that cannot run a whole block.
+static void step_counted(RvContext_t *context) {
+  RvStepResult result = rv_step(context);
+  if (result.status != RV_STEP_EXECUTED)
+    return;
+  context->instructions_retired++;
+  if (context->bbv)
+    bbv_record(context->bbv, result.pc, 1);
+}
+
+static void run_blocks(RvContext_t *context) {
+  CPU_t *cpu = context->cpu;
+  BlockCache_t *cache = context->blocks;
+  Block_t *block = NULL;
+
+  while (!cpu->halt) {
+    if (block)
+      block = block_cache_next(cache, context, block, cpu->pc);
+    else
+      block = block_cache_lookup(cache, context, cpu->pc);
+
+    // Let the interpreter report instructions that cannot be fetched.
+    if (!block) {
+      if (rv_check_limits(context, 1) != RV_RUN_STOP)
+        step_counted(context);
+      continue;
+    }
+
+    // A block runs only when all of it fits in the instruction budget, and
+    // is charged the instructions that actually retired, which are fewer
+    // when it stops early. A block that would overrun the budget is
+    // single-stepped instead, so the limit itself is exact.
+    RvRunCheck check = rv_check_limits(context, block->count);
+    if (check != RV_RUN_BLOCK) {
+      if (check == RV_RUN_STEP)
+        step_counted(context);
+      block = NULL;
+      continue;
+    }
+    if (block->loop && block_execute_loop(block, context))
+      continue;
+    if (context->coverage)
+      coverage_edge(context->coverage, block->start_pc);
+
+    uint32_t retired;
+    if (block->uops) {
+      retired = block_execute_optimized(block, context);
+    } else {
+      retired = execute_block(block, context);
+      if (cache->hot_threshold != 0 &&
+          ++block->exec_count == cache->hot_threshold)
+        block_optimize(cache, block);
+    }
+    context->instructions_retired += retired;
+    if (context->bbv)
+      bbv_record(context->bbv, block->start_pc, retired);
+  }
+}
+
+void rv_run(RvContext_t *context) {
+  context->stop_reason = RV_STOP_HALTED;
+  if (context->coverage)
+    context->coverage->block_edges = context->blocks != NULL;
+  if (context->blocks) {
+    run_blocks(context);
+    return;
+  }
+
+  while (!context->cpu->halt && rv_check_limits(context, 1) != RV_RUN_STOP)
+    step_counted(context);
+}
@@ -1,19 +1,46 @@
 #include "fetch.h"
 
-#include "utils.h"
+#include "isa.h"
 
-FetchResult_t fetch_instruction(const Memory_t *memory, uint32_t pc) {
-  uint16_t lower;
-  if (!read_half(memory, pc, &lower))
+#include <string.h>
+
+// Reads one instruction parcel from a page that grants execute permission.
+static bool fetch_parcel(const Memory_t *memory, uint32_t pc, size_t size,
+                         uint32_t *value) {
+  if (!validate_alignment(pc, size))
+    return false;
+
+  const uint8_t *host = memory_access(memory, pc, size, MEMORY_PROT_EXEC);
+  if (!host)
+    return false;
+
+  *value = 0;
+  memcpy(value, host, size);
+  return true;
+}
+
+// Handles what the fast path rejects: TLB misses, misaligned pc,
+// instructions that straddle a page, and the last bytes of guest memory.
+// Faults are reported the way data accesses report them.
+static FetchResult_t fetch_slow(const Memory_t *memory, uint32_t pc) {
+  if (!RV_ISA_HAS_C) {
+    uint32_t inst;
+    if (!fetch_parcel(memory, pc, 4, &inst))
+      return (FetchResult_t){.success = false};
+    return (FetchResult_t){.inst = inst, .len = 4, .success = true};
+  }
+
+  uint32_t lower;
+  if (!fetch_parcel(memory, pc, 2, &lower))
     return (FetchResult_t){.success = false};
 
-  if (!is_compressed(lower)) {
-    uint16_t upper;
-    if (!read_half(memory, pc + 2, &upper))
+  if (!is_compressed((uint16_t)lower)) {
+    uint32_t upper;
+    if (!fetch_parcel(memory, pc + 2, 2, &upper))
       return (FetchResult_t){.success = false};
 
     return (FetchResult_t){
-        .inst = (uint32_t)lower | ((uint32_t)upper << 16),
+        .inst = lower | (upper << 16),
         .len = 4,
         .success = true,
     };
@@ -21,3 +48,28 @@ FetchResult_t fetch_instruction(const Memory_t *memory, uint32_t pc) {
 
   return (FetchResult_t){.inst = lower, .len = 2, .success = true};
 }
+
+// An aligned pc whose four bytes lie in one page that the execute TLB holds
+// needs a single tag compare and a single load, even when the instruction
+// turns out to be compressed.
+FetchResult_t fetch_instruction(const Memory_t *memory, uint32_t pc) {
+  if (pc % RV_INSTRUCTION_ALIGN == 0 &&
+      pc % GUEST_PAGE_SIZE <= GUEST_PAGE_SIZE - 4) {
+    const uint8_t *host = memory_tlb_lookup(memory->tlb->exec, pc);
+    if (host) {
+      uint32_t word;
+      memcpy(&word, host, 4);
+      if (rv_is_compressed((uint16_t)word))
+        return (FetchResult_t){
+            .inst = word & 0xFFFF, .len = 2, .success = true};
+      return (FetchResult_t){.inst = word, .len = 4, .success = true};
+    }
+  }
+
+  // Memory with an observer keeps its TLB empty, so every fetch gets here.
+  FetchResult_t fetch = fetch_slow(memory, pc);
+  if (fetch.success && memory->observer)
+    memory->observer(memory->observer_arg, pc, (size_t)fetch.len,
+                     MEMORY_PROT_EXEC);
+  return fetch;
+}
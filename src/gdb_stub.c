@@ -0,0 +1,612 @@
+#include "gdb_stub.h"
+
+#include "block_cache.h"
+#include "cpu.h"
+#include "emulator.h"
+#include "memory.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define GDB_SIGINT 2
+#define GDB_SIGTRAP 5
+#define GDB_SIGALRM 14
+#define GDB_SIGXCPU 24
+// Register numbers in the target description: x0-x31, then pc.
+#define GDB_PC_REGISTER 32
+#define GDB_REGISTER_COUNT 33
+
+static const char target_xml[] =
+    "<?xml version=\"1.0\"?>"
+    "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+    "<target version=\"1.0\">"
+    "<architecture>riscv:rv32</architecture>"
+    "<feature name=\"org.gnu.gdb.riscv.cpu\">"
+    "<reg name=\"zero\" bitsize=\"32\" type=\"int\" regnum=\"0\"/>"
+    "<reg name=\"ra\" bitsize=\"32\" type=\"code_ptr\"/>"
+    "<reg name=\"sp\" bitsize=\"32\" type=\"data_ptr\"/>"
+    "<reg name=\"gp\" bitsize=\"32\" type=\"data_ptr\"/>"
+    "<reg name=\"tp\" bitsize=\"32\" type=\"data_ptr\"/>"
+    "<reg name=\"t0\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"t1\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"t2\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"fp\" bitsize=\"32\" type=\"data_ptr\"/>"
+    "<reg name=\"s1\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a0\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a1\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a2\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a3\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a4\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a5\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a6\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a7\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s2\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s3\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s4\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s5\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s6\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s7\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s8\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s9\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s10\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s11\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"t3\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"t4\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"t5\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"t6\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/>"
+    "</feature>"
+    "</target>";
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+// Parses hex digits at *text, advancing past them. Fails on no digits or
+// overflow.
+static bool parse_hex(const char **text, uint32_t *value) {
+  const char *p = *text;
+  uint64_t result = 0;
+  int digit;
+  while ((digit = hex_value(*p)) >= 0) {
+    result = result * 16 + (uint64_t)digit;
+    if (result > UINT32_MAX)
+      return false;
+    p++;
+  }
+  if (p == *text)
+    return false;
+  *value = (uint32_t)result;
+  *text = p;
+  return true;
+}
+
+static bool expect(const char **text, char c) {
+  if (**text != c)
+    return false;
+  (*text)++;
+  return true;
+}
+
+// Registers travel as 8 hex digits in guest (little-endian) byte order.
+static char *put_register(char *out, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    uint8_t byte = (uint8_t)(value >> (8 * i));
+    *out++ = hex_digits[byte >> 4];
+    *out++ = hex_digits[byte & 0xF];
+  }
+  return out;
+}
+
+static bool get_register(const char **text, uint32_t *value) {
+  uint32_t result = 0;
+  for (int i = 0; i < 8; i++) {
+    int digit = hex_value((*text)[i]);
+    if (digit < 0)
+      return false;
+    result |= (uint32_t)digit << (8 * (i / 2) + (i % 2 ? 0 : 4));
+  }
+  *text += 8;
+  *value = result;
+  return true;
+}
+
+static bool send_all(int fd, const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += sent;
+    length -= (size_t)sent;
+  }
+  return true;
+}
+
+static bool read_byte_from(int fd, char *c) {
+  while (true) {
+    ssize_t received = recv(fd, c, 1, 0);
+    if (received == 1)
+      return true;
+    if (received < 0 && errno == EINTR)
+      continue;
+    return false;
+  }
+}
+
+// Sends `length` bytes of `data` as a packet and keeps it for a resend.
+static bool send_reply(GdbStub_t *stub, const char *data, size_t length) {
+  if (length > sizeof(stub->reply) - 4)
+    length = sizeof(stub->reply) - 4;
+
+  uint8_t checksum = 0;
+  stub->reply[0] = '$';
+  for (size_t i = 0; i < length; i++) {
+    stub->reply[1 + i] = data[i];
+    checksum += (uint8_t)data[i];
+  }
+  stub->reply[1 + length] = '#';
+  stub->reply[2 + length] = hex_digits[checksum >> 4];
+  stub->reply[3 + length] = hex_digits[checksum & 0xF];
+  stub->reply_length = length + 4;
+  return send_all(stub->fd, stub->reply, stub->reply_length);
+}
+
+static bool send_string(GdbStub_t *stub, const char *text) {
+  return send_reply(stub, text, strlen(text));
+}
+
+// Reads the next packet into stub->packet and acknowledges it. Returns
+// false when gdb has gone away.
+static bool read_packet(GdbStub_t *stub) {
+  char c;
+  while (true) {
+    if (!read_byte_from(stub->fd, &c))
+      return false;
+    if (c == '-' && stub->reply_length > 0) {
+      if (!send_all(stub->fd, stub->reply, stub->reply_length))
+        return false;
+      continue;
+    }
+    if (c != '$')
+      continue;
+
+    size_t length = 0;
+    uint8_t checksum = 0;
+    while (read_byte_from(stub->fd, &c) && c != '#') {
+      if (length < sizeof(stub->packet) - 1)
+        stub->packet[length++] = c;
+      checksum += (uint8_t)c;
+    }
+    char sum[2];
+    if (c != '#' || !read_byte_from(stub->fd, &sum[0]) ||
+        !read_byte_from(stub->fd, &sum[1]))
+      return false;
+    stub->packet[length] = '\0';
+
+    if (hex_value(sum[0]) * 16 + hex_value(sum[1]) != checksum) {
+      if (!send_all(stub->fd, "-", 1))
+        return false;
+      continue;
+    }
+    return send_all(stub->fd, "+", 1);
+  }
+}
+
+// gdb sends a bare 0x03 to stop a running guest.
+static bool interrupt_requested(GdbStub_t *stub) {
+  char c;
+  if (recv(stub->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) != 1 || c != 0x03)
+    return false;
+  return recv(stub->fd, &c, 1, 0) == 1;
+}
+
+static bool guest_exited(const RvContext_t *context) {
+  return context->cpu->halt && context->stop_reason == RV_STOP_HALTED;
+}
+
+static bool send_stop(GdbStub_t *stub, int signal) {
+  char reply[8];
+  if (guest_exited(stub->context))
+    snprintf(reply, sizeof(reply), "W%02x",
+             stub->context->cpu->exit_code & 0xFF);
+  else
+    snprintf(reply, sizeof(reply), "S%02x", signal);
+  return send_string(stub, reply);
+}
+
+static void step(RvContext_t *context) {
+  context->cpu->halt = false;
+  context->stop_reason = RV_STOP_HALTED;
+  if (rv_step(context).status == RV_STEP_EXECUTED)
+    context->instructions_retired++;
+}
+
+// Runs in slices of GDB_RUN_SLICE instructions, so that an interrupt from
+// gdb is seen while the guest is in a long loop.
+static int resume(GdbStub_t *stub) {
+  RvContext_t *context = stub->context;
+  CPU_t *cpu = context->cpu;
+  uint64_t limit = stub->instruction_limit;
+
+  // rv_run stops before a breakpoint at the current pc; get past it first.
+  if (breakpoints_contains(&stub->breakpoints, cpu->pc)) {
+    step(context);
+    if (cpu->halt)
+      return GDB_SIGTRAP;
+  }
+
+  int signal = GDB_SIGTRAP;
+  while (true) {
+    uint64_t slice = context->instructions_retired + GDB_RUN_SLICE;
+    context->instruction_limit = limit != 0 && limit < slice ? limit : slice;
+    cpu->halt = false;
+    rv_run(context);
+
+    if (context->stop_reason == RV_STOP_BUDGET &&
+        context->instructions_retired != limit) {
+      if (!interrupt_requested(stub))
+        continue;
+      signal = GDB_SIGINT;
+    } else if (context->stop_reason == RV_STOP_BUDGET) {
+      signal = GDB_SIGXCPU;
+    } else if (context->stop_reason == RV_STOP_DEADLINE) {
+      signal = GDB_SIGALRM;
+    }
+    break;
+  }
+  context->instruction_limit = limit;
+  return signal;
+}
+
+static bool read_registers(GdbStub_t *stub) {
+  CPU_t *cpu = stub->context->cpu;
+  char reply[GDB_REGISTER_COUNT * 8];
+  char *out = reply;
+  for (uint8_t reg = 0; reg < 32; reg++)
+    out = put_register(out, read_reg(cpu, reg));
+  out = put_register(out, cpu->pc);
+  return send_reply(stub, reply, sizeof(reply));
+}
+
+static bool write_registers(GdbStub_t *stub, const char *args) {
+  CPU_t *cpu = stub->context->cpu;
+  uint32_t values[GDB_REGISTER_COUNT];
+  for (int i = 0; i < GDB_REGISTER_COUNT; i++) {
+    if (!get_register(&args, &values[i]))
+      return send_string(stub, "E01");
+  }
+  for (uint8_t reg = 1; reg < 32; reg++)
+    write_reg(cpu, reg, values[reg]);
+  cpu->pc = values[GDB_PC_REGISTER];
+  return send_string(stub, "OK");
+}
+
+static bool read_register(GdbStub_t *stub, const char *args) {
+  CPU_t *cpu = stub->context->cpu;
+  uint32_t reg;
+  if (!parse_hex(&args, &reg) || reg >= GDB_REGISTER_COUNT)
+    return send_string(stub, "E01");
+
+  char reply[8];
+  put_register(reply, reg == GDB_PC_REGISTER ? cpu->pc
+                                             : read_reg(cpu, (uint8_t)reg));
+  return send_reply(stub, reply, sizeof(reply));
+}
+
+static bool write_register(GdbStub_t *stub, const char *args) {
+  CPU_t *cpu = stub->context->cpu;
+  uint32_t reg;
+  uint32_t value;
+  if (!parse_hex(&args, &reg) || !expect(&args, '=') ||
+      !get_register(&args, &value) || reg >= GDB_REGISTER_COUNT)
+    return send_string(stub, "E01");
+
+  if (reg == GDB_PC_REGISTER)
+    cpu->pc = value;
+  else
+    write_reg(cpu, (uint8_t)reg, value);
+  return send_string(stub, "OK");
+}
+
+// The debugger sees all of guest memory, whatever its page protection.
+static bool read_memory(GdbStub_t *stub, const char *args) {
+  uint32_t addr;
+  uint32_t length;
+  uint8_t *data;
+  if (!parse_hex(&args, &addr) || !expect(&args, ',') ||
+      !parse_hex(&args, &length))
+    return send_string(stub, "E01");
+  if (length > (GDB_PACKET_SIZE - 4) / 2)
+    length = (GDB_PACKET_SIZE - 4) / 2;
+  if (!memory_get_pointer(stub->context->memory, addr, length, &data))
+    return send_string(stub, "E14");
+
+  char reply[GDB_PACKET_SIZE];
+  for (uint32_t i = 0; i < length; i++) {
+    reply[2 * i] = hex_digits[data[i] >> 4];
+    reply[2 * i + 1] = hex_digits[data[i] & 0xF];
+  }
+  return send_reply(stub, reply, 2 * (size_t)length);
+}
+
+static bool write_memory(GdbStub_t *stub, const char *args) {
+  Memory_t *memory = stub->context->memory;
+  uint32_t addr;
+  uint32_t length;
+  uint8_t *data;
+  if (!parse_hex(&args, &addr) || !expect(&args, ',') ||
+      !parse_hex(&args, &length) || !expect(&args, ':') ||
+      strlen(args) != 2 * (size_t)length)
+    return send_string(stub, "E01");
+  if (!memory_get_pointer(memory, addr, length, &data))
+    return send_string(stub, "E14");
+
+  for (uint32_t i = 0; i < length; i++) {
+    int high = hex_value(args[2 * i]);
+    int low = hex_value(args[2 * i + 1]);
+    if (high < 0 || low < 0)
+      return send_string(stub, "E01");
+    data[i] = (uint8_t)(high * 16 + low);
+  }
+  // Predecoded and translated code over the written bytes is dropped.
+  memory_mark_written(memory, addr, length);
+  return send_string(stub, "OK");
+}
+
+// Z0/z0 (software) and Z1/z1 (hardware) breakpoints are the same here.
+static bool change_breakpoint(GdbStub_t *stub, const char *args, bool insert) {
+  uint32_t type;
+  uint32_t addr;
+  if (!parse_hex(&args, &type) || !expect(&args, ',') ||
+      !parse_hex(&args, &addr))
+    return send_string(stub, "E01");
+  if (type > 1)
+    return send_string(stub, "");
+
+  if (!insert) {
+    breakpoints_remove(&stub->breakpoints, addr);
+    return send_string(stub, "OK");
+  }
+  if (!breakpoints_insert(&stub->breakpoints, addr))
+    return send_string(stub, "E01");
+  // Blocks built across the address end before it from now on.
+  if (stub->context->blocks)
+    block_cache_invalidate(stub->context->blocks, addr, 1);
+  return send_string(stub, "OK");
+}
+
+static bool read_target_xml(GdbStub_t *stub, const char *args) {
+  uint32_t offset;
+  uint32_t length;
+  if (!parse_hex(&args, &offset) || !expect(&args, ',') ||
+      !parse_hex(&args, &length))
+    return send_string(stub, "E01");
+
+  size_t size = sizeof(target_xml) - 1;
+  if (offset > size)
+    return send_string(stub, "E01");
+  if (length > GDB_PACKET_SIZE - 5)
+    length = GDB_PACKET_SIZE - 5;
+
+  size_t remaining = size - offset;
+  size_t chunk = remaining < length ? remaining : length;
+  char reply[GDB_PACKET_SIZE];
+  reply[0] = chunk == remaining ? 'l' : 'm';
+  memcpy(reply + 1, target_xml + offset, chunk);
+  return send_reply(stub, reply, chunk + 1);
+}
+
+static bool handle_query(GdbStub_t *stub, const char *packet) {
+  static const char xfer[] = "qXfer:features:read:target.xml:";
+  char reply[64];
+
+  if (strncmp(packet, "qSupported", 10) == 0) {
+    snprintf(reply, sizeof(reply), "PacketSize=%x;qXfer:features:read+",
+             GDB_PACKET_SIZE);
+    return send_string(stub, reply);
+  }
+  if (strncmp(packet, xfer, sizeof(xfer) - 1) == 0)
+    return read_target_xml(stub, packet + sizeof(xfer) - 1);
+  if (strcmp(packet, "qAttached") == 0)
+    return send_string(stub, "0");
+  return send_string(stub, "");
+}
+
+// Serves packets until the session ends. Returns false when gdb detached,
+// so the guest should run on without it.
+static bool serve(GdbStub_t *stub) {
+  RvContext_t *context = stub->context;
+  CPU_t *cpu = context->cpu;
+
+  while (read_packet(stub)) {
+    const char *packet = stub->packet;
+    const char *args = packet + 1;
+    bool ok;
+
+    switch (packet[0]) {
+    case '?':
+      ok = send_stop(stub, GDB_SIGTRAP);
+      break;
+    case 'g':
+      ok = read_registers(stub);
+      break;
+    case 'G':
+      ok = write_registers(stub, args);
+      break;
+    case 'p':
+      ok = read_register(stub, args);
+      break;
+    case 'P':
+      ok = write_register(stub, args);
+      break;
+    case 'm':
+      ok = read_memory(stub, args);
+      break;
+    case 'M':
+      ok = write_memory(stub, args);
+      break;
+    case 'c':
+    case 's': {
+      uint32_t addr;
+      if (parse_hex(&args, &addr))
+        cpu->pc = addr;
+      int signal = GDB_SIGTRAP;
+      if (!guest_exited(context)) {
+        if (packet[0] == 's')
+          step(context);
+        else
+          signal = resume(stub);
+      }
+      ok = send_stop(stub, signal);
+      break;
+    }
+    case 'Z':
+    case 'z':
+      ok = change_breakpoint(stub, args, packet[0] == 'Z');
+      break;
+    case 'H':
+      ok = send_string(stub, "OK");
+      break;
+    case 'q':
+      ok = handle_query(stub, packet);
+      break;
+    case 'D':
+      send_string(stub, "OK");
+      return false;
+    case 'k':
+      return true;
+    default:
+      ok = send_string(stub, "");
+      break;
+    }
+    if (!ok)
+      break;
+  }
+  return true;
+}
+
+bool gdb_serve_fd(RvContext_t *context, int fd) {
+  GdbStub_t stub = {.fd = fd,
+                    .context = context,
+                    .instruction_limit = context->instruction_limit,
+                    .reply_length = 0};
+  if (!init_breakpoints(&stub.breakpoints)) {
+    fprintf(stderr, "Error: Failed to allocate breakpoints\n");
+    return false;
+  }
+
+  context->breakpoints = &stub.breakpoints;
+  bool killed = serve(&stub);
+  context->breakpoints = NULL;
+  context->instruction_limit = stub.instruction_limit;
+  free_breakpoints(&stub.breakpoints);
+
+  if (guest_exited(context))
+    return true;
+  if (killed) {
+    // Leaves the guest halted where gdb left it.
+    context->cpu->halt = true;
+    context->stop_reason = RV_STOP_HALTED;
+    return true;
+  }
+
+  context->cpu->halt = false;
+  rv_run(context);
+  return true;
+}
+
+// Takes ownership of `fd`, which `bound` says was bound successfully.
+static int start_listening(int fd, bool bound) {
+  if (fd >= 0 && bound && listen(fd, 1) == 0)
+    return fd;
+  perror("Error: Failed to listen for gdb");
+  if (fd >= 0)
+    close(fd);
+  return -1;
+}
+
+static int listen_tcp(const char *port_text) {
+  unsigned long port = strtoul(port_text, NULL, 10);
+  if (port == 0 || port > 65535) {
+    fprintf(stderr, "Error: Invalid gdb port: %s\n", port_text);
+    return -1;
+  }
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons((uint16_t)port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  return start_listening(
+      fd, fd >= 0 &&
+              setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse,
+                         sizeof(reuse)) == 0 &&
+              bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+}
+
+static int listen_unix(const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Error: gdb socket path is too long\n");
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+  unlink(path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  return start_listening(
+      fd, fd >= 0 && bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+}
+
+bool gdb_serve(RvContext_t *context, const char *address) {
+  bool is_unix = *address == '\0' ||
+                 strspn(address, "0123456789") != strlen(address);
+  int listener = is_unix ? listen_unix(address) : listen_tcp(address);
+  if (listener < 0)
+    return false;
+
+  fprintf(stderr, "Waiting for gdb on %s%s\n", is_unix ? "" : "127.0.0.1:",
+          address);
+  int fd;
+  do {
+    fd = accept(listener, NULL, NULL);
+  } while (fd < 0 && errno == EINTR);
+  close(listener);
+  if (is_unix)
+    unlink(address);
+  if (fd < 0) {
+    perror("Error: Failed to accept gdb");
+    return false;
+  }
+
+  if (!is_unix) {
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+  }
+  bool ok = gdb_serve_fd(context, fd);
+  close(fd);
+  return ok;
+}
@@ -0,0 +1,155 @@
+#include "hypercall.h"
+
+#include "instructions/instructions.h"
+#include "opcodes.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool init_hypercalls(Hypercalls_t *hypercalls) {
+  hypercalls->entries =
+      (HypercallEntry_t *)calloc(HYPERCALL_COUNT, sizeof(HypercallEntry_t));
+  if (!hypercalls->entries) {
+    perror("Error: Failed to allocate hypercall table");
+    return false;
+  }
+  return true;
+}
+
+void free_hypercalls(Hypercalls_t *hypercalls) {
+  free(hypercalls->entries);
+  hypercalls->entries = NULL;
+}
+
+bool hypercall_register(Hypercalls_t *hypercalls, uint32_t number,
+                        const char *name, HypercallKernel kernel, void *arg) {
+  if (number >= HYPERCALL_COUNT || hypercalls->entries[number].kernel)
+    return false;
+  hypercalls->entries[number] =
+      (HypercallEntry_t){.kernel = kernel, .arg = arg, .name = name};
+  return true;
+}
+
+uint8_t *hypercall_buffer(RvContext_t *context, uint32_t addr, size_t size,
+                          uint8_t prot) {
+  static uint8_t empty;
+  if (size == 0)
+    return &empty;
+
+  Memory_t *memory = context->memory;
+  uint8_t *host = memory_access(memory, addr, size, prot);
+  if (host && (prot & MEMORY_PROT_WRITE))
+    memory_mark_written(memory, addr, size);
+  return host;
+}
+
+static bool kernel_hash(RvContext_t *context, uint32_t *args, void *arg) {
+  (void)arg;
+  const uint8_t *data =
+      hypercall_buffer(context, args[0], args[1], MEMORY_PROT_READ);
+  if (!data)
+    return false;
+  uint64_t hash = hash_bytes(HASH_SEED, data, args[1]);
+  args[0] = (uint32_t)hash;
+  args[1] = (uint32_t)(hash >> 32);
+  return true;
+}
+
+// The byte size of a rows x columns int32 matrix, or false when it does
+// not fit in the guest address space.
+static bool matrix_size(uint32_t rows, uint32_t columns, size_t *size) {
+  uint64_t bytes = (uint64_t)rows * columns * sizeof(uint32_t);
+  if (bytes > UINT32_MAX) {
+    fprintf(stderr, "Error: Hypercall matrix of %ux%u is too large\n", rows,
+            columns);
+    return false;
+  }
+  *size = (size_t)bytes;
+  return true;
+}
+
+static bool ranges_overlap(uint32_t a, size_t a_size, uint32_t b,
+                           size_t b_size) {
+  return a_size > 0 && b_size > 0 && a < (uint64_t)b + b_size &&
+         b < (uint64_t)a + a_size;
+}
+
+static bool kernel_matmul(RvContext_t *context, uint32_t *args, void *arg) {
+  (void)arg;
+  uint32_t rows = args[3];
+  uint32_t inner = args[4];
+  uint32_t columns = args[5];
+  size_t c_size;
+  size_t a_size;
+  size_t b_size;
+  if (!matrix_size(rows, columns, &c_size) ||
+      !matrix_size(rows, inner, &a_size) ||
+      !matrix_size(inner, columns, &b_size))
+    return false;
+  if (ranges_overlap(args[0], c_size, args[1], a_size) ||
+      ranges_overlap(args[0], c_size, args[2], b_size)) {
+    fprintf(stderr, "Error: Hypercall matmul output overlaps an input\n");
+    return false;
+  }
+
+  const uint8_t *a = hypercall_buffer(context, args[1], a_size,
+                                      MEMORY_PROT_READ);
+  const uint8_t *b = hypercall_buffer(context, args[2], b_size,
+                                      MEMORY_PROT_READ);
+  uint8_t *c = a && b ? hypercall_buffer(context, args[0], c_size,
+                                         MEMORY_PROT_WRITE)
+                      : NULL;
+  if (!c)
+    return false;
+
+  for (uint32_t i = 0; i < rows; i++) {
+    for (uint32_t j = 0; j < columns; j++) {
+      uint32_t sum = 0;
+      for (uint32_t k = 0; k < inner; k++) {
+        uint32_t x;
+        uint32_t y;
+        memcpy(&x, a + ((size_t)i * inner + k) * sizeof(x), sizeof(x));
+        memcpy(&y, b + ((size_t)k * columns + j) * sizeof(y), sizeof(y));
+        sum += x * y;
+      }
+      memcpy(c + ((size_t)i * columns + j) * sizeof(sum), &sum, sizeof(sum));
+    }
+  }
+  return true;
+}
+
+bool hypercall_register_builtins(Hypercalls_t *hypercalls) {
+  return hypercall_register(hypercalls, HYPERCALL_HASH, "hash", kernel_hash,
+                            NULL) &&
+         hypercall_register(hypercalls, HYPERCALL_MATMUL, "matmul",
+                            kernel_matmul, NULL);
+}
+
+uint32_t hypercall_number(uint32_t inst) {
+  uint32_t number = (uint32_t)get_funct3(inst) << 7 | get_funct7(inst);
+  if (get_opcode(inst) == OPCODE_CUSTOM_1)
+    number += HYPERCALL_CUSTOM_1_BASE;
+  return number;
+}
+
+void handle_hypercall(uint32_t inst, RvContext_t *context) {
+  const Hypercalls_t *hypercalls = context->hypercalls;
+  uint32_t number = hypercall_number(inst);
+  const HypercallEntry_t *entry =
+      hypercalls ? &hypercalls->entries[number] : NULL;
+  if (!entry || !entry->kernel) {
+    handle_illegal_instruction(inst, context);
+    return;
+  }
+
+  CPU_t *cpu = context->cpu;
+  if (!entry->kernel(context, &cpu->regs[10], entry->arg)) {
+    fprintf(stderr, "Error: Hypercall %s failed at PC: 0x%08x\n",
+            entry->name, cpu->pc);
+    cpu->exit_code = 1;
+    cpu->halt = true;
+    cpu->faulted = true;
+  }
+}
@@ -1,6 +1,10 @@
 #include "instructions/instructions.h"
 
+#include "coverage.h"
+#include "intercept.h"
 #include "syscall.h"
+#include "syscall_log.h"
+#include "timing.h"
 #include "utils.h"
 
 #include <stdint.h>
@@ -9,6 +13,27 @@
 static void stop_on_memory_error(CPU_t *cpu) {
   cpu->exit_code = 1;
   cpu->halt = true;
+  cpu->faulted = true;
+}
+
+typedef enum {
+  TRANSFER_BRANCH,   // Conditional, to a pc-relative target.
+  TRANSFER_JUMP,     // Unconditional, to a pc-relative target.
+  TRANSFER_INDIRECT, // Unconditional, to a register target.
+} TransferKind;
+
+// Control transfers feed the coverage map and the timing model. The block
+// engines record the block they enter in the coverage map instead, so they
+// skip that part.
+static inline void transfer(RvContext_t *context, TransferKind kind) {
+  CPU_t *cpu = context->cpu;
+  Coverage_t *coverage = context->coverage;
+  if (coverage && !coverage->block_edges)
+    coverage_edge(coverage, cpu->next_pc);
+  if (context->timing)
+    timing_branch(context->timing, cpu->pc, kind == TRANSFER_BRANCH,
+                  cpu->next_pc != cpu->pc + cpu->current_inst_len,
+                  kind == TRANSFER_INDIRECT);
 }
 
 void handle_lui(uint32_t inst, RvContext_t *context) {
@@ -25,6 +50,9 @@ void handle_jal(uint32_t inst, RvContext_t *context) {
   CPU_t *cpu = context->cpu;
   write_reg(cpu, get_rd(inst), cpu->pc + cpu->current_inst_len);
   cpu->next_pc = cpu->pc + get_imm_j(inst);
+  if (context->intercepts && intercept_call(context, cpu->next_pc))
+    cpu->next_pc = cpu->regs[1];
+  transfer(context, TRANSFER_JUMP);
 }
 
 void handle_jalr(uint32_t inst, RvContext_t *context) {
@@ -35,18 +63,23 @@ void handle_jalr(uint32_t inst, RvContext_t *context) {
 
   cpu->next_pc = (rs1_val + imm) & ~1;
   write_reg(cpu, get_rd(inst), next_pc);
+  if (context->intercepts && intercept_call(context, cpu->next_pc))
+    cpu->next_pc = cpu->regs[1];
+  transfer(context, TRANSFER_INDIRECT);
 }
 
 void handle_beq(uint32_t inst, RvContext_t *context) {
   CPU_t *cpu = context->cpu;
   if (read_reg(cpu, get_rs1(inst)) == read_reg(cpu, get_rs2(inst)))
     cpu->next_pc = cpu->pc + get_imm_b(inst);
+  transfer(context, TRANSFER_BRANCH);
 }
 
 void handle_bne(uint32_t inst, RvContext_t *context) {
   CPU_t *cpu = context->cpu;
   if (read_reg(cpu, get_rs1(inst)) != read_reg(cpu, get_rs2(inst)))
     cpu->next_pc = cpu->pc + get_imm_b(inst);
+  transfer(context, TRANSFER_BRANCH);
 }
 
 void handle_blt(uint32_t inst, RvContext_t *context) {
@@ -55,6 +88,7 @@ void handle_blt(uint32_t inst, RvContext_t *context) {
   int32_t rs2_val = (int32_t)read_reg(cpu, get_rs2(inst));
   if (rs1_val < rs2_val)
     cpu->next_pc = cpu->pc + get_imm_b(inst);
+  transfer(context, TRANSFER_BRANCH);
 }
 
 void handle_bge(uint32_t inst, RvContext_t *context) {
@@ -63,18 +97,21 @@ void handle_bge(uint32_t inst, RvContext_t *context) {
   int32_t rs2_val = (int32_t)read_reg(cpu, get_rs2(inst));
   if (rs1_val >= rs2_val)
     cpu->next_pc = cpu->pc + get_imm_b(inst);
+  transfer(context, TRANSFER_BRANCH);
 }
 
 void handle_bltu(uint32_t inst, RvContext_t *context) {
   CPU_t *cpu = context->cpu;
   if (read_reg(cpu, get_rs1(inst)) < read_reg(cpu, get_rs2(inst)))
     cpu->next_pc = cpu->pc + get_imm_b(inst);
+  transfer(context, TRANSFER_BRANCH);
 }
 
 void handle_bgeu(uint32_t inst, RvContext_t *context) {
   CPU_t *cpu = context->cpu;
   if (read_reg(cpu, get_rs1(inst)) >= read_reg(cpu, get_rs2(inst)))
     cpu->next_pc = cpu->pc + get_imm_b(inst);
+  transfer(context, TRANSFER_BRANCH);
 }
 
 void handle_lb(uint32_t inst, RvContext_t *context) {
@@ -283,30 +320,90 @@ void handle_fence(uint32_t inst, RvContext_t *context) {
   (void)context;
 }
 
+// Stores already invalidate cached code precisely; FENCE.I only ends the
+// current block so the following instructions are fetched again.
+void handle_fence_i(uint32_t inst, RvContext_t *context) {
+  (void)inst;
+  (void)context;
+}
+
 void handle_ecall(uint32_t inst, RvContext_t *context) {
   (void)inst;
   CPU_t *cpu = context->cpu;
   Memory_t *memory = context->memory;
+  SyscallState_t *syscalls = context->syscalls;
+  SyscallLog_t *log = syscalls ? syscalls->log : NULL;
+  uint32_t number = read_reg(cpu, 17);
+
+  if (syscall_log_replaces(log, number)) {
+    syscall_log_finish(log, cpu, memory, number, false);
+    return;
+  }
 
-  switch (read_reg(cpu, 17)) {
-  case 63:
-    handle_sys_read(cpu, memory);
+  switch (number) {
+  case SYSCALL_OPENAT:
+    handle_sys_openat(cpu, memory, syscalls);
+    break;
+  case SYSCALL_CLOSE:
+    handle_sys_close(cpu, syscalls);
+    break;
+  case SYSCALL_LSEEK:
+    handle_sys_lseek(cpu, syscalls);
+    break;
+  case SYSCALL_READ:
+    handle_sys_read(cpu, memory, syscalls);
     break;
-  case 64:
-    handle_sys_write(cpu, memory);
+  case SYSCALL_WRITE:
+    handle_sys_write(cpu, memory, syscalls);
     break;
-  case 93:
-    handle_sys_exit(cpu);
+  case SYSCALL_READV:
+    handle_sys_readv(cpu, memory, syscalls);
     break;
-  case 214:
+  case SYSCALL_WRITEV:
+    handle_sys_writev(cpu, memory, syscalls);
+    break;
+  case SYSCALL_FSTAT:
+    handle_sys_fstat(cpu, memory, syscalls);
+    break;
+  case SYSCALL_FSYNC:
+    handle_sys_fsync(cpu, syscalls, false);
+    break;
+  case SYSCALL_FDATASYNC:
+    handle_sys_fsync(cpu, syscalls, true);
+    break;
+  case SYSCALL_EXIT:
+    handle_sys_exit(cpu, syscalls);
+    break;
+  case SYSCALL_CLOCK_GETTIME:
+    handle_sys_clock_gettime(cpu, memory, syscalls, false);
+    break;
+  case SYSCALL_BRK:
     handle_sys_brk(cpu, memory);
     break;
+  case SYSCALL_MUNMAP:
+    handle_sys_munmap(cpu, memory);
+    break;
+  case SYSCALL_MMAP:
+    handle_sys_mmap(cpu, memory, syscalls);
+    break;
+  case SYSCALL_MPROTECT:
+    handle_sys_mprotect(cpu, memory);
+    break;
+  case SYSCALL_GETRANDOM:
+    handle_sys_getrandom(cpu, memory, syscalls);
+    break;
+  case SYSCALL_CLOCK_GETTIME64:
+    handle_sys_clock_gettime(cpu, memory, syscalls, true);
+    break;
   default:
-    fprintf(stderr, "Error: Unknown syscall: %u\n", read_reg(cpu, 17));
+    fprintf(stderr, "Error: Unknown syscall: %u\n", number);
     cpu->exit_code = 1;
     cpu->halt = true;
-    break;
+    return;
   }
+
+  if (log)
+    syscall_log_finish(log, cpu, memory, number, true);
 }
 
 void handle_ebreak(uint32_t inst, RvContext_t *context) {
@@ -322,4 +419,5 @@ void handle_illegal_instruction(uint32_t inst, RvContext_t *context) {
           cpu->pc, inst);
   cpu->exit_code = 1;
   cpu->halt = true;
+  cpu->faulted = true;
 }
@@ -0,0 +1,187 @@
+#include "intercept.h"
+
+#include "loader.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char *const routine_names[INTERCEPT_ROUTINES] = {
+    "memcpy", "memset", "memmove", "strlen", "strcmp", "memcmp",
+};
+
+static int find_routine(const char *name, size_t length) {
+  for (int i = 0; i < INTERCEPT_ROUTINES; i++) {
+    if (strlen(routine_names[i]) == length &&
+        strncmp(name, routine_names[i], length) == 0)
+      return i;
+  }
+  return -1;
+}
+
+bool intercept_parse(const char *list, uint32_t *allowed) {
+  uint32_t mask = 0;
+  const char *p = list;
+  for (;;) {
+    const char *comma = strchr(p, ',');
+    size_t length = comma ? (size_t)(comma - p) : strlen(p);
+    if (length == 0) {
+      fprintf(stderr, "Error: Empty name in intercepted routine list: '%s'\n",
+              list);
+      return false;
+    }
+    int routine = find_routine(p, length);
+    if (routine < 0) {
+      fprintf(stderr, "Error: Unknown intercepted routine: %.*s\n",
+              (int)length, p);
+      return false;
+    }
+    mask |= 1u << routine;
+    if (!comma)
+      break;
+    p = comma + 1;
+  }
+  *allowed = mask;
+  return true;
+}
+
+void init_intercepts(Intercepts_t *intercepts, uint32_t allowed) {
+  memset(intercepts, 0, sizeof(*intercepts));
+  intercepts->allowed = allowed;
+  intercepts->low_pc = UINT32_MAX;
+}
+
+bool intercept_add(Intercepts_t *intercepts, uint32_t pc,
+                   InterceptRoutine routine) {
+  if (intercepts->count == INTERCEPT_MAX_ENTRIES)
+    return false;
+  intercepts->pcs[intercepts->count] = pc;
+  intercepts->routines[intercepts->count] = (uint8_t)routine;
+  intercepts->count++;
+  if (pc < intercepts->low_pc)
+    intercepts->low_pc = pc;
+  if (pc > intercepts->high_pc)
+    intercepts->high_pc = pc;
+  return true;
+}
+
+static void visit_function(void *arg, const char *name, uint32_t addr) {
+  Intercepts_t *intercepts = (Intercepts_t *)arg;
+  int routine = find_routine(name, strlen(name));
+  if (routine >= 0 && (intercepts->allowed & (1u << routine)))
+    intercept_add(intercepts, addr, (InterceptRoutine)routine);
+}
+
+size_t intercept_load_symbols(Intercepts_t *intercepts, const char *path) {
+  elf_visit_functions(path, visit_function, intercepts);
+  return intercepts->count;
+}
+
+// The bytes from `addr` to the end of guest memory, or 0.
+static size_t span_from(Memory_t *memory, uint32_t addr, uint8_t **host) {
+  if (!memory_get_pointer(memory, addr, 1, host))
+    return 0;
+  return memory->size - (addr - memory->base);
+}
+
+// Returns the length of the string at `addr`, or false when it does not
+// end inside readable guest memory.
+static bool guest_strlen(Memory_t *memory, uint32_t addr, uint8_t **host,
+                         size_t *length) {
+  size_t span = span_from(memory, addr, host);
+  const uint8_t *end = span ? (const uint8_t *)memchr(*host, 0, span) : NULL;
+  if (!end)
+    return false;
+  *length = (size_t)(end - *host);
+  return memory_allows(memory, addr, *length + 1, MEMORY_PROT_READ);
+}
+
+static bool guest_range(Memory_t *memory, uint32_t addr, size_t size,
+                        uint8_t prot, uint8_t **host) {
+  return memory_allows(memory, addr, size, prot) &&
+         memory_get_pointer(memory, addr, size, host);
+}
+
+// Callers of strcmp and memcmp may only rely on the sign of the result.
+static uint32_t compare_bytes(const uint8_t *a, const uint8_t *b,
+                              size_t size) {
+  int order = memcmp(a, b, size);
+  return order < 0 ? UINT32_MAX : order > 0;
+}
+
+// Runs `routine` on the guest's argument registers and sets `result`.
+static bool run_routine(Memory_t *memory, const uint32_t *regs,
+                        InterceptRoutine routine, uint32_t *result) {
+  uint32_t a0 = regs[10];
+  uint32_t a1 = regs[11];
+  uint32_t a2 = regs[12];
+  uint8_t *dst;
+  uint8_t *src;
+  size_t length;
+  size_t other;
+
+  switch (routine) {
+  case INTERCEPT_MEMCPY:
+  case INTERCEPT_MEMMOVE:
+    *result = a0;
+    if (a2 == 0)
+      return true;
+    if (!guest_range(memory, a1, a2, MEMORY_PROT_READ, &src) ||
+        !guest_range(memory, a0, a2, MEMORY_PROT_WRITE, &dst))
+      return false;
+    // Overlapping memcpy is undefined, so memmove serves both.
+    memmove(dst, src, a2);
+    memory_mark_written(memory, a0, a2);
+    return true;
+  case INTERCEPT_MEMSET:
+    *result = a0;
+    if (a2 == 0)
+      return true;
+    if (!guest_range(memory, a0, a2, MEMORY_PROT_WRITE, &dst))
+      return false;
+    memset(dst, (int)(a1 & 0xff), a2);
+    memory_mark_written(memory, a0, a2);
+    return true;
+  case INTERCEPT_STRLEN:
+    if (!guest_strlen(memory, a0, &src, &length))
+      return false;
+    *result = (uint32_t)length;
+    return true;
+  case INTERCEPT_STRCMP:
+    if (!guest_strlen(memory, a0, &dst, &length) ||
+        !guest_strlen(memory, a1, &src, &other))
+      return false;
+    *result = compare_bytes(dst, src, (length < other ? length : other) + 1);
+    return true;
+  case INTERCEPT_MEMCMP:
+    *result = 0;
+    if (a2 == 0)
+      return true;
+    if (!guest_range(memory, a0, a2, MEMORY_PROT_READ, &dst) ||
+        !guest_range(memory, a1, a2, MEMORY_PROT_READ, &src))
+      return false;
+    *result = compare_bytes(dst, src, a2);
+    return true;
+  case INTERCEPT_ROUTINES:
+    break;
+  }
+  return false;
+}
+
+bool intercept_call(RvContext_t *context, uint32_t target) {
+  Intercepts_t *intercepts = context->intercepts;
+  if (target < intercepts->low_pc || target > intercepts->high_pc)
+    return false;
+
+  for (size_t i = 0; i < intercepts->count; i++) {
+    if (intercepts->pcs[i] != target)
+      continue;
+    InterceptRoutine routine = (InterceptRoutine)intercepts->routines[i];
+    uint32_t result;
+    if (!run_routine(context->memory, context->cpu->regs, routine, &result))
+      return false;
+    write_reg(context->cpu, 10, result);
+    intercepts->calls[routine]++;
+    return true;
+  }
+  return false;
+}
@@ -1,12 +1,33 @@
 #include "loader.h"
 
+#include "isa.h"
+#include "utils.h"
+
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-void load_elf(CPU_t *cpu, Memory_t *memory, const char *filename) {
+static uint8_t segment_prot(const Elf32_Phdr_t *ph) {
+  uint8_t prot = 0;
+  if (ph->p_flags & PF_R)
+    prot |= MEMORY_PROT_READ;
+  if (ph->p_flags & PF_W)
+    prot |= MEMORY_PROT_WRITE;
+  if (ph->p_flags & PF_X)
+    prot |= MEMORY_PROT_EXEC;
+  return prot;
+}
+
+void load_elf(CPU_t *cpu, Memory_t *memory, const char *filename,
+              ElfInfo_t *info) {
+  ElfInfo_t local_info;
+  if (!info)
+    info = &local_info;
+  memset(info, 0, sizeof(*info));
+  info->exec_hash = HASH_SEED;
+
   FILE *fp = fopen(filename, "rb");
   if (!fp) {
     perror("Error: Failed to open program file");
@@ -63,6 +84,15 @@ void load_elf(CPU_t *cpu, Memory_t *memory, const char *filename) {
     return;
   }
 
+  if (!RV_ISA_HAS_C && (elf_header.e_flags & EF_RISCV_RVC)) {
+    fprintf(stderr, "Error: Program uses compressed instructions, which this "
+                    "build does not support\n");
+    fclose(fp);
+    cpu->exit_code = 1;
+    cpu->halt = true;
+    return;
+  }
+
   if (elf_header.e_version != 1) {
     fprintf(stderr, "Error: Invalid ELF version (e_version=%d)\n",
             elf_header.e_version);
@@ -225,6 +255,14 @@ void load_elf(CPU_t *cpu, Memory_t *memory, const char *filename) {
 
   memory->base = min_vaddr;
   memory->program_break = max_vaddr;
+  // The stack and heap get read and write access; segments get what their
+  // p_flags ask for, merged where two segments share a page.
+  memory_set_default_prot(memory, MEMORY_PROT_READ | MEMORY_PROT_WRITE);
+  for (int i = 0; i < elf_header.e_phnum; i++) {
+    Elf32_Phdr_t *ph = &program_headers[i];
+    if (ph->p_type == PT_LOAD)
+      memory_revoke(memory, ph->p_vaddr, ph->p_memsz, MEMORY_PROT_MASK);
+  }
   // Update Stack Pointer (x2) to be at the top of the new memory range
   cpu->regs[2] = memory->base + (uint32_t)memory->size;
 
@@ -284,6 +322,17 @@ void load_elf(CPU_t *cpu, Memory_t *memory, const char *filename) {
         size_t bss_size = ph->p_memsz - ph->p_filesz;
         memset(dest + ph->p_filesz, 0, bss_size);
       }
+
+      memory_grant(memory, ph->p_vaddr, ph->p_memsz, segment_prot(ph));
+
+      if ((ph->p_flags & PF_X) && ph->p_memsz > 0) {
+        info->exec_segment_count++;
+        info->exec_hash =
+            hash_bytes(info->exec_hash, &ph->p_vaddr, sizeof(ph->p_vaddr));
+        info->exec_hash =
+            hash_bytes(info->exec_hash, &ph->p_memsz, sizeof(ph->p_memsz));
+        info->exec_hash = hash_bytes(info->exec_hash, dest, ph->p_memsz);
+      }
     }
   }
 
@@ -292,3 +341,71 @@ void load_elf(CPU_t *cpu, Memory_t *memory, const char *filename) {
 
   cpu->pc = elf_header.e_entry;
 }
+
+// Reads `size` bytes at `offset` into a new buffer with a NUL after them,
+// or returns NULL.
+static char *read_range(FILE *fp, uint64_t file_size, uint32_t offset,
+                        uint32_t size) {
+  if ((uint64_t)offset > file_size || (uint64_t)size > file_size - offset ||
+      fseek(fp, (long)offset, SEEK_SET) != 0)
+    return NULL;
+  char *data = (char *)malloc((size_t)size + 1);
+  if (!data)
+    return NULL;
+  if (fread(data, 1, size, fp) != size) {
+    free(data);
+    return NULL;
+  }
+  data[size] = '\0';
+  return data;
+}
+
+bool elf_visit_functions(const char *filename, ElfFunctionVisitor visit,
+                         void *arg) {
+  FILE *fp = fopen(filename, "rb");
+  if (!fp)
+    return false;
+
+  Elf32_Ehdr_t header;
+  long end = -1;
+  bool ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+            header.e_ident[EI_CLASS] == ELFCLASS32 &&
+            header.e_shentsize == sizeof(Elf32_Shdr_t) &&
+            fseek(fp, 0, SEEK_END) == 0 && (end = ftell(fp)) >= 0;
+  uint64_t file_size = (uint64_t)end;
+
+  Elf32_Shdr_t *sections =
+      ok ? (Elf32_Shdr_t *)read_range(fp, file_size, header.e_shoff,
+                                      header.e_shnum * sizeof(Elf32_Shdr_t))
+         : NULL;
+  const Elf32_Shdr_t *symtab = NULL;
+  for (uint16_t i = 0; sections && i < header.e_shnum && !symtab; i++) {
+    if (sections[i].sh_type == SHT_SYMTAB &&
+        sections[i].sh_entsize == sizeof(Elf32_Sym_t) &&
+        sections[i].sh_link < header.e_shnum)
+      symtab = &sections[i];
+  }
+
+  Elf32_Sym_t *symbols = NULL;
+  char *names = NULL;
+  if (symtab) {
+    const Elf32_Shdr_t *strtab = &sections[symtab->sh_link];
+    symbols = (Elf32_Sym_t *)read_range(fp, file_size, symtab->sh_offset,
+                                        symtab->sh_size);
+    names = read_range(fp, file_size, strtab->sh_offset, strtab->sh_size);
+    size_t count = symtab->sh_size / sizeof(Elf32_Sym_t);
+    for (size_t i = 0; symbols && names && i < count; i++) {
+      const Elf32_Sym_t *symbol = &symbols[i];
+      if (ELF32_ST_TYPE(symbol->st_info) == STT_FUNC &&
+          symbol->st_shndx != SHN_UNDEF && symbol->st_name < strtab->sh_size)
+        visit(arg, &names[symbol->st_name], symbol->st_value);
+    }
+  }
+  ok = symbols && names;
+
+  free(names);
+  free(symbols);
+  free(sections);
+  fclose(fp);
+  return ok;
+}
@@ -1,17 +1,510 @@
+#include "async_io.h"
+#include "bbv.h"
+#include "block_cache.h"
+#include "cache_sim.h"
+#include "checkpoint.h"
+#include "coverage.h"
 #include "cpu.h"
 #include "emulator.h"
+#include "gdb_stub.h"
+#include "hypercall.h"
+#include "intercept.h"
 #include "loader.h"
 #include "memory.h"
+#include "syscall.h"
+#include "syscall_log.h"
+#include "timing.h"
 
+#include <errno.h>
+#include <getopt.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#ifdef RV_AOT
+#include "aot.h"
+
+// Emitted by tools/rv_aot.c into the C file linked with this runner.
+extern const AotProgram_t rv_aot_program;
+#endif
+
+// Pcs and data regions listed in the cache simulation report.
+#define CACHE_SIM_REPORT_ROWS 20
+
+// Checkpoint positions accepted by --checkpoint-at.
+#define MAX_CHECKPOINTS 256
+
+// Exit statuses for runs stopped by a limit rather than by the guest.
+#define EXIT_INSTRUCTION_LIMIT 124
+#define EXIT_DEADLINE 125
+
+typedef struct Options {
+  bool use_blocks;
+  SyscallIoMode io_mode;
+  bool allow_io_uring;
+  const char *cache_dir;
+  uint32_t hot_threshold;
+  uint64_t max_instructions;
+  uint64_t deadline_ms;
+  const char *syscall_log;
+  SyscallLogMode syscall_log_mode;
+  const char *gdb_address;
+  MemoryBacking memory_backing;
+  bool memory_backing_requested;
+  uint64_t repeat;
+  const char *coverage_path;
+  bool cache_sim;
+  CacheConfig_t cache_configs[CACHE_LEVELS];
+  bool timing;
+  TimingConfig_t timing_config;
+  const char *bbv_path;
+  uint64_t bbv_interval;
+  uint64_t checkpoints[MAX_CHECKPOINTS]; // Ascending, without repeats.
+  size_t checkpoint_count;
+  const char *checkpoint_dir;
+  const char *restore_path;
+  uint32_t intercepted; // InterceptRoutine bits; 0 leaves every call alone.
+  const char *program;
+} Options_t;
+
+static void print_usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s [options] <program.elf>\n"
+          "\n"
+          "Options:\n"
+          "  --engine=block|interp  execute predecoded blocks (default) or\n"
+          "                         single-step the interpreter\n"
+          "  --io=strict|buffered|async|async-threads\n"
+          "                         issue every guest write immediately\n"
+          "                         (default), coalesce output per fd, or\n"
+          "                         offload writes to io_uring (falling back\n"
+          "                         to worker threads) or to worker threads\n"
+          "  --cache-dir=DIR        reuse predecoded blocks saved in DIR by\n"
+          "                         earlier runs of the same program\n"
+          "  --hot-threshold=N      optimize a block after N executions\n"
+          "                         (default %d, 0 never optimizes)\n"
+          "  --max-instructions=N   stop after N guest instructions and exit\n"
+          "                         with status %d\n"
+          "  --deadline=MS          stop after MS milliseconds of wall-clock\n"
+          "                         time and exit with status %d\n"
+          "  --record=FILE          log every syscall's effect on the guest\n"
+          "                         to FILE\n"
+          "  --replay=FILE          answer syscalls from a log made by\n"
+          "                         --record, without host I/O\n"
+          "  --gdb=PORT|PATH        wait for gdb on 127.0.0.1:PORT or on the\n"
+          "                         Unix socket PATH and run under it\n"
+          "  --pages=small|thp|hugetlb\n"
+          "                         back guest memory with base pages,\n"
+          "                         transparent huge pages (default) or\n"
+          "                         explicit huge pages, falling back in\n"
+          "                         that order\n"
+          "  --repeat=N             run the program N times in one process,\n"
+          "                         restoring only the memory each run\n"
+          "                         changed and rewinding a seekable stdin;\n"
+          "                         stops at the first failing run\n"
+          "  --coverage=FILE        record AFL-style edge coverage and write\n"
+          "                         the map to FILE; under afl-fuzz (%s\n"
+          "                         set) the map is afl's and guests are\n"
+          "                         forked from a fork server after loading\n"
+          "  --cache-sim[=SPEC]     simulate L1I, L1D and L2 caches on the\n"
+          "                         interpreter and report misses per level,\n"
+          "                         pc and data page; SPEC overrides levels\n"
+          "                         as l1i=16k:2:32,l1d=16k:4:32,l2=128k:8:64\n"
+          "                         (size:ways:line bytes, the defaults)\n"
+          "  --timing[=SPEC]        estimate cycles and IPC on an in-order\n"
+          "                         pipeline model, run on the interpreter;\n"
+          "                         SPEC overrides predictor=gshare|bimodal|\n"
+          "                         not-taken, entries=1024, history=10,\n"
+          "                         mul=3, div=34, load-use=1, taken=1 and\n"
+          "                         mispredict=3 (the defaults, in cycles)\n"
+          "  --bbv=FILE             write SimPoint basic-block vectors to\n"
+          "                         FILE, one line per interval\n"
+          "  --interval=N           instructions per interval (default\n"
+          "                         %llu)\n"
+          "  --checkpoint-at=N[,N...]\n"
+          "                         fast-forward to each instruction count,\n"
+          "                         such as a SimPoint interval times the\n"
+          "                         interval length, save a checkpoint\n"
+          "                         there and stop after the last one\n"
+          "  --checkpoint-dir=DIR   write checkpoints to DIR/<count>.ckpt\n"
+          "                         (default .)\n"
+          "  --restore=FILE         start from a checkpoint of the program\n"
+          "                         instead of its entry point\n"
+          "  --intercept[=LIST]     run the guest's memcpy, memset, memmove,\n"
+          "                         strlen, strcmp and memcmp, or those in\n"
+          "                         the comma-separated LIST, on the host,\n"
+          "                         found through the ELF symbol table\n",
+          name, BLOCK_HOT_THRESHOLD, EXIT_INSTRUCTION_LIMIT, EXIT_DEADLINE,
+          COVERAGE_SHM_ENV, (unsigned long long)BBV_DEFAULT_INTERVAL);
+}
+
+// Parses a decimal option value no greater than `max`.
+static bool parse_count(const char *text, uint64_t max, uint64_t *value) {
+  char *end;
+  errno = 0;
+  unsigned long long parsed = strtoull(text, &end, 10);
+  if (errno != 0 || *text < '0' || *text > '9' || *end != '\0' ||
+      parsed > max)
+    return false;
+  *value = parsed;
+  return true;
+}
+
+static int compare_counts(const void *a, const void *b) {
+  uint64_t left = *(const uint64_t *)a;
+  uint64_t right = *(const uint64_t *)b;
+  return left < right ? -1 : left > right;
+}
+
+// Parses a comma-separated list of instruction counts, sorted and with
+// repeats dropped.
+static bool parse_checkpoints(char *text, Options_t *options) {
+  size_t count = 0;
+  for (char *item = strtok(text, ","); item; item = strtok(NULL, ",")) {
+    if (count == MAX_CHECKPOINTS ||
+        !parse_count(item, UINT64_MAX, &options->checkpoints[count]))
+      return false;
+    count++;
+  }
+  qsort(options->checkpoints, count, sizeof(uint64_t), compare_counts);
+
+  options->checkpoint_count = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (i == 0 || options->checkpoints[i] != options->checkpoints[i - 1])
+      options->checkpoints[options->checkpoint_count++] =
+          options->checkpoints[i];
+  }
+  return options->checkpoint_count > 0;
+}
+
+static bool parse_options(int argc, char *argv[], Options_t *options) {
+  static const struct option long_options[] = {
+      {"engine", required_argument, NULL, 'e'},
+      {"io", required_argument, NULL, 'i'},
+      {"cache-dir", required_argument, NULL, 'c'},
+      {"hot-threshold", required_argument, NULL, 't'},
+      {"max-instructions", required_argument, NULL, 'm'},
+      {"deadline", required_argument, NULL, 'd'},
+      {"record", required_argument, NULL, 'r'},
+      {"replay", required_argument, NULL, 'p'},
+      {"gdb", required_argument, NULL, 'g'},
+      {"pages", required_argument, NULL, 'b'},
+      {"repeat", required_argument, NULL, 'n'},
+      {"coverage", required_argument, NULL, 'v'},
+      {"cache-sim", optional_argument, NULL, 's'},
+      {"timing", optional_argument, NULL, 'T'},
+      {"bbv", required_argument, NULL, 'B'},
+      {"interval", required_argument, NULL, 'I'},
+      {"checkpoint-at", required_argument, NULL, 'K'},
+      {"checkpoint-dir", required_argument, NULL, 'D'},
+      {"restore", required_argument, NULL, 'R'},
+      {"intercept", optional_argument, NULL, 'x'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0},
+  };
+
+  options->use_blocks = true;
+  options->io_mode = SYSCALL_IO_STRICT;
+  options->allow_io_uring = true;
+  options->cache_dir = NULL;
+  options->hot_threshold = BLOCK_HOT_THRESHOLD;
+  options->max_instructions = 0;
+  options->deadline_ms = 0;
+  options->syscall_log = NULL;
+  options->syscall_log_mode = SYSCALL_LOG_RECORD;
+  options->gdb_address = NULL;
+  options->memory_backing = MEMORY_BACKING_THP;
+  options->memory_backing_requested = false;
+  options->repeat = 1;
+  options->coverage_path = NULL;
+  options->cache_sim = false;
+  cache_sim_default_config(options->cache_configs);
+  options->timing = false;
+  timing_default_config(&options->timing_config);
+  options->bbv_path = NULL;
+  options->bbv_interval = BBV_DEFAULT_INTERVAL;
+  options->checkpoint_count = 0;
+  options->checkpoint_dir = ".";
+  options->restore_path = NULL;
+  options->intercepted = 0;
+  options->program = NULL;
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'e':
+      if (strcmp(optarg, "block") == 0) {
+        options->use_blocks = true;
+      } else if (strcmp(optarg, "interp") == 0) {
+        options->use_blocks = false;
+      } else {
+        fprintf(stderr, "Error: Unknown engine: %s\n", optarg);
+        return false;
+      }
+      break;
+    case 'i':
+      if (strcmp(optarg, "strict") == 0) {
+        options->io_mode = SYSCALL_IO_STRICT;
+      } else if (strcmp(optarg, "buffered") == 0) {
+        options->io_mode = SYSCALL_IO_BUFFERED;
+      } else if (strcmp(optarg, "async") == 0) {
+        options->io_mode = SYSCALL_IO_ASYNC;
+      } else if (strcmp(optarg, "async-threads") == 0) {
+        options->io_mode = SYSCALL_IO_ASYNC;
+        options->allow_io_uring = false;
+      } else {
+        fprintf(stderr, "Error: Unknown I/O mode: %s\n", optarg);
+        return false;
+      }
+      break;
+    case 'c':
+      options->cache_dir = optarg;
+      break;
+    case 't': {
+      uint64_t threshold;
+      if (!parse_count(optarg, UINT32_MAX, &threshold)) {
+        fprintf(stderr, "Error: Invalid hot threshold: %s\n", optarg);
+        return false;
+      }
+      options->hot_threshold = (uint32_t)threshold;
+      break;
+    }
+    case 'm':
+      if (!parse_count(optarg, UINT64_MAX, &options->max_instructions) ||
+          options->max_instructions == 0) {
+        fprintf(stderr, "Error: Invalid instruction limit: %s\n", optarg);
+        return false;
+      }
+      break;
+    case 'd':
+      if (!parse_count(optarg, UINT32_MAX, &options->deadline_ms) ||
+          options->deadline_ms == 0) {
+        fprintf(stderr, "Error: Invalid deadline: %s\n", optarg);
+        return false;
+      }
+      break;
+    case 'r':
+    case 'p':
+      if (options->syscall_log) {
+        fprintf(stderr, "Error: Only one of --record and --replay is "
+                        "allowed\n");
+        return false;
+      }
+      options->syscall_log = optarg;
+      options->syscall_log_mode =
+          opt == 'r' ? SYSCALL_LOG_RECORD : SYSCALL_LOG_REPLAY;
+      break;
+    case 'g':
+      options->gdb_address = optarg;
+      break;
+    case 'b':
+      if (strcmp(optarg, "small") == 0) {
+        options->memory_backing = MEMORY_BACKING_SMALL;
+      } else if (strcmp(optarg, "thp") == 0) {
+        options->memory_backing = MEMORY_BACKING_THP;
+      } else if (strcmp(optarg, "hugetlb") == 0) {
+        options->memory_backing = MEMORY_BACKING_HUGETLB;
+      } else {
+        fprintf(stderr, "Error: Unknown page backing: %s\n", optarg);
+        return false;
+      }
+      options->memory_backing_requested = true;
+      break;
+    case 'v':
+      options->coverage_path = optarg;
+      break;
+    case 's':
+      options->cache_sim = true;
+      if (optarg && !cache_sim_parse(optarg, options->cache_configs))
+        return false;
+      break;
+    case 'T':
+      options->timing = true;
+      if (optarg && !timing_parse(optarg, &options->timing_config))
+        return false;
+      break;
+    case 'B':
+      options->bbv_path = optarg;
+      break;
+    case 'I':
+      if (!parse_count(optarg, UINT64_MAX, &options->bbv_interval) ||
+          options->bbv_interval == 0) {
+        fprintf(stderr, "Error: Invalid interval: %s\n", optarg);
+        return false;
+      }
+      break;
+    case 'K':
+      if (!parse_checkpoints(optarg, options)) {
+        fprintf(stderr, "Error: Invalid checkpoint list\n");
+        return false;
+      }
+      break;
+    case 'D':
+      options->checkpoint_dir = optarg;
+      break;
+    case 'R':
+      options->restore_path = optarg;
+      break;
+    case 'x':
+      options->intercepted = INTERCEPT_ALL;
+      if (optarg && !intercept_parse(optarg, &options->intercepted))
+        return false;
+      break;
+    case 'n':
+      if (!parse_count(optarg, UINT64_MAX, &options->repeat) ||
+          options->repeat == 0) {
+        fprintf(stderr, "Error: Invalid repeat count: %s\n", optarg);
+        return false;
+      }
+      break;
+    default:
+      return false;
+    }
+  }
+
+  if (optind != argc - 1)
+    return false;
+
+  if (options->repeat > 1 && (options->syscall_log || options->gdb_address)) {
+    fprintf(stderr, "Error: --repeat cannot be combined with --record, "
+                    "--replay or --gdb\n");
+    return false;
+  }
+  if (options->checkpoint_count > 0 &&
+      (options->repeat > 1 || options->gdb_address)) {
+    fprintf(stderr, "Error: --checkpoint-at cannot be combined with "
+                    "--repeat or --gdb\n");
+    return false;
+  }
+
+  // Vectors of single instructions would not match those of whole blocks.
+  if (options->bbv_path &&
+      (!options->use_blocks || options->cache_sim || options->timing)) {
+    fprintf(stderr, "Error: --bbv needs the block engine\n");
+    return false;
+  }
+
+  // Predecoded and translated blocks do not fetch their instructions again,
+  // so the cache and timing models need the interpreter.
+  if (options->cache_sim || options->timing)
+    options->use_blocks = false;
+
+  options->program = argv[optind];
+  return true;
+}
+
+// Block caches are named after the program's executable segments, so any
+// rebuild of the program starts a new file.
+static bool block_cache_path(const char *dir, uint64_t key, char *path,
+                             size_t size) {
+  if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+    perror("Error: Failed to create block cache directory");
+    return false;
+  }
+  int length =
+      snprintf(path, size, "%s/%016llx.blocks", dir, (unsigned long long)key);
+  if (length < 0 || (size_t)length >= size) {
+    fprintf(stderr, "Error: Block cache directory path is too long\n");
+    return false;
+  }
+  return true;
+}
+
+// Puts the guest back where load_elf left it, keeping predecoded blocks for
+// the pages the last run did not write. `stdin_offset` is negative when
+// stdin cannot be rewound.
+static void restart_guest(RvContext_t *context, const CPU_t *initial,
+                          off_t stdin_offset) {
+  SyscallState_t *syscalls = context->syscalls;
+  SyscallIoMode io_mode = syscalls->io_mode;
+  AsyncIo_t *async = syscalls->async;
+  free_syscall_state(syscalls);
+  init_syscall_state(syscalls);
+  syscalls->io_mode = io_mode;
+  syscalls->async = async;
+  if (stdin_offset >= 0)
+    lseek(STDIN_FILENO, stdin_offset, SEEK_SET);
+
+  *context->cpu = *initial;
+  memory_reset_to_baseline(context->memory);
+  context->instructions_retired = 0;
+}
+
+static void run_guest(RvContext_t *context) {
+#ifdef RV_AOT
+  // Models that watch every instruction need the interpreter.
+  if (context->memory->observer || context->timing ||
+      !rv_run_aot(context, &rv_aot_program))
+    rv_run(context);
+#else
+  rv_run(context);
+#endif
+}
+
+// Fast-forwards through the checkpoint positions on the usual engine,
+// saving the guest at each, and leaves it halted after the last. Positions
+// count from the program's entry point; a run restored from a checkpoint
+// starts at `origin`.
+static bool run_to_checkpoints(RvContext_t *context, const Options_t *options,
+                               uint64_t key, uint64_t origin) {
+  uint64_t limit = context->instruction_limit;
+  for (size_t i = 0; i < options->checkpoint_count; i++) {
+    uint64_t at = options->checkpoints[i];
+    if (at < origin) {
+      fprintf(stderr, "Warning: Checkpoint at %llu precedes the restored "
+                      "one at %llu\n",
+              (unsigned long long)at, (unsigned long long)origin);
+      continue;
+    }
+    if (limit != 0 && at - origin > limit) {
+      run_guest(context);
+      return true;
+    }
+
+    context->instruction_limit = at - origin;
+    if (context->instructions_retired < at - origin)
+      run_guest(context);
+    if (context->cpu->halt && context->stop_reason != RV_STOP_BUDGET) {
+      if (context->stop_reason == RV_STOP_HALTED)
+        fprintf(stderr, "Warning: Guest stopped after %llu instructions, "
+                        "before the checkpoint at %llu\n",
+                (unsigned long long)(origin + context->instructions_retired),
+                (unsigned long long)at);
+      context->instruction_limit = limit;
+      return true;
+    }
+    context->cpu->halt = false;
+    context->stop_reason = RV_STOP_HALTED;
+
+    char path[4096];
+    int length = snprintf(path, sizeof(path), "%s/%llu.ckpt",
+                          options->checkpoint_dir, (unsigned long long)at);
+    if (length < 0 || (size_t)length >= sizeof(path)) {
+      fprintf(stderr, "Error: Checkpoint directory path is too long\n");
+      return false;
+    }
+    if (mkdir(options->checkpoint_dir, 0777) != 0 && errno != EEXIST) {
+      perror("Error: Failed to create checkpoint directory");
+      return false;
+    }
+    if (!checkpoint_save(path, context->cpu, context->memory,
+                         context->syscalls, key, at))
+      return false;
+  }
+
+  context->instruction_limit = limit;
+  context->cpu->halt = true;
+  return true;
+}
+
 int main(int argc, char *argv[]) {
-  if (argc < 2) {
-    fprintf(stderr, "Usage: %s <program.elf>\n", argv[0]);
+  Options_t options;
+  if (!parse_options(argc, argv, &options)) {
+    print_usage(argv[0]);
     return EXIT_FAILURE;
   }
 
@@ -19,31 +512,230 @@ int main(int argc, char *argv[]) {
   init_cpu(&cpu);
 
   Memory_t memory;
-  if (!init_memory(&memory, MEMORY_SIZE_BYTES))
+  if (!init_memory_backed(&memory, MEMORY_SIZE_BYTES, options.memory_backing))
     return EXIT_FAILURE;
+  if (options.memory_backing_requested &&
+      memory.backing != options.memory_backing)
+    fprintf(stderr,
+            "Warning: %s pages are unavailable; guest memory uses %s pages\n",
+            memory_backing_name(options.memory_backing),
+            memory_backing_name(memory.backing));
+
+  SyscallState_t syscalls;
+  init_syscall_state(&syscalls);
+  syscalls.io_mode = options.io_mode;
 
-  RvContext_t context = {.cpu = &cpu, .memory = &memory};
+  RvContext_t context = {.cpu = &cpu,
+                         .memory = &memory,
+                         .blocks = NULL,
+                         .syscalls = &syscalls,
+                         .instruction_limit = options.max_instructions};
 
-  load_elf(&cpu, &memory, argv[1]);
+  ElfInfo_t elf_info;
+  load_elf(&cpu, &memory, options.program, &elf_info);
 
-  if (cpu.halt) {
+  uint64_t origin = 0;
+  if (cpu.halt ||
+      (options.restore_path &&
+       !checkpoint_restore(options.restore_path, &cpu, &memory,
+                           elf_info.exec_hash, &origin))) {
     free_memory(&memory);
     return EXIT_FAILURE;
   }
 
-  while (!cpu.halt) {
-    RvStepResult result = rv_step(&context);
+  Hypercalls_t hypercalls;
+  if (!init_hypercalls(&hypercalls) ||
+      !hypercall_register_builtins(&hypercalls)) {
+    free_memory(&memory);
+    return EXIT_FAILURE;
+  }
+  context.hypercalls = &hypercalls;
 
-    if (result.status != RV_STEP_EXECUTED) {
-      break;
+  Intercepts_t intercepts;
+  if (options.intercepted) {
+    init_intercepts(&intercepts, options.intercepted);
+    if (intercept_load_symbols(&intercepts, options.program) > 0)
+      context.intercepts = &intercepts;
+    else
+      fprintf(stderr, "Warning: No routine to intercept was found in the "
+                      "program's symbol table\n");
+  }
+
+  SyscallLog_t syscall_log;
+  if (options.syscall_log) {
+    if (!syscall_log_open(&syscall_log, options.syscall_log,
+                          options.syscall_log_mode, elf_info.exec_hash)) {
+      free_memory(&memory);
+      return EXIT_FAILURE;
+    }
+    syscalls.log = &syscall_log;
+  }
+
+  BlockCache_t blocks;
+  if (options.use_blocks) {
+    if (!init_block_cache(&blocks)) {
+      if (syscalls.log)
+        syscall_log_close(&syscall_log);
+      free_memory(&memory);
+      return EXIT_FAILURE;
+    }
+    blocks.hot_threshold = options.hot_threshold;
+    context.blocks = &blocks;
+  }
+
+  char cache_path[4096];
+  bool use_cache_file =
+      context.blocks && options.cache_dir &&
+      block_cache_path(options.cache_dir, elf_info.exec_hash, cache_path,
+                       sizeof(cache_path));
+  if (use_cache_file)
+    block_cache_load(&blocks, &memory, cache_path, elf_info.exec_hash);
+
+  if (options.repeat > 1 && !memory_capture_baseline(&memory)) {
+    cpu.exit_code = 1;
+    cpu.halt = true;
+  }
+
+  // Setup above runs once under afl-fuzz: each input gets a child forked
+  // from here. Worker threads and timers do not survive a fork, so they
+  // start after it.
+  Coverage_t coverage;
+  if (!cpu.halt && (options.coverage_path || getenv(COVERAGE_SHM_ENV))) {
+    if (init_coverage(&coverage)) {
+      context.coverage = &coverage;
+      if (coverage.shared)
+        coverage_fork_server();
+    } else {
+      cpu.exit_code = 1;
+      cpu.halt = true;
     }
   }
 
+  CacheSim_t cache_sim;
+  bool use_cache_sim = false;
+  if (!cpu.halt && options.cache_sim) {
+    if (init_cache_sim(&cache_sim, options.cache_configs, &cpu)) {
+      cache_sim_attach(&cache_sim, &memory);
+      use_cache_sim = true;
+    } else {
+      cpu.exit_code = 1;
+      cpu.halt = true;
+    }
+  }
+
+  Bbv_t bbv;
+  if (!cpu.halt && options.bbv_path) {
+    if (bbv_open(&bbv, options.bbv_path, options.bbv_interval)) {
+      context.bbv = &bbv;
+    } else {
+      cpu.exit_code = 1;
+      cpu.halt = true;
+    }
+  }
+
+  Timing_t timing;
+  if (!cpu.halt && options.timing) {
+    if (init_timing(&timing, &options.timing_config)) {
+      context.timing = &timing;
+    } else {
+      cpu.exit_code = 1;
+      cpu.halt = true;
+    }
+  }
+
+  AsyncIo_t async;
+  if (!cpu.halt && options.io_mode == SYSCALL_IO_ASYNC) {
+    if (init_async_io(&async, options.allow_io_uring)) {
+      syscalls.async = &async;
+    } else {
+      cpu.exit_code = 1;
+      cpu.halt = true;
+    }
+  }
+
+  CPU_t initial_cpu = cpu;
+  off_t stdin_offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+
+  if (options.deadline_ms != 0 &&
+      !rv_set_deadline(&context, options.deadline_ms)) {
+    cpu.exit_code = 1;
+    cpu.halt = true;
+  }
+
+  if (!cpu.halt && options.gdb_address) {
+    if (!gdb_serve(&context, options.gdb_address))
+      cpu.exit_code = EXIT_FAILURE;
+  } else if (!cpu.halt && options.checkpoint_count > 0) {
+    if (!run_to_checkpoints(&context, &options, elf_info.exec_hash, origin))
+      cpu.exit_code = EXIT_FAILURE;
+  } else if (!cpu.halt) {
+    run_guest(&context);
+    for (uint64_t run = 1; run < options.repeat && cpu.exit_code == 0 &&
+                           context.stop_reason == RV_STOP_HALTED;
+         run++) {
+      restart_guest(&context, &initial_cpu, stdin_offset);
+      run_guest(&context);
+    }
+  }
+  if (context.deadline_expired)
+    rv_clear_deadline(&context);
+  syscall_flush_output(&syscalls);
+
+  if (context.stop_reason == RV_STOP_BUDGET) {
+    fprintf(stderr, "Error: Instruction limit of %llu reached at pc 0x%08x\n",
+            (unsigned long long)options.max_instructions, cpu.pc);
+    cpu.exit_code = EXIT_INSTRUCTION_LIMIT;
+  } else if (context.stop_reason == RV_STOP_DEADLINE) {
+    fprintf(stderr,
+            "Error: Deadline of %llu ms passed after %llu instructions at pc "
+            "0x%08x\n",
+            (unsigned long long)options.deadline_ms,
+            (unsigned long long)context.instructions_retired, cpu.pc);
+    cpu.exit_code = EXIT_DEADLINE;
+  }
+
+  if (use_cache_file)
+    block_cache_save(&blocks, &memory, cache_path, elf_info.exec_hash);
+
+  if (syscalls.log && !syscall_log_close(&syscall_log) && cpu.exit_code == 0)
+    cpu.exit_code = EXIT_FAILURE;
+
+  // afl-fuzz only counts a run as a crash when it ends on a signal.
+  bool report_crash = cpu.faulted && context.coverage && coverage.shared;
+  if (context.coverage) {
+    if (options.coverage_path &&
+        !coverage_save(&coverage, options.coverage_path) &&
+        cpu.exit_code == 0)
+      cpu.exit_code = EXIT_FAILURE;
+    free_coverage(&coverage);
+  }
+
+  if (use_cache_sim) {
+    cache_sim_report(&cache_sim, stderr, CACHE_SIM_REPORT_ROWS);
+    free_cache_sim(&cache_sim);
+  }
+
+  if (context.bbv && !bbv_close(&bbv) && cpu.exit_code == 0)
+    cpu.exit_code = EXIT_FAILURE;
+
+  if (context.timing) {
+    timing_report(&timing, stderr);
+    free_timing(&timing);
+  }
+
   if (cpu.exit_code != 0) {
     dump_registers(&cpu);
   }
 
+  if (context.blocks)
+    free_block_cache(&blocks);
+  free_hypercalls(&hypercalls);
+  free_syscall_state(&syscalls);
+  if (syscalls.async)
+    free_async_io(&async);
   free_memory(&memory);
 
+  if (report_crash)
+    abort();
   return cpu.exit_code;
 }
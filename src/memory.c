@@ -1,8 +1,12 @@
 #include "memory.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 static bool contains_range(const Memory_t *memory, uint32_t addr, size_t size) {
   if (addr < memory->base)
@@ -12,28 +16,162 @@ static bool contains_range(const Memory_t *memory, uint32_t addr, size_t size) {
   return offset <= memory->size && size <= memory->size - offset;
 }
 
+static void clear_memory(Memory_t *memory) {
+  memory->data = NULL;
+  memory->size = 0;
+  memory->backing = MEMORY_BACKING_SMALL;
+  memory->base = 0;
+  memory->program_break = 0;
+  memory->pages = NULL;
+  memory->page_count = 0;
+  memory->default_prot = MEMORY_PROT_MASK;
+  memory->tlb = NULL;
+  memory->dirty = NULL;
+  memory->dirty_count = 0;
+  memory->baseline = NULL;
+  memory->code_write = NULL;
+  memory->code_write_arg = NULL;
+  memory->observer = NULL;
+  memory->observer_arg = NULL;
+}
+
+static void *map_anonymous(size_t size, int flags) {
+  return mmap(NULL, size, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+}
+
+// Over-allocates by one huge page and trims the mapping to a huge page
+// boundary, so the kernel can back it with huge pages from the start.
+static void *map_huge_aligned(size_t size) {
+  uint8_t *raw = map_anonymous(size + MEMORY_HUGE_PAGE_SIZE, 0);
+  if (raw == MAP_FAILED)
+    return MAP_FAILED;
+
+  size_t lead = (MEMORY_HUGE_PAGE_SIZE -
+                 (uintptr_t)raw % MEMORY_HUGE_PAGE_SIZE) %
+                MEMORY_HUGE_PAGE_SIZE;
+  if (lead > 0)
+    munmap(raw, lead);
+  munmap(raw + lead + size, MEMORY_HUGE_PAGE_SIZE - lead);
+  return raw + lead;
+}
+
+static bool advise_huge(void *data, size_t size) {
+#ifdef MADV_HUGEPAGE
+  return madvise(data, size, MADV_HUGEPAGE) == 0;
+#else
+  (void)data;
+  (void)size;
+  return false;
+#endif
+}
+
+// Tries `*backing` and then each kind below it, storing the one used.
+static void *map_guest(size_t size, MemoryBacking *backing) {
+#ifdef MAP_HUGETLB
+  if (*backing == MEMORY_BACKING_HUGETLB && size % MEMORY_HUGE_PAGE_SIZE == 0) {
+    void *data = map_anonymous(size, MAP_HUGETLB);
+    if (data != MAP_FAILED)
+      return data;
+  }
+#endif
+  if (*backing >= MEMORY_BACKING_THP && size >= MEMORY_HUGE_PAGE_SIZE) {
+    void *data = map_huge_aligned(size);
+    if (data != MAP_FAILED && advise_huge(data, size)) {
+      *backing = MEMORY_BACKING_THP;
+      return data;
+    }
+    if (data != MAP_FAILED) {
+      *backing = MEMORY_BACKING_SMALL;
+      return data;
+    }
+  }
+
+  *backing = MEMORY_BACKING_SMALL;
+  return map_anonymous(size, 0);
+}
+
+const char *memory_backing_name(MemoryBacking backing) {
+  switch (backing) {
+  case MEMORY_BACKING_THP:
+    return "thp";
+  case MEMORY_BACKING_HUGETLB:
+    return "hugetlb";
+  default:
+    return "small";
+  }
+}
+
 bool init_memory(Memory_t *memory, size_t size) {
-  memory->data = (uint8_t *)calloc(1, size);
-  if (!memory->data) {
+  return init_memory_backed(memory, size, MEMORY_BACKING_THP);
+}
+
+// Guest memory is a private anonymous host mapping so that file-backed guest
+// mappings can be placed over it with MAP_FIXED.
+bool init_memory_backed(Memory_t *memory, size_t size, MemoryBacking backing) {
+  clear_memory(memory);
+
+  void *data = map_guest(size, &backing);
+  if (data == MAP_FAILED) {
     perror("Error: Failed to allocate memory");
-    memory->size = 0;
-    memory->base = 0;
-    memory->program_break = 0;
     return false;
   }
 
+  // One spare entry covers a base that is not page aligned.
+  size_t page_count = (size + GUEST_PAGE_SIZE - 1) / GUEST_PAGE_SIZE + 1;
+  memory->pages = (uint8_t *)malloc(page_count);
+  if (!memory->pages) {
+    perror("Error: Failed to allocate memory");
+    munmap(data, size);
+    return false;
+  }
+  memset(memory->pages, MEMORY_PROT_MASK, page_count);
+
+  memory->tlb = (MemoryTlb_t *)malloc(sizeof(MemoryTlb_t));
+  if (!memory->tlb) {
+    perror("Error: Failed to allocate memory");
+    free(memory->pages);
+    memory->pages = NULL;
+    munmap(data, size);
+    return false;
+  }
+  memory_flush_tlb(memory);
+
+  memory->dirty = (uint32_t *)malloc(page_count * sizeof(uint32_t));
+  if (!memory->dirty) {
+    perror("Error: Failed to allocate memory");
+    free(memory->tlb);
+    free(memory->pages);
+    clear_memory(memory);
+    munmap(data, size);
+    return false;
+  }
+
+  memory->data = (uint8_t *)data;
   memory->size = size;
-  memory->base = 0;
-  memory->program_break = 0;
+  memory->backing = backing;
+  memory->page_count = page_count;
   return true;
 }
 
+static void free_baseline(Memory_t *memory) {
+  if (!memory->baseline)
+    return;
+  free(memory->baseline->flags);
+  free(memory->baseline->slots);
+  free(memory->baseline->data);
+  free(memory->baseline);
+  memory->baseline = NULL;
+}
+
 void free_memory(Memory_t *memory) {
-  free(memory->data);
-  memory->data = NULL;
-  memory->size = 0;
-  memory->base = 0;
-  memory->program_break = 0;
+  if (memory->data)
+    munmap(memory->data, memory->size);
+  free(memory->pages);
+  free(memory->tlb);
+  free(memory->dirty);
+  free_baseline(memory);
+  clear_memory(memory);
 }
 
 bool validate_mem_access(const Memory_t *memory, uint32_t addr, size_t size) {
@@ -66,50 +204,635 @@ bool memory_get_pointer(Memory_t *memory, uint32_t addr, size_t size,
   return true;
 }
 
-bool read_byte(const Memory_t *memory, uint32_t addr, uint8_t *value) {
-  if (!validate_mem_access(memory, addr, 1))
+static size_t page_index(const Memory_t *memory, uint32_t addr) {
+  uint32_t first_page = memory->base / GUEST_PAGE_SIZE;
+  return addr / GUEST_PAGE_SIZE - first_page;
+}
+
+// Lists each page the first time it changes after the baseline, so that a
+// reset visits only those.
+static void mark_dirty(Memory_t *memory, size_t first, size_t last) {
+  for (size_t i = first; i <= last; i++) {
+    if (memory->pages[i] & MEMORY_PAGE_DIRTY)
+      continue;
+    memory->pages[i] |= MEMORY_PAGE_DIRTY;
+    memory->dirty[memory->dirty_count++] = (uint32_t)i;
+  }
+}
+
+void memory_flush_tlb(const Memory_t *memory) {
+  for (size_t i = 0; i < MEMORY_TLB_ENTRIES; i++) {
+    memory->tlb->read[i].tag = MEMORY_TLB_INVALID;
+    memory->tlb->write[i].tag = MEMORY_TLB_INVALID;
+    memory->tlb->exec[i].tag = MEMORY_TLB_INVALID;
+  }
+}
+
+static bool pages_allow(const Memory_t *memory, uint32_t addr, size_t size,
+                        uint8_t prot) {
+  size_t last = page_index(memory, addr + (uint32_t)size - 1);
+  for (size_t i = page_index(memory, addr); i <= last; i++) {
+    if ((memory->pages[i] & prot) != prot)
+      return false;
+  }
+  return true;
+}
+
+bool memory_allows(const Memory_t *memory, uint32_t addr, size_t size,
+                   uint8_t prot) {
+  return size > 0 && contains_range(memory, addr, size) &&
+         pages_allow(memory, addr, size, prot);
+}
+
+static const char *access_name(uint8_t prot) {
+  switch (prot) {
+  case MEMORY_PROT_READ:
+    return "read";
+  case MEMORY_PROT_WRITE:
+    return "write";
+  case MEMORY_PROT_EXEC:
+    return "execute";
+  default:
+    return "access";
+  }
+}
+
+// Caches the page of `addr` for one kind of access. Pages that run past
+// either end of guest memory are never cached, so a hit needs no range check.
+// Stores hitting the TLB skip both the code check and dirty tracking, so only
+// dirty pages without code get write entries.
+static void fill_tlb(const Memory_t *memory, uint32_t addr, uint8_t prot) {
+  MemoryTlbEntry_t *tlb;
+  if (memory->observer)
+    return;
+  if (prot == MEMORY_PROT_READ)
+    tlb = memory->tlb->read;
+  else if (prot == MEMORY_PROT_WRITE)
+    tlb = memory->tlb->write;
+  else if (prot == MEMORY_PROT_EXEC)
+    tlb = memory->tlb->exec;
+  else
+    return;
+
+  uint32_t page = addr / GUEST_PAGE_SIZE;
+  uint32_t start = page * GUEST_PAGE_SIZE;
+  if (!contains_range(memory, start, GUEST_PAGE_SIZE))
+    return;
+  uint8_t flags = memory->pages[page_index(memory, addr)];
+  if (prot == MEMORY_PROT_WRITE &&
+      (flags & (MEMORY_PAGE_CODE | MEMORY_PAGE_DIRTY)) != MEMORY_PAGE_DIRTY)
+    return;
+
+  MemoryTlbEntry_t *entry = &tlb[page % MEMORY_TLB_ENTRIES];
+  entry->tag = page;
+  entry->host = &memory->data[start - memory->base];
+}
+
+uint8_t *memory_access(const Memory_t *memory, uint32_t addr, size_t size,
+                       uint8_t prot) {
+  if (!validate_mem_access(memory, addr, size))
+    return NULL;
+
+  if (!pages_allow(memory, addr, size, prot)) {
+    fprintf(stderr,
+            "Error: Memory %s violates page protection (addr: 0x%08x, "
+            "size: %zu)\n",
+            access_name(prot), addr, size);
+    return NULL;
+  }
+
+  fill_tlb(memory, addr, prot);
+  return &memory->data[addr - memory->base];
+}
+
+bool memory_is_page_range(const Memory_t *memory, uint32_t addr,
+                          uint32_t size) {
+  return addr % GUEST_PAGE_SIZE == 0 && size % GUEST_PAGE_SIZE == 0 &&
+         size > 0 && contains_range(memory, addr, size);
+}
+
+bool memory_range_is_free(const Memory_t *memory, uint32_t addr,
+                          uint32_t size) {
+  if (size == 0)
+    return true;
+  if (!contains_range(memory, addr, size))
     return false;
 
-  *value = memory->data[addr - memory->base];
+  size_t last = page_index(memory, addr + size - 1);
+  for (size_t i = page_index(memory, addr); i <= last; i++) {
+    if (memory->pages[i] & MEMORY_PAGE_MAPPED)
+      return false;
+  }
   return true;
 }
 
-bool read_half(const Memory_t *memory, uint32_t addr, uint16_t *value) {
-  if (!validate_alignment(addr, 2) || !validate_mem_access(memory, addr, 2))
+// First fit from the top of [low, high), so mappings grow down towards the
+// program break and away from the heap.
+bool memory_find_free(const Memory_t *memory, uint32_t low, uint32_t high,
+                      uint32_t size, uint32_t *addr) {
+  if (size == 0 || high < low || high - low < size ||
+      !contains_range(memory, low, high - low))
     return false;
 
-  memcpy(value, &memory->data[addr - memory->base], 2);
+  uint32_t candidate = high - size;
+  for (;;) {
+    bool blocked = false;
+    uint32_t page = 0;
+    for (uint32_t offset = size; offset > 0; offset -= GUEST_PAGE_SIZE) {
+      page = candidate + offset - GUEST_PAGE_SIZE;
+      if (memory->pages[page_index(memory, page)] & MEMORY_PAGE_MAPPED) {
+        blocked = true;
+        break;
+      }
+    }
+
+    if (!blocked) {
+      *addr = candidate;
+      return true;
+    }
+    // Retry just below the mapped page that blocked this candidate.
+    if (page - low < size)
+      return false;
+    candidate = page - size;
+  }
+}
+
+static size_t host_page_size(void) {
+  static size_t page_size;
+  if (page_size == 0) {
+    long value = sysconf(_SC_PAGESIZE);
+    page_size = value > 0 ? (size_t)value : GUEST_PAGE_SIZE;
+  }
+  return page_size;
+}
+
+// Explicit huge pages cannot be replaced one base page at a time, so
+// hugetlb-backed memory never takes host overlays.
+static bool host_aligned(const Memory_t *memory, const uint8_t *host,
+                         size_t size) {
+  return memory->backing != MEMORY_BACKING_HUGETLB &&
+         (uintptr_t)host % host_page_size() == 0 &&
+         size % host_page_size() == 0;
+}
+
+// Returns guest pages to zero-filled private memory. Remapping drops any
+// file overlay and lets the host reclaim the pages; the new range is advised
+// again so that it can merge back into the huge-page mapping around it.
+static void reset_host_range(Memory_t *memory, uint32_t addr, uint32_t size) {
+  uint8_t *host = &memory->data[addr - memory->base];
+  if (host_aligned(memory, host, size) &&
+      mmap(host, size, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED) {
+    if (memory->backing == MEMORY_BACKING_THP)
+      advise_huge(host, size);
+    return;
+  }
+  memset(host, 0, size);
+}
+
+static void set_pages(Memory_t *memory, uint32_t addr, uint32_t size,
+                      uint8_t flags) {
+  size_t last = page_index(memory, addr + size - 1);
+  mark_dirty(memory, page_index(memory, addr), last);
+  for (size_t i = page_index(memory, addr); i <= last; i++)
+    memory->pages[i] = flags | MEMORY_PAGE_DIRTY;
+}
+
+bool memory_map_anonymous(Memory_t *memory, uint32_t addr, uint32_t size,
+                          uint8_t prot) {
+  if (!memory_is_page_range(memory, addr, size))
+    return false;
+
+  memory_mark_written(memory, addr, size);
+  reset_host_range(memory, addr, size);
+  set_pages(memory, addr, size, (prot & MEMORY_PROT_MASK) | MEMORY_PAGE_MAPPED);
+  memory_flush_tlb(memory);
   return true;
 }
 
-bool read_word(const Memory_t *memory, uint32_t addr, uint32_t *value) {
-  if (!validate_alignment(addr, 4) || !validate_mem_access(memory, addr, 4))
+static bool copy_file_range_to(uint8_t *host, size_t size, int fd,
+                               uint64_t offset) {
+  while (size > 0) {
+    ssize_t count = pread(fd, host, size, (off_t)offset);
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count <= 0)
+      return count == 0;
+    host += count;
+    size -= (size_t)count;
+    offset += (uint64_t)count;
+  }
+  return true;
+}
+
+// Pages past the end of the file read as zero, as on Linux, rather than
+// faulting. When the host page size or alignment rules out an overlay,
+// private mappings fall back to a copy and shared ones fail with ENODEV.
+bool memory_map_file(Memory_t *memory, uint32_t addr, uint32_t size,
+                     uint8_t prot, int fd, uint64_t offset, bool shared) {
+  if (!memory_is_page_range(memory, addr, size)) {
+    errno = ENOMEM;
     return false;
+  }
 
-  memcpy(value, &memory->data[addr - memory->base], 4);
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    return false;
+  if (!S_ISREG(st.st_mode)) {
+    errno = ENODEV;
+    return false;
+  }
+
+  uint64_t file_size = (uint64_t)st.st_size;
+  uint64_t available = offset < file_size ? file_size - offset : 0;
+  uint32_t backed = available < size ? (uint32_t)available : size;
+  uint32_t backed_pages =
+      (backed + GUEST_PAGE_SIZE - 1) & ~(uint32_t)(GUEST_PAGE_SIZE - 1);
+  uint8_t *host = &memory->data[addr - memory->base];
+
+  // A read-only shared mapping cannot be written by the guest, so a private
+  // overlay is equivalent and also works for read-only descriptors.
+  bool host_shared = shared && (prot & MEMORY_PROT_WRITE);
+  memory_mark_written(memory, addr, size);
+  if (backed_pages > 0) {
+    if (host_aligned(memory, host, backed_pages) &&
+        offset % host_page_size() == 0) {
+      int flags = (host_shared ? MAP_SHARED : MAP_PRIVATE) | MAP_FIXED;
+      if (mmap(host, backed_pages, PROT_READ | PROT_WRITE, flags, fd,
+               (off_t)offset) == MAP_FAILED)
+        return false;
+    } else if (host_shared) {
+      errno = ENODEV;
+      return false;
+    } else {
+      reset_host_range(memory, addr, backed_pages);
+      if (!copy_file_range_to(host, backed, fd, offset))
+        return false;
+    }
+  }
+
+  if (backed_pages < size)
+    reset_host_range(memory, addr + backed_pages, size - backed_pages);
+  set_pages(memory, addr, size, (prot & MEMORY_PROT_MASK) | MEMORY_PAGE_MAPPED);
+  memory_flush_tlb(memory);
   return true;
 }
 
-bool write_byte(Memory_t *memory, uint32_t addr, uint8_t value) {
-  if (!validate_mem_access(memory, addr, 1))
+void memory_unmap(Memory_t *memory, uint32_t addr, uint32_t size) {
+  if (!memory_is_page_range(memory, addr, size))
+    return;
+
+  for (uint32_t page = addr; page - addr < size; page += GUEST_PAGE_SIZE) {
+    uint8_t *flags = &memory->pages[page_index(memory, page)];
+    if (!(*flags & MEMORY_PAGE_MAPPED))
+      continue;
+    memory_mark_written(memory, page, GUEST_PAGE_SIZE);
+    reset_host_range(memory, page, GUEST_PAGE_SIZE);
+    *flags = memory->default_prot | MEMORY_PAGE_DIRTY;
+  }
+  memory_flush_tlb(memory);
+}
+
+// Code on a page that loses execute permission is dropped, so cached blocks
+// cannot keep running it.
+void memory_protect(Memory_t *memory, uint32_t addr, uint32_t size,
+                    uint8_t prot) {
+  if (!memory_is_page_range(memory, addr, size))
+    return;
+
+  if (!(prot & MEMORY_PROT_EXEC))
+    memory_mark_written(memory, addr, size);
+
+  size_t last = page_index(memory, addr + size - 1);
+  mark_dirty(memory, page_index(memory, addr), last);
+  for (size_t i = page_index(memory, addr); i <= last; i++)
+    memory->pages[i] = (memory->pages[i] & ~MEMORY_PROT_MASK) |
+                       (prot & MEMORY_PROT_MASK);
+  memory_flush_tlb(memory);
+}
+
+void memory_set_default_prot(Memory_t *memory, uint8_t prot) {
+  memory->default_prot = prot & MEMORY_PROT_MASK;
+  mark_dirty(memory, 0, memory->page_count - 1);
+  for (size_t i = 0; i < memory->page_count; i++) {
+    if (!(memory->pages[i] & MEMORY_PAGE_MAPPED))
+      memory->pages[i] = (memory->pages[i] & ~MEMORY_PROT_MASK) |
+                         memory->default_prot;
+  }
+  memory_flush_tlb(memory);
+}
+
+static void change_prot(Memory_t *memory, uint32_t addr, uint32_t size,
+                        uint8_t keep, uint8_t add) {
+  if (size == 0 || !contains_range(memory, addr, size))
+    return;
+
+  size_t last = page_index(memory, addr + size - 1);
+  mark_dirty(memory, page_index(memory, addr), last);
+  for (size_t i = page_index(memory, addr); i <= last; i++)
+    memory->pages[i] = (memory->pages[i] & keep) | (add & MEMORY_PROT_MASK);
+  memory_flush_tlb(memory);
+}
+
+void memory_grant(Memory_t *memory, uint32_t addr, uint32_t size,
+                  uint8_t prot) {
+  change_prot(memory, addr, size, 0xFF, prot);
+}
+
+void memory_revoke(Memory_t *memory, uint32_t addr, uint32_t size,
+                   uint8_t prot) {
+  change_prot(memory, addr, size, (uint8_t)~prot, 0);
+}
+
+void memory_set_code_hook(Memory_t *memory, MemoryWriteHook hook, void *arg) {
+  memory->code_write = hook;
+  memory->code_write_arg = arg;
+}
+
+void memory_set_observer(Memory_t *memory, MemoryObserver observer,
+                         void *arg) {
+  memory->observer = observer;
+  memory->observer_arg = arg;
+  memory_flush_tlb(memory);
+}
+
+void memory_mark_code(Memory_t *memory, uint32_t addr, size_t size) {
+  if (size == 0 || !contains_range(memory, addr, size))
+    return;
+
+  // Stores to these pages must now take the slow path and its code check.
+  uint32_t last_page = (addr + (uint32_t)size - 1) / GUEST_PAGE_SIZE;
+  for (uint32_t page = addr / GUEST_PAGE_SIZE; page <= last_page; page++) {
+    memory->pages[page_index(memory, page * GUEST_PAGE_SIZE)] |=
+        MEMORY_PAGE_CODE;
+    MemoryTlbEntry_t *entry = &memory->tlb->write[page % MEMORY_TLB_ENTRIES];
+    if (entry->tag == page)
+      entry->tag = MEMORY_TLB_INVALID;
+  }
+}
+
+void memory_clear_code(Memory_t *memory) {
+  for (size_t i = 0; i < memory->page_count; i++)
+    memory->pages[i] &= (uint8_t)~MEMORY_PAGE_CODE;
+}
+
+// Reports writes that miss the write TLB, including syscall buffers and
+// remapped pages: the pages turn dirty and cached code on them is dropped.
+void memory_mark_written(Memory_t *memory, uint32_t addr, size_t size) {
+  if (size == 0 || !contains_range(memory, addr, size))
+    return;
+
+  size_t first = page_index(memory, addr);
+  size_t last = page_index(memory, addr + (uint32_t)size - 1);
+  mark_dirty(memory, first, last);
+  if (!memory->code_write)
+    return;
+
+  for (size_t i = first; i <= last; i++) {
+    if (memory->pages[i] & MEMORY_PAGE_CODE) {
+      memory->code_write(memory->code_write_arg, addr, size);
+      return;
+    }
+  }
+}
+
+// The part of page `index` that lies inside guest memory, as a host offset
+// and a length; the first and last pages may be partial.
+static size_t page_span(const Memory_t *memory, size_t index, size_t *offset) {
+  uint64_t low = memory->base;
+  uint64_t high = low + memory->size;
+  uint64_t start = (low / GUEST_PAGE_SIZE + index) * GUEST_PAGE_SIZE;
+  uint64_t end = start + GUEST_PAGE_SIZE;
+  if (start < low)
+    start = low;
+  if (end > high)
+    end = high;
+  if (end <= start)
+    return 0;
+
+  *offset = (size_t)(start - low);
+  return (size_t)(end - start);
+}
+
+static bool is_zero(const uint8_t *data, size_t size) {
+  return size == 0 || (data[0] == 0 && memcmp(data, data + 1, size - 1) == 0);
+}
+
+bool memory_capture_baseline(Memory_t *memory) {
+  free_baseline(memory);
+
+  size_t copies = 0;
+  for (size_t i = 0; i < memory->page_count; i++) {
+    size_t offset = 0;
+    size_t length = page_span(memory, i, &offset);
+    if (!is_zero(&memory->data[offset], length))
+      copies++;
+  }
+
+  MemoryBaseline_t *baseline =
+      (MemoryBaseline_t *)calloc(1, sizeof(MemoryBaseline_t));
+  if (baseline) {
+    baseline->flags = (uint8_t *)malloc(memory->page_count);
+    baseline->slots =
+        (uint32_t *)malloc(memory->page_count * sizeof(uint32_t));
+    baseline->data = (uint8_t *)malloc(copies * GUEST_PAGE_SIZE + 1);
+  }
+  memory->baseline = baseline;
+  if (!baseline || !baseline->flags || !baseline->slots || !baseline->data) {
+    perror("Error: Failed to allocate memory baseline");
+    free_baseline(memory);
     return false;
+  }
 
-  memory->data[addr - memory->base] = value;
+  uint32_t slot = 0;
+  for (size_t i = 0; i < memory->page_count; i++) {
+    memory->pages[i] &= (uint8_t)~MEMORY_PAGE_DIRTY;
+    baseline->flags[i] = memory->pages[i] & (uint8_t)~MEMORY_PAGE_CODE;
+    baseline->slots[i] = MEMORY_BASELINE_ZERO;
+
+    size_t offset = 0;
+    size_t length = page_span(memory, i, &offset);
+    if (is_zero(&memory->data[offset], length))
+      continue;
+    memcpy(&baseline->data[(size_t)slot * GUEST_PAGE_SIZE],
+           &memory->data[offset], length);
+    baseline->slots[i] = slot++;
+  }
+  baseline->program_break = memory->program_break;
+  memory->dirty_count = 0;
+  memory_flush_tlb(memory);
   return true;
 }
 
-bool write_half(Memory_t *memory, uint32_t addr, uint16_t value) {
-  if (!validate_alignment(addr, 2) || !validate_mem_access(memory, addr, 2))
+// Guest mappings over a page are dropped before its contents come back, so
+// the copy never writes through to a mapped file.
+void memory_reset_to_baseline(Memory_t *memory) {
+  const MemoryBaseline_t *baseline = memory->baseline;
+  if (!baseline)
+    return;
+
+  for (size_t i = 0; i < memory->dirty_count; i++) {
+    size_t index = memory->dirty[i];
+    size_t offset = 0;
+    size_t length = page_span(memory, index, &offset);
+    uint8_t flags = memory->pages[index];
+    uint32_t addr = memory->base + (uint32_t)offset;
+
+    if (flags & MEMORY_PAGE_MAPPED)
+      reset_host_range(memory, addr, (uint32_t)length);
+    uint32_t slot = baseline->slots[index];
+    if (slot == MEMORY_BASELINE_ZERO)
+      memset(&memory->data[offset], 0, length);
+    else
+      memcpy(&memory->data[offset],
+             &baseline->data[(size_t)slot * GUEST_PAGE_SIZE], length);
+
+    memory->pages[index] = baseline->flags[index] | (flags & MEMORY_PAGE_CODE);
+    if ((flags & MEMORY_PAGE_CODE) && memory->code_write && length > 0)
+      memory->code_write(memory->code_write_arg, addr, length);
+  }
+
+  memory->dirty_count = 0;
+  memory->program_break = baseline->program_break;
+  memory_flush_tlb(memory);
+}
+
+// On-disk image: a header, one flags byte per page, then each page that is
+// not all zero as its index and contents, ended by MEMORY_IMAGE_END.
+#define MEMORY_IMAGE_END UINT32_MAX
+#define MEMORY_IMAGE_FLAGS (MEMORY_PROT_MASK | MEMORY_PAGE_MAPPED)
+
+typedef struct MemoryImageHeader {
+  uint32_t base;
+  uint32_t program_break;
+  uint64_t size;
+  uint64_t page_count;
+  uint32_t default_prot;
+  uint32_t padding;
+} MemoryImageHeader_t;
+
+bool memory_save_image(const Memory_t *memory, FILE *fp) {
+  MemoryImageHeader_t header = {.base = memory->base,
+                                .program_break = memory->program_break,
+                                .size = memory->size,
+                                .page_count = memory->page_count,
+                                .default_prot = memory->default_prot};
+  bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+  for (size_t i = 0; ok && i < memory->page_count; i++)
+    ok = fputc(memory->pages[i] & MEMORY_IMAGE_FLAGS, fp) != EOF;
+
+  for (size_t i = 0; ok && i < memory->page_count; i++) {
+    size_t offset = 0;
+    size_t length = page_span(memory, i, &offset);
+    if (is_zero(&memory->data[offset], length))
+      continue;
+    uint32_t index = (uint32_t)i;
+    ok = fwrite(&index, sizeof(index), 1, fp) == 1 &&
+         fwrite(&memory->data[offset], 1, length, fp) == length;
+  }
+
+  uint32_t end = MEMORY_IMAGE_END;
+  return ok && fwrite(&end, sizeof(end), 1, fp) == 1;
+}
+
+bool memory_load_image(Memory_t *memory, FILE *fp) {
+  MemoryImageHeader_t header;
+  if (fread(&header, sizeof(header), 1, fp) != 1 ||
+      header.base != memory->base || header.size != memory->size ||
+      header.page_count != memory->page_count ||
+      (header.default_prot & ~MEMORY_PROT_MASK) != 0)
+    return false;
+
+  // Every page changes, so every page is dirty relative to any baseline.
+  if (memory->page_count > 0)
+    mark_dirty(memory, 0, memory->page_count - 1);
+  for (size_t i = 0; i < memory->page_count; i++) {
+    int flags = fgetc(fp);
+    if (flags == EOF || (flags & ~MEMORY_IMAGE_FLAGS) != 0)
+      return false;
+    memory->pages[i] = (uint8_t)flags | MEMORY_PAGE_DIRTY |
+                       (memory->pages[i] & MEMORY_PAGE_CODE);
+
+    size_t offset = 0;
+    size_t length = page_span(memory, i, &offset);
+    if (!is_zero(&memory->data[offset], length))
+      memset(&memory->data[offset], 0, length);
+  }
+  memory->default_prot = (uint8_t)header.default_prot;
+  memory->program_break = header.program_break;
+  memory_flush_tlb(memory);
+
+  uint32_t index;
+  while (fread(&index, sizeof(index), 1, fp) == 1) {
+    if (index == MEMORY_IMAGE_END)
+      return true;
+    size_t offset = 0;
+    size_t length = index < memory->page_count
+                        ? page_span(memory, index, &offset)
+                        : 0;
+    if (length == 0 ||
+        fread(&memory->data[offset], 1, length, fp) != length)
+      return false;
+  }
+  return false;
+}
+
+// Aligned accesses never cross a page, so the TLB entry for the first byte
+// covers them all.
+static inline bool load(const Memory_t *memory, uint32_t addr, void *value,
+                        size_t size) {
+  uint8_t *host = memory_tlb_lookup(memory->tlb->read, addr);
+  if (!host)
+    host = memory_access(memory, addr, size, MEMORY_PROT_READ);
+  if (!host)
     return false;
 
-  memcpy(&memory->data[addr - memory->base], &value, 2);
+  memcpy(value, host, size);
+  if (memory->observer)
+    memory->observer(memory->observer_arg, addr, size, MEMORY_PROT_READ);
   return true;
 }
 
-bool write_word(Memory_t *memory, uint32_t addr, uint32_t value) {
-  if (!validate_alignment(addr, 4) || !validate_mem_access(memory, addr, 4))
+static inline bool store(Memory_t *memory, uint32_t addr, const void *value,
+                         size_t size) {
+  uint8_t *host = memory_tlb_lookup(memory->tlb->write, addr);
+  if (host) {
+    memcpy(host, value, size);
+    return true;
+  }
+
+  host = memory_access(memory, addr, size, MEMORY_PROT_WRITE);
+  if (!host)
     return false;
 
-  memcpy(&memory->data[addr - memory->base], &value, 4);
+  memcpy(host, value, size);
+  memory_mark_written(memory, addr, size);
+  fill_tlb(memory, addr, MEMORY_PROT_WRITE);
+  if (memory->observer)
+    memory->observer(memory->observer_arg, addr, size, MEMORY_PROT_WRITE);
   return true;
 }
+
+bool read_byte(const Memory_t *memory, uint32_t addr, uint8_t *value) {
+  return load(memory, addr, value, 1);
+}
+
+bool read_half(const Memory_t *memory, uint32_t addr, uint16_t *value) {
+  return validate_alignment(addr, 2) && load(memory, addr, value, 2);
+}
+
+bool read_word(const Memory_t *memory, uint32_t addr, uint32_t *value) {
+  return validate_alignment(addr, 4) && load(memory, addr, value, 4);
+}
+
+bool write_byte(Memory_t *memory, uint32_t addr, uint8_t value) {
+  return store(memory, addr, &value, 1);
+}
+
+bool write_half(Memory_t *memory, uint32_t addr, uint16_t value) {
+  return validate_alignment(addr, 2) && store(memory, addr, &value, 2);
+}
+
+bool write_word(Memory_t *memory, uint32_t addr, uint32_t value) {
+  return validate_alignment(addr, 4) && store(memory, addr, &value, 4);
+}
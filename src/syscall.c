@@ -1,9 +1,86 @@
 #include "syscall.h"
 
+#include "syscall_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+// Linux (asm-generic) ABI values seen by the guest.
+#define GUEST_AT_FDCWD ((uint32_t)-100)
+#define GUEST_O_ACCMODE 03
+#define GUEST_O_CREAT 0100
+#define GUEST_O_EXCL 0200
+#define GUEST_O_NOCTTY 0400
+#define GUEST_O_TRUNC 01000
+#define GUEST_O_APPEND 02000
+#define GUEST_O_NONBLOCK 04000
+#define GUEST_O_DIRECTORY 0200000
+#define GUEST_O_NOFOLLOW 0400000
+#define GUEST_O_CLOEXEC 02000000
+#define GUEST_MAP_SHARED 0x01
+#define GUEST_MAP_PRIVATE 0x02
+#define GUEST_MAP_FIXED 0x10
+#define GUEST_MAP_ANONYMOUS 0x20
+#define GUEST_MAP_FIXED_NOREPLACE 0x100000
+#define GUEST_IOV_MAX 1024
+
+typedef struct GuestIovec {
+  uint32_t base;
+  uint32_t len;
+} GuestIovec_t;
+
+typedef struct GuestTimespec {
+  int64_t tv_sec;
+  int32_t tv_nsec;
+  int32_t pad;
+} GuestTimespec_t;
+
+// struct kernel_stat as laid out by libgloss for RV32.
+typedef struct GuestStat {
+  uint64_t st_dev;
+  uint64_t st_ino;
+  uint32_t st_mode;
+  uint32_t st_nlink;
+  uint32_t st_uid;
+  uint32_t st_gid;
+  uint64_t st_rdev;
+  uint64_t pad1;
+  int64_t st_size;
+  int32_t st_blksize;
+  int32_t pad2;
+  int64_t st_blocks;
+  GuestTimespec_t st_atim;
+  GuestTimespec_t st_mtim;
+  GuestTimespec_t st_ctim;
+  int32_t reserved[2];
+} GuestStat_t;
+
+_Static_assert(sizeof(GuestStat_t) == 128, "guest stat layout");
+
+static void set_result(CPU_t *cpu, int64_t value) {
+  write_reg(cpu, 10, (uint32_t)value);
+}
+
+static void set_errno_result(CPU_t *cpu) { set_result(cpu, -errno); }
+
+// Guest memory filled by a syscall: invalidates cached code there and logs
+// the bytes when recording.
+static void mark_output(Memory_t *memory, SyscallState_t *state, uint32_t addr,
+                        size_t size) {
+  memory_mark_written(memory, addr, size);
+  if (state)
+    syscall_log_output(state->log, addr, size);
+}
+
 static bool get_syscall_buffer(Memory_t *memory, uint32_t buf_addr,
                                uint32_t count, const char *op, char **buffer) {
   uint8_t *pointer;
@@ -16,60 +93,698 @@ static bool get_syscall_buffer(Memory_t *memory, uint32_t buf_addr,
   return true;
 }
 
-void handle_sys_read(CPU_t *cpu, Memory_t *memory) {
+static bool get_syscall_string(Memory_t *memory, uint32_t addr, const char *op,
+                               const char **string) {
+  char *start;
+  if (!get_syscall_buffer(memory, addr, 1, op, &start))
+    return false;
+
+  size_t available = memory->size - (addr - memory->base);
+  if (!memchr(start, '\0', available)) {
+    fprintf(stderr, "Error: ECALL %s string is not terminated\n", op);
+    return false;
+  }
+
+  *string = start;
+  return true;
+}
+
+static int host_fd(const SyscallState_t *state, uint32_t fd) {
+  if (!state)
+    return fd <= 2 ? (int)fd : -1;
+  if (fd >= SYSCALL_MAX_FDS)
+    return -1;
+  return state->host_fds[fd];
+}
+
+static int host_open_flags(uint32_t flags) {
+  static const struct {
+    uint32_t guest;
+    int host;
+  } flag_map[] = {
+      {GUEST_O_CREAT, O_CREAT},         {GUEST_O_EXCL, O_EXCL},
+      {GUEST_O_NOCTTY, O_NOCTTY},       {GUEST_O_TRUNC, O_TRUNC},
+      {GUEST_O_APPEND, O_APPEND},       {GUEST_O_NONBLOCK, O_NONBLOCK},
+      {GUEST_O_DIRECTORY, O_DIRECTORY}, {GUEST_O_NOFOLLOW, O_NOFOLLOW},
+      {GUEST_O_CLOEXEC, O_CLOEXEC},
+  };
+
+  int host = 0;
+  switch (flags & GUEST_O_ACCMODE) {
+  case 0:
+    host = O_RDONLY;
+    break;
+  case 1:
+    host = O_WRONLY;
+    break;
+  default:
+    host = O_RDWR;
+    break;
+  }
+
+  for (size_t i = 0; i < sizeof(flag_map) / sizeof(flag_map[0]); i++) {
+    if (flags & flag_map[i].guest)
+      host |= flag_map[i].host;
+  }
+  return host;
+}
+
+void init_syscall_state(SyscallState_t *state) {
+  for (int i = 0; i < SYSCALL_MAX_FDS; i++) {
+    state->host_fds[i] = i <= 2 ? i : -1;
+    state->output[i] = (OutputBuffer_t){.data = NULL, .length = 0};
+  }
+  state->io_mode = SYSCALL_IO_STRICT;
+  state->async = NULL;
+  state->log = NULL;
+}
+
+void free_syscall_state(SyscallState_t *state) {
+  syscall_flush_output(state);
+  for (int i = 0; i < SYSCALL_MAX_FDS; i++) {
+    if (state->host_fds[i] > 2)
+      close(state->host_fds[i]);
+    state->host_fds[i] = -1;
+    free(state->output[i].data);
+    state->output[i] = (OutputBuffer_t){.data = NULL, .length = 0};
+  }
+}
+
+static bool write_all(int fd, const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t written = write(fd, data, length);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += written;
+    length -= (size_t)written;
+  }
+  return true;
+}
+
+static void flush_fd_output(SyscallState_t *state, uint32_t fd) {
+  OutputBuffer_t *output = &state->output[fd];
+  if (output->length == 0)
+    return;
+
+  if (!write_all(state->host_fds[fd], output->data, output->length))
+    perror("Error: Failed to flush buffered guest output");
+  output->length = 0;
+}
+
+void syscall_flush_output(SyscallState_t *state) {
+  if (state->async)
+    async_io_drain(state->async);
+  for (uint32_t fd = 0; fd < SYSCALL_MAX_FDS; fd++)
+    flush_fd_output(state, fd);
+}
+
+// Pending output must reach the host before anything else touches the
+// descriptor. Reading stdin also flushes everything so prompts show first.
+static void sync_fd_output(SyscallState_t *state, uint32_t fd) {
+  if (!state)
+    return;
+  if (state->async)
+    async_io_drain(state->async);
+  if (fd >= SYSCALL_MAX_FDS)
+    return;
+  if (fd == 0)
+    syscall_flush_output(state);
+  else
+    flush_fd_output(state, fd);
+}
+
+// Makes room for `length` bytes in the descriptor's buffer, flushing it when
+// full. Returns false when the write must go straight to the host instead.
+static bool reserve_output(SyscallState_t *state, uint32_t fd, size_t length) {
+  if (!state || state->io_mode != SYSCALL_IO_BUFFERED ||
+      fd >= SYSCALL_MAX_FDS || length >= SYSCALL_OUTPUT_BUFFER_SIZE)
+    return false;
+
+  OutputBuffer_t *output = &state->output[fd];
+  if (!output->data) {
+    output->data = (char *)malloc(SYSCALL_OUTPUT_BUFFER_SIZE);
+    if (!output->data)
+      return false;
+  }
+
+  if (length > SYSCALL_OUTPUT_BUFFER_SIZE - output->length)
+    flush_fd_output(state, fd);
+  return true;
+}
+
+static void append_output(SyscallState_t *state, uint32_t fd, const void *data,
+                          size_t length) {
+  OutputBuffer_t *output = &state->output[fd];
+  memcpy(output->data + output->length, data, length);
+  output->length += length;
+}
+
+void handle_sys_openat(CPU_t *cpu, Memory_t *memory, SyscallState_t *state) {
+  uint32_t dirfd = read_reg(cpu, 10);
+  uint32_t path_addr = read_reg(cpu, 11);
+  uint32_t flags = read_reg(cpu, 12);
+  uint32_t mode = read_reg(cpu, 13);
+
+  const char *path;
+  if (!get_syscall_string(memory, path_addr, "openat", &path)) {
+    set_result(cpu, -EFAULT);
+    return;
+  }
+
+  int host_dirfd = dirfd == GUEST_AT_FDCWD ? AT_FDCWD : host_fd(state, dirfd);
+  if (host_dirfd == -1) {
+    set_result(cpu, -EBADF);
+    return;
+  }
+
+  int guest_fd = -1;
+  for (int i = 0; state && i < SYSCALL_MAX_FDS; i++) {
+    if (state->host_fds[i] == -1) {
+      guest_fd = i;
+      break;
+    }
+  }
+  if (guest_fd == -1) {
+    set_result(cpu, -EMFILE);
+    return;
+  }
+
+  int fd = openat(host_dirfd, path, host_open_flags(flags), (mode_t)mode);
+  if (fd < 0) {
+    set_errno_result(cpu);
+    return;
+  }
+
+  state->host_fds[guest_fd] = fd;
+  set_result(cpu, guest_fd);
+}
+
+void handle_sys_close(CPU_t *cpu, SyscallState_t *state) {
+  uint32_t fd = read_reg(cpu, 10);
+  int host = host_fd(state, fd);
+  if (host == -1 || !state) {
+    set_result(cpu, -EBADF);
+    return;
+  }
+
+  sync_fd_output(state, fd);
+
+  // The emulator keeps its own stdio; the guest only loses the mapping.
+  state->host_fds[fd] = -1;
+  if (host > 2 && close(host) != 0) {
+    set_errno_result(cpu);
+    return;
+  }
+  set_result(cpu, 0);
+}
+
+void handle_sys_lseek(CPU_t *cpu, SyscallState_t *state) {
   uint32_t fd = read_reg(cpu, 10);
+  int host = host_fd(state, fd);
+  int32_t offset = (int32_t)read_reg(cpu, 11);
+  uint32_t whence = read_reg(cpu, 12);
+
+  if (host == -1) {
+    set_result(cpu, -EBADF);
+    return;
+  }
+
+  sync_fd_output(state, fd);
+  off_t position = lseek(host, offset, (int)whence);
+  if (position < 0) {
+    set_errno_result(cpu);
+    return;
+  }
+  if (position > INT32_MAX) {
+    set_result(cpu, -EOVERFLOW);
+    return;
+  }
+  set_result(cpu, position);
+}
+
+void handle_sys_read(CPU_t *cpu, Memory_t *memory, SyscallState_t *state) {
+  uint32_t guest_fd = read_reg(cpu, 10);
+  int fd = host_fd(state, guest_fd);
   uint32_t buf_addr = read_reg(cpu, 11);
   uint32_t count = read_reg(cpu, 12);
 
   char *buffer;
   if (!get_syscall_buffer(memory, buf_addr, count, "read", &buffer)) {
-    write_reg(cpu, 10, (uint32_t)-1);
+    set_result(cpu, -EFAULT);
+    return;
+  }
+  if (fd == -1) {
+    set_result(cpu, -EBADF);
     return;
   }
 
-  ssize_t read_count = read(fd, buffer, count);
-  write_reg(cpu, 10, (uint32_t)read_count);
+  ssize_t read_count;
+  if (state && state->async) {
+    read_count = async_io_read(state->async, fd, buffer, count);
+  } else {
+    sync_fd_output(state, guest_fd);
+    read_count = read(fd, buffer, count);
+  }
+  if (read_count < 0) {
+    set_errno_result(cpu);
+    return;
+  }
+  mark_output(memory, state, buf_addr, (size_t)read_count);
+  set_result(cpu, read_count);
 }
 
-void handle_sys_write(CPU_t *cpu, Memory_t *memory) {
-  uint32_t fd = read_reg(cpu, 10);
+void handle_sys_write(CPU_t *cpu, Memory_t *memory, SyscallState_t *state) {
+  uint32_t guest_fd = read_reg(cpu, 10);
+  int fd = host_fd(state, guest_fd);
   uint32_t buf_addr = read_reg(cpu, 11);
   uint32_t count = read_reg(cpu, 12);
 
   char *buffer;
   if (!get_syscall_buffer(memory, buf_addr, count, "write", &buffer)) {
-    write_reg(cpu, 10, (uint32_t)-1);
+    set_result(cpu, -EFAULT);
+    return;
+  }
+  if (fd == -1) {
+    set_result(cpu, -EBADF);
     return;
   }
 
+  if (reserve_output(state, guest_fd, count)) {
+    append_output(state, guest_fd, buffer, count);
+    set_result(cpu, count);
+    return;
+  }
+  if (state && state->async &&
+      async_io_write(state->async, fd, buffer, count)) {
+    set_result(cpu, count);
+    return;
+  }
+
+  sync_fd_output(state, guest_fd);
   ssize_t written = write(fd, buffer, count);
-  write_reg(cpu, 10, (uint32_t)written);
+  if (written < 0) {
+    set_errno_result(cpu);
+    return;
+  }
+  set_result(cpu, written);
+}
+
+// Builds host iovecs that point straight into guest memory, so vectored I/O
+// needs no bounce buffer.
+static int map_guest_iovecs(Memory_t *memory, uint32_t iov_addr,
+                            uint32_t iovcnt, const char *op,
+                            struct iovec *host_iov) {
+  if (iovcnt > GUEST_IOV_MAX)
+    return -EINVAL;
+
+  char *raw;
+  if (!get_syscall_buffer(memory, iov_addr, iovcnt * sizeof(GuestIovec_t), op,
+                          &raw))
+    return -EFAULT;
+
+  for (uint32_t i = 0; i < iovcnt; i++) {
+    GuestIovec_t guest_iov;
+    memcpy(&guest_iov, raw + i * sizeof(GuestIovec_t), sizeof(guest_iov));
+
+    char *buffer;
+    if (!get_syscall_buffer(memory, guest_iov.base, guest_iov.len, op,
+                            &buffer))
+      return -EFAULT;
+    host_iov[i].iov_base = buffer;
+    host_iov[i].iov_len = guest_iov.len;
+  }
+  return 0;
+}
+
+static void mark_iovecs_written(Memory_t *memory, SyscallState_t *state,
+                                const struct iovec *host_iov, uint32_t iovcnt,
+                                size_t count) {
+  for (uint32_t i = 0; i < iovcnt && count > 0; i++) {
+    size_t length = host_iov[i].iov_len < count ? host_iov[i].iov_len : count;
+    uint32_t addr =
+        memory->base + (uint32_t)((uint8_t *)host_iov[i].iov_base -
+                                  memory->data);
+    mark_output(memory, state, addr, length);
+    count -= length;
+  }
+}
+
+void handle_sys_readv(CPU_t *cpu, Memory_t *memory, SyscallState_t *state) {
+  uint32_t guest_fd = read_reg(cpu, 10);
+  int fd = host_fd(state, guest_fd);
+  uint32_t iov_addr = read_reg(cpu, 11);
+  uint32_t iovcnt = read_reg(cpu, 12);
+
+  struct iovec host_iov[GUEST_IOV_MAX];
+  int error = map_guest_iovecs(memory, iov_addr, iovcnt, "readv", host_iov);
+  if (error != 0) {
+    set_result(cpu, error);
+    return;
+  }
+  if (fd == -1) {
+    set_result(cpu, -EBADF);
+    return;
+  }
+
+  sync_fd_output(state, guest_fd);
+  ssize_t read_count = readv(fd, host_iov, (int)iovcnt);
+  if (read_count < 0) {
+    set_errno_result(cpu);
+    return;
+  }
+  mark_iovecs_written(memory, state, host_iov, iovcnt, (size_t)read_count);
+  set_result(cpu, read_count);
+}
+
+void handle_sys_writev(CPU_t *cpu, Memory_t *memory, SyscallState_t *state) {
+  uint32_t guest_fd = read_reg(cpu, 10);
+  int fd = host_fd(state, guest_fd);
+  uint32_t iov_addr = read_reg(cpu, 11);
+  uint32_t iovcnt = read_reg(cpu, 12);
+
+  struct iovec host_iov[GUEST_IOV_MAX];
+  int error = map_guest_iovecs(memory, iov_addr, iovcnt, "writev", host_iov);
+  if (error != 0) {
+    set_result(cpu, error);
+    return;
+  }
+  if (fd == -1) {
+    set_result(cpu, -EBADF);
+    return;
+  }
+
+  size_t total = 0;
+  for (uint32_t i = 0; i < iovcnt; i++)
+    total += host_iov[i].iov_len;
+  if (reserve_output(state, guest_fd, total)) {
+    for (uint32_t i = 0; i < iovcnt; i++)
+      append_output(state, guest_fd, host_iov[i].iov_base, host_iov[i].iov_len);
+    set_result(cpu, (int64_t)total);
+    return;
+  }
+  if (state && state->async &&
+      async_io_writev(state->async, fd, host_iov, (int)iovcnt)) {
+    set_result(cpu, (int64_t)total);
+    return;
+  }
+
+  sync_fd_output(state, guest_fd);
+  ssize_t written = writev(fd, host_iov, (int)iovcnt);
+  if (written < 0) {
+    set_errno_result(cpu);
+    return;
+  }
+  set_result(cpu, written);
+}
+
+static GuestTimespec_t guest_timespec(struct timespec time) {
+  return (GuestTimespec_t){.tv_sec = time.tv_sec,
+                           .tv_nsec = (int32_t)time.tv_nsec};
 }
 
-void handle_sys_exit(CPU_t *cpu) {
+void handle_sys_fstat(CPU_t *cpu, Memory_t *memory, SyscallState_t *state) {
+  uint32_t guest_fd = read_reg(cpu, 10);
+  int fd = host_fd(state, guest_fd);
+  uint32_t stat_addr = read_reg(cpu, 11);
+
+  char *buffer;
+  if (!get_syscall_buffer(memory, stat_addr, sizeof(GuestStat_t), "fstat",
+                          &buffer)) {
+    set_result(cpu, -EFAULT);
+    return;
+  }
+  if (fd == -1) {
+    set_result(cpu, -EBADF);
+    return;
+  }
+
+  sync_fd_output(state, guest_fd);
+  struct stat host_stat;
+  if (fstat(fd, &host_stat) != 0) {
+    set_errno_result(cpu);
+    return;
+  }
+
+  GuestStat_t guest_stat = {
+      .st_dev = host_stat.st_dev,
+      .st_ino = host_stat.st_ino,
+      .st_mode = host_stat.st_mode,
+      .st_nlink = (uint32_t)host_stat.st_nlink,
+      .st_uid = host_stat.st_uid,
+      .st_gid = host_stat.st_gid,
+      .st_rdev = host_stat.st_rdev,
+      .st_size = host_stat.st_size,
+      .st_blksize = (int32_t)host_stat.st_blksize,
+      .st_blocks = host_stat.st_blocks,
+      .st_atim = guest_timespec(host_stat.st_atim),
+      .st_mtim = guest_timespec(host_stat.st_mtim),
+      .st_ctim = guest_timespec(host_stat.st_ctim),
+  };
+  memcpy(buffer, &guest_stat, sizeof(guest_stat));
+  mark_output(memory, state, stat_addr, sizeof(guest_stat));
+  set_result(cpu, 0);
+}
+
+void handle_sys_fsync(CPU_t *cpu, SyscallState_t *state, bool data_only) {
+  uint32_t guest_fd = read_reg(cpu, 10);
+  int fd = host_fd(state, guest_fd);
+  if (fd == -1) {
+    set_result(cpu, -EBADF);
+    return;
+  }
+
+  sync_fd_output(state, guest_fd);
+  if ((data_only ? fdatasync(fd) : fsync(fd)) != 0) {
+    set_errno_result(cpu);
+    return;
+  }
+  set_result(cpu, 0);
+}
+
+void handle_sys_exit(CPU_t *cpu, SyscallState_t *state) {
+  if (state)
+    syscall_flush_output(state);
   cpu->exit_code = read_reg(cpu, 10);
   cpu->halt = true;
 }
 
+void handle_sys_clock_gettime(CPU_t *cpu, Memory_t *memory,
+                              SyscallState_t *state, bool time64) {
+  uint32_t clock_id = read_reg(cpu, 10);
+  uint32_t time_addr = read_reg(cpu, 11);
+  size_t size = time64 ? 2 * sizeof(int64_t) : 2 * sizeof(int32_t);
+
+  char *buffer;
+  if (!get_syscall_buffer(memory, time_addr, size, "clock_gettime", &buffer)) {
+    set_result(cpu, -EFAULT);
+    return;
+  }
+
+  struct timespec now;
+  if (clock_gettime((clockid_t)clock_id, &now) != 0) {
+    set_errno_result(cpu);
+    return;
+  }
+
+  if (time64) {
+    int64_t fields[2] = {now.tv_sec, now.tv_nsec};
+    memcpy(buffer, fields, sizeof(fields));
+  } else {
+    int32_t fields[2] = {(int32_t)now.tv_sec, (int32_t)now.tv_nsec};
+    memcpy(buffer, fields, sizeof(fields));
+  }
+  mark_output(memory, state, time_addr, size);
+  set_result(cpu, 0);
+}
+
+static uint32_t page_align_up(uint32_t value) {
+  return (value + GUEST_PAGE_SIZE - 1) & ~(uint32_t)(GUEST_PAGE_SIZE - 1);
+}
+
+// The top STACK_RESERVE_BYTES of guest memory belong to the stack; the heap
+// and mappings share the space between the program break and that reserve.
+static uint32_t mmap_limit(const Memory_t *memory) {
+  if (memory->size <= STACK_RESERVE_BYTES)
+    return memory->base;
+  uint32_t top = memory->base + (uint32_t)memory->size - STACK_RESERVE_BYTES;
+  return top & ~(uint32_t)(GUEST_PAGE_SIZE - 1);
+}
+
 void handle_sys_brk(CPU_t *cpu, Memory_t *memory) {
   uint32_t new_brk = read_reg(cpu, 10);
+  uint32_t old_brk = memory->program_break;
 
   if (new_brk == 0) {
-    write_reg(cpu, 10, memory->program_break);
+    write_reg(cpu, 10, old_brk);
     return;
   }
 
-  if (new_brk < memory->base || new_brk - memory->base > memory->size) {
-    write_reg(cpu, 10, memory->program_break);
+  if (new_brk < memory->base || new_brk > mmap_limit(memory)) {
+    write_reg(cpu, 10, old_brk);
     return;
   }
 
-  uint32_t sp = read_reg(cpu, 2);
-  if (new_brk >= sp - 4096) {
-    write_reg(cpu, 10, memory->program_break);
+  // The heap may not grow over pages handed out by mmap.
+  uint32_t old_top = page_align_up(old_brk);
+  if (new_brk > old_top &&
+      !memory_range_is_free(memory, old_top,
+                            page_align_up(new_brk) - old_top)) {
+    write_reg(cpu, 10, old_brk);
     return;
   }
 
   memory->program_break = new_brk;
   write_reg(cpu, 10, new_brk);
 }
+
+static bool find_mapping_address(const Memory_t *memory, uint32_t hint,
+                                 uint32_t size, uint32_t *addr) {
+  uint32_t low = page_align_up(memory->program_break);
+  uint32_t high = mmap_limit(memory);
+
+  if (hint != 0 && hint % GUEST_PAGE_SIZE == 0 && hint >= low &&
+      hint <= high && high - hint >= size &&
+      memory_range_is_free(memory, hint, size)) {
+    *addr = hint;
+    return true;
+  }
+  return memory_find_free(memory, low, high, size, addr);
+}
+
+// Syscall 222 is mmap2 on 32-bit asm-generic targets: the offset in a5 is in
+// 4096-byte units.
+void handle_sys_mmap(CPU_t *cpu, Memory_t *memory, SyscallState_t *state) {
+  uint32_t hint = read_reg(cpu, 10);
+  uint32_t length = read_reg(cpu, 11);
+  uint32_t prot = read_reg(cpu, 12);
+  uint32_t flags = read_reg(cpu, 13);
+  uint32_t fd = read_reg(cpu, 14);
+  uint64_t offset = (uint64_t)read_reg(cpu, 15) * GUEST_PAGE_SIZE;
+  // Replay recreates a file mapping as anonymous memory that the log fills,
+  // or fails it as the recorded run did.
+  if (!(flags & GUEST_MAP_ANONYMOUS) && state && state->log &&
+      state->log->mode == SYSCALL_LOG_REPLAY) {
+    uint32_t result;
+    if (!syscall_log_peek(state->log, SYSCALL_MMAP, &result))
+      return;
+    if ((int32_t)result < 0) {
+      set_result(cpu, (int32_t)result);
+      return;
+    }
+    flags |= GUEST_MAP_ANONYMOUS;
+  }
+  bool fixed = flags & (GUEST_MAP_FIXED | GUEST_MAP_FIXED_NOREPLACE);
+
+  if (length == 0 || (flags & (GUEST_MAP_SHARED | GUEST_MAP_PRIVATE)) == 0 ||
+      (prot & ~(uint32_t)MEMORY_PROT_MASK) != 0 ||
+      (fixed && hint % GUEST_PAGE_SIZE != 0)) {
+    set_result(cpu, -EINVAL);
+    return;
+  }
+
+  uint32_t size = page_align_up(length);
+  uint32_t addr = hint;
+  if (size == 0) {
+    set_result(cpu, -ENOMEM);
+    return;
+  }
+  if (fixed) {
+    if (!memory_is_page_range(memory, addr, size)) {
+      set_result(cpu, -ENOMEM);
+      return;
+    }
+    if ((flags & GUEST_MAP_FIXED_NOREPLACE) &&
+        !memory_range_is_free(memory, addr, size)) {
+      set_result(cpu, -EEXIST);
+      return;
+    }
+  } else if (!find_mapping_address(memory, hint, size, &addr)) {
+    set_result(cpu, -ENOMEM);
+    return;
+  }
+
+  if (flags & GUEST_MAP_ANONYMOUS) {
+    memory_map_anonymous(memory, addr, size, (uint8_t)prot);
+    set_result(cpu, addr);
+    return;
+  }
+
+  int host = host_fd(state, fd);
+  if (host < 0) {
+    set_result(cpu, -EBADF);
+    return;
+  }
+
+  // Buffered writes must reach the file before it is mapped.
+  sync_fd_output(state, fd);
+  if (!memory_map_file(memory, addr, size, (uint8_t)prot, host, offset,
+                       flags & GUEST_MAP_SHARED)) {
+    set_errno_result(cpu);
+    return;
+  }
+  if (state)
+    syscall_log_output(state->log, addr, size);
+  set_result(cpu, addr);
+}
+
+void handle_sys_munmap(CPU_t *cpu, Memory_t *memory) {
+  uint32_t addr = read_reg(cpu, 10);
+  uint32_t size = page_align_up(read_reg(cpu, 11));
+
+  if (!memory_is_page_range(memory, addr, size)) {
+    set_result(cpu, -EINVAL);
+    return;
+  }
+
+  memory_unmap(memory, addr, size);
+  set_result(cpu, 0);
+}
+
+void handle_sys_mprotect(CPU_t *cpu, Memory_t *memory) {
+  uint32_t addr = read_reg(cpu, 10);
+  uint32_t length = read_reg(cpu, 11);
+  uint32_t prot = read_reg(cpu, 12);
+
+  if (addr % GUEST_PAGE_SIZE != 0 ||
+      (prot & ~(uint32_t)MEMORY_PROT_MASK) != 0) {
+    set_result(cpu, -EINVAL);
+    return;
+  }
+  if (length == 0) {
+    set_result(cpu, 0);
+    return;
+  }
+
+  uint32_t size = page_align_up(length);
+  if (!memory_is_page_range(memory, addr, size)) {
+    set_result(cpu, -ENOMEM);
+    return;
+  }
+
+  memory_protect(memory, addr, size, (uint8_t)prot);
+  set_result(cpu, 0);
+}
+
+void handle_sys_getrandom(CPU_t *cpu, Memory_t *memory,
+                          SyscallState_t *state) {
+  uint32_t buf_addr = read_reg(cpu, 10);
+  uint32_t count = read_reg(cpu, 11);
+  uint32_t flags = read_reg(cpu, 12);
+
+  char *buffer;
+  if (!get_syscall_buffer(memory, buf_addr, count, "getrandom", &buffer)) {
+    set_result(cpu, -EFAULT);
+    return;
+  }
+
+  ssize_t filled = getrandom(buffer, count, flags);
+  if (filled < 0) {
+    set_errno_result(cpu);
+    return;
+  }
+  mark_output(memory, state, buf_addr, (size_t)filled);
+  set_result(cpu, filled);
+}
@@ -0,0 +1,175 @@
+#include "syscall_log.h"
+
+#include "syscall.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SYSCALL_LOG_BUFFER_SIZE (64 * 1024)
+
+bool syscall_log_open(SyscallLog_t *log, const char *path, SyscallLogMode mode,
+                      uint64_t key) {
+  *log = (SyscallLog_t){.mode = mode};
+  log->file = fopen(path, mode == SYSCALL_LOG_RECORD ? "wb" : "rb");
+  if (!log->file) {
+    perror("Error: Failed to open syscall log");
+    return false;
+  }
+  setvbuf(log->file, NULL, _IOFBF, SYSCALL_LOG_BUFFER_SIZE);
+
+  SyscallLogHeader_t header;
+  bool ok;
+  if (mode == SYSCALL_LOG_RECORD) {
+    header = (SyscallLogHeader_t){.magic = SYSCALL_LOG_MAGIC,
+                                  .version = SYSCALL_LOG_VERSION,
+                                  .key = key};
+    ok = fwrite(&header, sizeof(header), 1, log->file) == 1;
+  } else {
+    ok = fread(&header, sizeof(header), 1, log->file) == 1 &&
+         header.magic == SYSCALL_LOG_MAGIC &&
+         header.version == SYSCALL_LOG_VERSION;
+    if (ok && header.key != key) {
+      fprintf(stderr, "Error: Syscall log was recorded for another program\n");
+      fclose(log->file);
+      log->file = NULL;
+      return false;
+    }
+  }
+
+  if (!ok) {
+    fprintf(stderr, "Error: Invalid syscall log: %s\n", path);
+    fclose(log->file);
+    log->file = NULL;
+  }
+  return ok;
+}
+
+bool syscall_log_close(SyscallLog_t *log) {
+  free(log->outputs);
+  log->outputs = NULL;
+  if (!log->file)
+    return true;
+
+  bool ok = !log->failed && !ferror(log->file);
+  if (fclose(log->file) != 0)
+    ok = false;
+  log->file = NULL;
+  if (!ok && log->mode == SYSCALL_LOG_RECORD)
+    fprintf(stderr, "Error: Failed to write syscall log\n");
+  return ok;
+}
+
+bool syscall_log_replaces(const SyscallLog_t *log, uint32_t number) {
+  if (!log || log->mode != SYSCALL_LOG_REPLAY)
+    return false;
+
+  switch (number) {
+  case SYSCALL_OPENAT:
+  case SYSCALL_CLOSE:
+  case SYSCALL_LSEEK:
+  case SYSCALL_READ:
+  case SYSCALL_WRITE:
+  case SYSCALL_READV:
+  case SYSCALL_WRITEV:
+  case SYSCALL_FSTAT:
+  case SYSCALL_FSYNC:
+  case SYSCALL_FDATASYNC:
+  case SYSCALL_CLOCK_GETTIME:
+  case SYSCALL_GETRANDOM:
+  case SYSCALL_CLOCK_GETTIME64:
+    return true;
+  default:
+    return false;
+  }
+}
+
+void syscall_log_output(SyscallLog_t *log, uint32_t addr, size_t size) {
+  if (!log || log->mode != SYSCALL_LOG_RECORD || size == 0)
+    return;
+
+  if (log->output_count == log->output_capacity) {
+    size_t capacity = log->output_capacity ? log->output_capacity * 2 : 16;
+    SyscallLogOutput_t *outputs =
+        realloc(log->outputs, capacity * sizeof(SyscallLogOutput_t));
+    if (!outputs) {
+      fprintf(stderr, "Error: Failed to allocate syscall log outputs\n");
+      log->failed = true;
+      return;
+    }
+    log->outputs = outputs;
+    log->output_capacity = capacity;
+  }
+  log->outputs[log->output_count++] =
+      (SyscallLogOutput_t){.addr = addr, .size = (uint32_t)size};
+}
+
+static void record(SyscallLog_t *log, CPU_t *cpu, Memory_t *memory,
+                   uint32_t number) {
+  SyscallLogRecord_t entry = {.number = number,
+                              .result = read_reg(cpu, 10),
+                              .output_count = (uint32_t)log->output_count};
+  fwrite(&entry, sizeof(entry), 1, log->file);
+  for (size_t i = 0; i < log->output_count; i++) {
+    SyscallLogOutput_t output = log->outputs[i];
+    uint8_t *data;
+    if (!memory_get_pointer(memory, output.addr, output.size, &data))
+      output.size = 0;
+    fwrite(&output, sizeof(output), 1, log->file);
+    fwrite(data, 1, output.size, log->file);
+  }
+  log->output_count = 0;
+}
+
+bool syscall_log_peek(SyscallLog_t *log, uint32_t number, uint32_t *result) {
+  if (!log->has_next &&
+      fread(&log->next, sizeof(log->next), 1, log->file) != 1)
+    return false;
+  log->has_next = true;
+  *result = log->next.result;
+  return log->next.number == number;
+}
+
+static void diverge(SyscallLog_t *log, CPU_t *cpu, const char *reason) {
+  fprintf(stderr, "Error: Replay diverged at syscall %llu: %s\n",
+          (unsigned long long)log->syscalls, reason);
+  cpu->exit_code = 1;
+  cpu->halt = true;
+}
+
+void syscall_log_finish(SyscallLog_t *log, CPU_t *cpu, Memory_t *memory,
+                        uint32_t number, bool executed) {
+  if (!log->file)
+    return;
+  if (log->mode == SYSCALL_LOG_RECORD) {
+    record(log, cpu, memory, number);
+    log->syscalls++;
+    return;
+  }
+
+  uint32_t result;
+  if (!syscall_log_peek(log, number, &result)) {
+    diverge(log, cpu,
+            log->has_next ? "the guest made a different syscall"
+                          : "the log ends");
+    return;
+  }
+  log->has_next = false;
+
+  for (uint32_t i = 0; i < log->next.output_count; i++) {
+    SyscallLogOutput_t output;
+    uint8_t *data;
+    if (fread(&output, sizeof(output), 1, log->file) != 1 ||
+        !memory_get_pointer(memory, output.addr, output.size, &data) ||
+        fread(data, 1, output.size, log->file) != output.size) {
+      diverge(log, cpu, "the log is corrupt");
+      return;
+    }
+    memory_mark_written(memory, output.addr, output.size);
+  }
+
+  if (!executed)
+    write_reg(cpu, 10, result);
+  else if (read_reg(cpu, 10) != result)
+    diverge(log, cpu, "the syscall returned a different result");
+  log->syscalls++;
+}
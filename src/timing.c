@@ -0,0 +1,246 @@
+#include "timing.h"
+
+#include "opcodes.h"
+#include "utils.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+void timing_default_config(TimingConfig_t *config) {
+  config->predictor = TIMING_PREDICT_GSHARE;
+  config->entries = 1024;
+  config->history_bits = 10;
+  config->mul_latency = 3;
+  config->div_latency = 34;
+  config->load_use = 1;
+  config->taken = 1;
+  config->mispredict = 3;
+}
+
+static bool parse_predictor(const char *text, size_t length,
+                            TimingPredictor *predictor) {
+  static const struct {
+    const char *name;
+    TimingPredictor predictor;
+  } names[] = {
+      {"not-taken", TIMING_PREDICT_NOT_TAKEN},
+      {"bimodal", TIMING_PREDICT_BIMODAL},
+      {"gshare", TIMING_PREDICT_GSHARE},
+  };
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (strlen(names[i].name) == length &&
+        strncmp(text, names[i].name, length) == 0) {
+      *predictor = names[i].predictor;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool parse_value(const char *text, size_t length, uint32_t *value) {
+  if (length == 0 || length > 9)
+    return false;
+  uint32_t parsed = 0;
+  for (size_t i = 0; i < length; i++) {
+    if (text[i] < '0' || text[i] > '9')
+      return false;
+    parsed = parsed * 10 + (uint32_t)(text[i] - '0');
+  }
+  *value = parsed;
+  return true;
+}
+
+static bool parse_pair(const char *key, size_t key_length, const char *value,
+                       size_t value_length, TimingConfig_t *config) {
+  if (key_length == 9 && strncmp(key, "predictor", 9) == 0)
+    return parse_predictor(value, value_length, &config->predictor);
+
+  static const struct {
+    const char *key;
+    size_t offset;
+  } counts[] = {
+      {"entries", offsetof(TimingConfig_t, entries)},
+      {"history", offsetof(TimingConfig_t, history_bits)},
+      {"mul", offsetof(TimingConfig_t, mul_latency)},
+      {"div", offsetof(TimingConfig_t, div_latency)},
+      {"load-use", offsetof(TimingConfig_t, load_use)},
+      {"taken", offsetof(TimingConfig_t, taken)},
+      {"mispredict", offsetof(TimingConfig_t, mispredict)},
+  };
+  for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    if (strlen(counts[i].key) == key_length &&
+        strncmp(key, counts[i].key, key_length) == 0)
+      return parse_value(value, value_length,
+                         (uint32_t *)((char *)config + counts[i].offset));
+  }
+  return false;
+}
+
+static bool valid_config(const TimingConfig_t *config) {
+  return config->entries != 0 &&
+         (config->entries & (config->entries - 1)) == 0 &&
+         config->history_bits <= 31 && config->mul_latency >= 1 &&
+         config->div_latency >= 1;
+}
+
+bool timing_parse(const char *spec, TimingConfig_t *config) {
+  TimingConfig_t parsed = *config;
+  const char *p = spec;
+  bool valid = true;
+  while (valid && *p) {
+    const char *comma = strchr(p, ',');
+    size_t length = comma ? (size_t)(comma - p) : strlen(p);
+    const char *equals = memchr(p, '=', length);
+    valid = equals != NULL &&
+            parse_pair(p, (size_t)(equals - p), equals + 1,
+                       length - (size_t)(equals - p) - 1, &parsed);
+    p = comma ? comma + 1 : p + length;
+  }
+  if (!valid || !valid_config(&parsed)) {
+    fprintf(stderr, "Error: Invalid timing model: %s\n", spec);
+    return false;
+  }
+  *config = parsed;
+  return true;
+}
+
+bool init_timing(Timing_t *timing, const TimingConfig_t *config) {
+  memset(timing, 0, sizeof(*timing));
+  timing->config = *config;
+  // Counters start weakly not-taken.
+  timing->counters = (uint8_t *)malloc(config->entries);
+  if (!timing->counters) {
+    fprintf(stderr, "Error: Failed to allocate branch predictor\n");
+    return false;
+  }
+  memset(timing->counters, 1, config->entries);
+  return true;
+}
+
+void free_timing(Timing_t *timing) {
+  free(timing->counters);
+  timing->counters = NULL;
+}
+
+static uint8_t *counter(Timing_t *timing, uint32_t pc) {
+  uint32_t index = pc >> 1;
+  if (timing->config.predictor == TIMING_PREDICT_GSHARE)
+    index ^= timing->history;
+  return &timing->counters[index & (timing->config.entries - 1)];
+}
+
+static bool predict(Timing_t *timing, uint32_t pc, bool taken) {
+  if (timing->config.predictor == TIMING_PREDICT_NOT_TAKEN)
+    return !taken;
+
+  uint8_t *state = counter(timing, pc);
+  bool correct = (*state >= 2) == taken;
+  if (taken && *state < 3)
+    (*state)++;
+  else if (!taken && *state > 0)
+    (*state)--;
+  uint32_t history_mask = (1u << timing->config.history_bits) - 1;
+  timing->history = ((timing->history << 1) | taken) & history_mask;
+  return correct;
+}
+
+void timing_branch(Timing_t *timing, uint32_t pc, bool conditional,
+                   bool taken, bool indirect) {
+  uint32_t penalty = 0;
+  if (conditional) {
+    timing->branches++;
+    if (!predict(timing, pc, taken)) {
+      timing->mispredicts++;
+      penalty = timing->config.mispredict;
+    } else if (taken) {
+      penalty = timing->config.taken;
+    }
+  } else {
+    timing->jumps++;
+    penalty = indirect ? timing->config.mispredict : timing->config.taken;
+  }
+  timing->redirect_cycles += penalty;
+  timing->cycles += penalty;
+}
+
+// Returns a bit per source register read, bit 0 for rs1 and bit 1 for rs2.
+static unsigned sources(uint32_t inst) {
+  switch (get_opcode(inst)) {
+  case OPCODE_JALR:
+  case OPCODE_LOAD:
+  case OPCODE_OP_IMM:
+    return 1;
+  case OPCODE_BRANCH:
+  case OPCODE_STORE:
+  case OPCODE_OP:
+    return 3;
+  default:
+    return 0;
+  }
+}
+
+void timing_retire(Timing_t *timing, uint32_t inst) {
+  uint64_t cycles = 1;
+  unsigned read = sources(inst);
+  uint32_t load_rd = timing->load_rd;
+  if (load_rd != 0 && (((read & 1) && get_rs1(inst) == load_rd) ||
+                       ((read & 2) && get_rs2(inst) == load_rd))) {
+    cycles += timing->config.load_use;
+    timing->load_use_stalls++;
+  }
+
+  uint8_t opcode = get_opcode(inst);
+  if (opcode == OPCODE_OP && get_funct7(inst) == 0b0000001) {
+    uint32_t latency = get_funct3(inst) < 0b100 ? timing->config.mul_latency
+                                                : timing->config.div_latency;
+    cycles += latency - 1;
+    timing->muldiv_cycles += latency - 1;
+  }
+
+  timing->load_rd = opcode == OPCODE_LOAD ? get_rd(inst) : 0;
+  timing->cycles += cycles;
+  timing->instructions++;
+}
+
+static const char *predictor_name(TimingPredictor predictor) {
+  switch (predictor) {
+  case TIMING_PREDICT_NOT_TAKEN:
+    return "not-taken";
+  case TIMING_PREDICT_BIMODAL:
+    return "bimodal";
+  case TIMING_PREDICT_GSHARE:
+    return "gshare";
+  }
+  return "unknown";
+}
+
+void timing_report(const Timing_t *timing, FILE *out) {
+  const TimingConfig_t *config = &timing->config;
+  double ipc = timing->cycles
+                   ? (double)timing->instructions / (double)timing->cycles
+                   : 0.0;
+  double mispredict_rate =
+      timing->branches
+          ? 100.0 * (double)timing->mispredicts / (double)timing->branches
+          : 0.0;
+  fprintf(out, "Timing model (%s predictor, %u entries)\n",
+          predictor_name(config->predictor), config->entries);
+  fprintf(out, "  instructions      %14llu\n",
+          (unsigned long long)timing->instructions);
+  fprintf(out, "  cycles            %14llu\n",
+          (unsigned long long)timing->cycles);
+  fprintf(out, "  IPC               %14.3f\n", ipc);
+  fprintf(out, "  mul/div cycles    %14llu\n",
+          (unsigned long long)timing->muldiv_cycles);
+  fprintf(out, "  load-use stalls   %14llu  (%u cycles each)\n",
+          (unsigned long long)timing->load_use_stalls, config->load_use);
+  fprintf(out, "  branches          %14llu\n",
+          (unsigned long long)timing->branches);
+  fprintf(out, "  mispredicts       %14llu  (%.2f%%)\n",
+          (unsigned long long)timing->mispredicts, mispredict_rate);
+  fprintf(out, "  jumps             %14llu\n",
+          (unsigned long long)timing->jumps);
+  fprintf(out, "  redirect cycles   %14llu\n",
+          (unsigned long long)timing->redirect_cycles);
+}
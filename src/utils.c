@@ -99,3 +99,12 @@ uint32_t build_j_type(uint32_t opcode, uint32_t rd, int32_t imm) {
 }
 
 bool is_compressed(uint16_t half) { return (half & 0b11) != 0b11; }
+
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t size) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
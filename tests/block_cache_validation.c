@@ -0,0 +1,566 @@
+#include "block_cache.h"
+#include "coverage.h"
+#include "cpu.h"
+#include "emulator.h"
+#include "memory.h"
+#include "opcodes.h"
+#include "rv_context.h"
+#include "utils.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FUNCTION_ADDR 0x40
+#define CACHE_FILE "/tmp/riscv-block-cache-validation.blocks"
+
+static bool write_program(Memory_t *memory, const uint32_t *program,
+                          size_t count, uint32_t addr) {
+  for (size_t i = 0; i < count; i++) {
+    if (!write_word(memory, addr + (uint32_t)(i * 4), program[i]))
+      return false;
+  }
+  return true;
+}
+
+// Calls the function at FUNCTION_ADDR four times through `call_inst`, which
+// must link through ra, then exits with the value the function accumulated.
+// The first call is reached by falling into the call site and later calls by
+// the loop branch, so two blocks end in the call and each misses once.
+static bool run_calls(uint32_t call_inst, BlockCacheStats_t *stats) {
+  const uint32_t program[] = {
+      build_i_type(OPCODE_OP_IMM, 8, 0b000, 0, 4),
+      build_i_type(OPCODE_OP_IMM, 6, 0b000, 0, FUNCTION_ADDR),
+      call_inst,
+      build_i_type(OPCODE_OP_IMM, 8, 0b000, 8, -1),
+      build_b_type(OPCODE_BRANCH, 0b001, 8, 0, -8),
+      build_i_type(OPCODE_OP_IMM, 17, 0b000, 0, 93),
+      build_i_type(OPCODE_SYSTEM, 0, 0b000, 0, 0),
+  };
+  const uint32_t function[] = {
+      build_i_type(OPCODE_OP_IMM, 10, 0b000, 10, 1),
+      build_i_type(OPCODE_JALR, 0, 0b000, 1, 0),
+  };
+
+  CPU_t cpu;
+  init_cpu(&cpu);
+  Memory_t memory;
+  if (!init_memory(&memory, 256))
+    return false;
+  BlockCache_t blocks;
+  if (!init_block_cache(&blocks)) {
+    free_memory(&memory);
+    return false;
+  }
+
+  bool passed = write_program(&memory, program, 7, 0) &&
+                write_program(&memory, function, 2, FUNCTION_ADDR);
+  if (passed) {
+    RvContext_t context = {.cpu = &cpu, .memory = &memory, .blocks = &blocks};
+    rv_run(&context);
+    passed = cpu.halt && cpu.exit_code == 4;
+    *stats = blocks.stats;
+  }
+
+  free_block_cache(&blocks);
+  free_memory(&memory);
+  return passed;
+}
+
+static bool test_direct_call_returns(void) {
+  BlockCacheStats_t stats;
+  uint32_t call = build_j_type(OPCODE_JAL, 1, FUNCTION_ADDR - 8);
+  return run_calls(call, &stats) && stats.return_hits == 2 &&
+         stats.return_misses == 2 && stats.indirect_misses == 0;
+}
+
+static bool test_indirect_call_targets(void) {
+  BlockCacheStats_t stats;
+  uint32_t call = build_i_type(OPCODE_JALR, 1, 0b000, 6, 0);
+  return run_calls(call, &stats) && stats.indirect_hits == 2 &&
+         stats.indirect_misses == 2 && stats.return_hits == 2;
+}
+
+static bool test_matches_interpreter(void) {
+  const uint32_t program[] = {
+      build_i_type(OPCODE_OP_IMM, 5, 0b000, 0, 10),
+      build_r_type(OPCODE_OP, 6, 0b000, 6, 5, 0),
+      build_i_type(OPCODE_OP_IMM, 5, 0b000, 5, -1),
+      build_b_type(OPCODE_BRANCH, 0b001, 5, 0, -8),
+      build_i_type(OPCODE_SYSTEM, 0, 0b000, 0, 1),
+  };
+
+  CPU_t interp_cpu;
+  CPU_t block_cpu;
+  Memory_t interp_memory;
+  Memory_t block_memory;
+  BlockCache_t blocks;
+  init_cpu(&interp_cpu);
+  init_cpu(&block_cpu);
+  if (!init_memory(&interp_memory, 64))
+    return false;
+  if (!init_memory(&block_memory, 64)) {
+    free_memory(&interp_memory);
+    return false;
+  }
+  if (!init_block_cache(&blocks)) {
+    free_memory(&interp_memory);
+    free_memory(&block_memory);
+    return false;
+  }
+
+  bool passed = write_program(&interp_memory, program, 5, 0) &&
+                write_program(&block_memory, program, 5, 0);
+  if (passed) {
+    RvContext_t interp = {.cpu = &interp_cpu, .memory = &interp_memory};
+    RvContext_t block = {
+        .cpu = &block_cpu, .memory = &block_memory, .blocks = &blocks};
+    rv_run(&interp);
+    rv_run(&block);
+    passed = interp_cpu.pc == block_cpu.pc && interp_cpu.pc == 16 &&
+             read_reg(&block_cpu, 6) == 55 &&
+             read_reg(&interp_cpu, 6) == read_reg(&block_cpu, 6);
+  }
+
+  free_block_cache(&blocks);
+  free_memory(&interp_memory);
+  free_memory(&block_memory);
+  return passed;
+}
+
+// Runs a countdown loop from `count` on a cache preloaded from CACHE_FILE,
+// then saves the cache back under `key`.
+static bool run_cached(int32_t count, uint64_t key,
+                       BlockCacheStats_t *stats) {
+  const uint32_t program[] = {
+      build_i_type(OPCODE_OP_IMM, 5, 0b000, 0, count),
+      build_r_type(OPCODE_OP, 6, 0b000, 6, 5, 0),
+      build_i_type(OPCODE_OP_IMM, 5, 0b000, 5, -1),
+      build_b_type(OPCODE_BRANCH, 0b001, 5, 0, -8),
+      build_i_type(OPCODE_SYSTEM, 0, 0b000, 0, 1),
+  };
+
+  CPU_t cpu;
+  init_cpu(&cpu);
+  Memory_t memory;
+  if (!init_memory(&memory, 64))
+    return false;
+  BlockCache_t blocks;
+  if (!init_block_cache(&blocks)) {
+    free_memory(&memory);
+    return false;
+  }
+
+  bool passed = write_program(&memory, program, 5, 0);
+  if (passed) {
+    block_cache_load(&blocks, &memory, CACHE_FILE, key);
+    RvContext_t context = {.cpu = &cpu, .memory = &memory, .blocks = &blocks};
+    rv_run(&context);
+    passed = cpu.pc == 16 &&
+             read_reg(&cpu, 6) == (uint32_t)(count * (count + 1) / 2) &&
+             block_cache_save(&blocks, &memory, CACHE_FILE, key);
+    *stats = blocks.stats;
+  }
+
+  free_block_cache(&blocks);
+  free_memory(&memory);
+  return passed;
+}
+
+// The loop builds three blocks: the entry block, the loop body reached by
+// the branch, and the final EBREAK.
+static bool test_saved_blocks_reload(void) {
+  BlockCacheStats_t cold;
+  BlockCacheStats_t warm;
+  BlockCacheStats_t changed;
+  BlockCacheStats_t other_key;
+
+  unlink(CACHE_FILE);
+  bool passed =
+      run_cached(10, 1, &cold) && cold.loaded == 0 && cold.builds == 3 &&
+      run_cached(10, 1, &warm) && warm.loaded == 3 && warm.builds == 0 &&
+      // Only the entry block holds the changed immediate.
+      run_cached(5, 1, &changed) && changed.loaded == 2 &&
+      changed.builds == 1 && run_cached(5, 2, &other_key) &&
+      other_key.loaded == 0 && other_key.builds == 3;
+  unlink(CACHE_FILE);
+  return passed;
+}
+
+// The loop block is promoted after two runs; the rest of the loop must
+// leave the same state as the interpreter.
+static bool test_optimized_tier_matches_interpreter(void) {
+  const uint32_t program[] = {
+      build_u_type(OPCODE_LUI, 5, 0x12345000),
+      build_i_type(OPCODE_OP_IMM, 5, 0b000, 5, 0x678),
+      build_i_type(OPCODE_OP_IMM, 0, 0b000, 5, 1),
+      build_i_type(OPCODE_OP_IMM, 6, 0b000, 0, 0),
+      // Loop at 16: every write below but the dead a2 = 7 must land.
+      build_i_type(OPCODE_OP_IMM, 10, 0b000, 10, 3),
+      build_r_type(OPCODE_OP, 11, 0b100, 10, 5, 0),
+      build_i_type(OPCODE_OP_IMM, 12, 0b000, 0, 7),
+      build_i_type(OPCODE_OP_IMM, 12, 0b000, 11, 1),
+      build_i_type(OPCODE_LOAD, 13, 0b010, 0, 4),
+      build_i_type(OPCODE_OP_IMM, 6, 0b000, 6, 1),
+      build_i_type(OPCODE_OP_IMM, 7, 0b010, 6, 20),
+      build_b_type(OPCODE_BRANCH, 0b001, 7, 0, -28),
+      build_i_type(OPCODE_SYSTEM, 0, 0b000, 0, 1),
+  };
+  size_t count = sizeof(program) / sizeof(program[0]);
+  CPU_t interp_cpu;
+  CPU_t block_cpu;
+  Memory_t interp_memory;
+  Memory_t block_memory;
+  BlockCache_t blocks;
+  init_cpu(&interp_cpu);
+  init_cpu(&block_cpu);
+  if (!init_memory(&interp_memory, 128))
+    return false;
+  if (!init_memory(&block_memory, 128)) {
+    free_memory(&interp_memory);
+    return false;
+  }
+  if (!init_block_cache(&blocks)) {
+    free_memory(&interp_memory);
+    free_memory(&block_memory);
+    return false;
+  }
+  blocks.hot_threshold = 2;
+
+  bool passed = write_program(&interp_memory, program, count, 0) &&
+                write_program(&block_memory, program, count, 0);
+  if (passed) {
+    RvContext_t interp = {.cpu = &interp_cpu, .memory = &interp_memory};
+    RvContext_t block = {
+        .cpu = &block_cpu, .memory = &block_memory, .blocks = &blocks};
+    rv_run(&interp);
+    rv_run(&block);
+    passed = blocks.stats.optimized == 1 && interp_cpu.pc == 48 &&
+             block_cpu.pc == interp_cpu.pc && read_reg(&block_cpu, 10) == 60 &&
+             memcmp(interp_cpu.regs, block_cpu.regs, sizeof(block_cpu.regs)) ==
+                 0;
+  }
+
+  free_block_cache(&blocks);
+  free_memory(&interp_memory);
+  free_memory(&block_memory);
+  return passed;
+}
+
+#define LOOP_MEMORY_SIZE 1024
+
+// Runs four loops, each promoted after its first iteration: a byte copy, a
+// sign-extending halfword copy counted down, a word fill and an overlapping
+// byte copy that stays on the guest until only its last element is left,
+// which overlaps nothing. Returns the guest memory in
+// `image` and the final state in `cpu` and `result`.
+static bool run_loops(bool use_blocks, uint64_t instruction_limit, CPU_t *cpu,
+                      uint8_t *image, RvContext_t *result,
+                      BlockCacheStats_t *stats) {
+  const uint32_t program[] = {
+      build_i_type(OPCODE_OP_IMM, 11, 0b000, 0, 0x200),
+      build_i_type(OPCODE_OP_IMM, 10, 0b000, 0, 0x300),
+      build_i_type(OPCODE_OP_IMM, 12, 0b000, 0, 0x264),
+      build_i_type(OPCODE_LOAD, 5, 0b100, 11, 0),
+      build_s_type(OPCODE_STORE, 0b000, 10, 5, 0),
+      build_i_type(OPCODE_OP_IMM, 11, 0b000, 11, 1),
+      build_i_type(OPCODE_OP_IMM, 10, 0b000, 10, 1),
+      build_b_type(OPCODE_BRANCH, 0b001, 11, 12, -16),
+      build_i_type(OPCODE_OP_IMM, 11, 0b000, 0, 0x200),
+      build_i_type(OPCODE_OP_IMM, 10, 0b000, 0, 0x380),
+      build_i_type(OPCODE_OP_IMM, 13, 0b000, 0, 20),
+      build_i_type(OPCODE_LOAD, 6, 0b001, 11, 0),
+      build_i_type(OPCODE_OP_IMM, 11, 0b000, 11, 2),
+      build_s_type(OPCODE_STORE, 0b001, 10, 6, 0),
+      build_i_type(OPCODE_OP_IMM, 10, 0b000, 10, 2),
+      build_i_type(OPCODE_OP_IMM, 13, 0b000, 13, -1),
+      build_b_type(OPCODE_BRANCH, 0b001, 13, 0, -20),
+      build_u_type(OPCODE_LUI, 7, 0x11223000),
+      build_i_type(OPCODE_OP_IMM, 7, 0b000, 7, 0x344),
+      build_i_type(OPCODE_OP_IMM, 10, 0b000, 0, 0x3c0),
+      build_i_type(OPCODE_OP_IMM, 12, 0b000, 0, 0x3f0),
+      build_s_type(OPCODE_STORE, 0b010, 10, 7, 0),
+      build_i_type(OPCODE_OP_IMM, 10, 0b000, 10, 4),
+      build_b_type(OPCODE_BRANCH, 0b001, 10, 12, -8),
+      build_i_type(OPCODE_OP_IMM, 11, 0b000, 0, 0x200),
+      build_i_type(OPCODE_OP_IMM, 10, 0b000, 0, 0x201),
+      build_i_type(OPCODE_OP_IMM, 12, 0b000, 0, 0x240),
+      build_i_type(OPCODE_LOAD, 5, 0b100, 11, 0),
+      build_s_type(OPCODE_STORE, 0b000, 10, 5, 0),
+      build_i_type(OPCODE_OP_IMM, 11, 0b000, 11, 1),
+      build_i_type(OPCODE_OP_IMM, 10, 0b000, 10, 1),
+      build_b_type(OPCODE_BRANCH, 0b001, 10, 12, -16),
+      build_i_type(OPCODE_SYSTEM, 0, 0b000, 0, 1),
+  };
+
+  init_cpu(cpu);
+  Memory_t memory;
+  if (!init_memory(&memory, LOOP_MEMORY_SIZE))
+    return false;
+  BlockCache_t blocks;
+  if (!init_block_cache(&blocks)) {
+    free_memory(&memory);
+    return false;
+  }
+  blocks.hot_threshold = 1;
+
+  bool passed = write_program(&memory, program,
+                              sizeof(program) / sizeof(program[0]), 0);
+  for (uint32_t i = 0; passed && i < 0x80; i++)
+    passed = write_byte(&memory, 0x200 + i, (uint8_t)(i * 7 + 0x81));
+  uint8_t *host;
+  if (passed) {
+    RvContext_t context = {.cpu = cpu,
+                           .memory = &memory,
+                           .blocks = use_blocks ? &blocks : NULL,
+                           .instruction_limit = instruction_limit};
+    rv_run(&context);
+    *result = context;
+    *stats = blocks.stats;
+    passed = memory_get_pointer(&memory, 0, LOOP_MEMORY_SIZE, &host);
+    if (passed)
+      memcpy(image, host, LOOP_MEMORY_SIZE);
+  }
+
+  free_block_cache(&blocks);
+  free_memory(&memory);
+  return passed;
+}
+
+// Copy and fill loops run on the host must leave the interpreter's state,
+// also when the budget ends in the middle of one.
+static bool test_loop_idioms_match_interpreter(void) {
+  static uint8_t interp_image[LOOP_MEMORY_SIZE];
+  static uint8_t block_image[LOOP_MEMORY_SIZE];
+  CPU_t interp_cpu;
+  CPU_t block_cpu;
+  RvContext_t interp;
+  RvContext_t block;
+  BlockCacheStats_t stats;
+  bool passed = true;
+
+  const uint64_t limits[] = {0, 200, 600, 900};
+  for (size_t i = 0; passed && i < sizeof(limits) / sizeof(limits[0]); i++) {
+    passed =
+        run_loops(false, limits[i], &interp_cpu, interp_image, &interp,
+                  &stats) &&
+        run_loops(true, limits[i], &block_cpu, block_image, &block, &stats) &&
+        interp_cpu.pc == block_cpu.pc &&
+        interp.instructions_retired == block.instructions_retired &&
+        memcmp(interp_cpu.regs, block_cpu.regs, sizeof(block_cpu.regs)) ==
+            0 &&
+        memcmp(interp_image, block_image, LOOP_MEMORY_SIZE) == 0;
+    if (passed && limits[i] == 0) {
+      passed = block_cpu.pc == 128 && stats.loops == 4 &&
+               stats.loop_runs == 4 && block_image[0x3c0] == 0x44 &&
+               read_reg(&block_cpu, 6) == (uint32_t)(int16_t)0x928b;
+    }
+  }
+  return passed;
+}
+
+// Runs an endless loop under the given limits, on predecoded blocks or on
+// the interpreter.
+static bool run_limited(const uint32_t *program, size_t count,
+                        bool use_blocks, uint64_t instruction_limit,
+                        uint64_t deadline_ms, CPU_t *cpu,
+                        RvContext_t *result) {
+  init_cpu(cpu);
+  Memory_t memory;
+  if (!init_memory(&memory, 64))
+    return false;
+  BlockCache_t blocks;
+  if (!init_block_cache(&blocks)) {
+    free_memory(&memory);
+    return false;
+  }
+
+  bool passed = write_program(&memory, program, count, 0);
+  if (passed) {
+    RvContext_t context = {.cpu = cpu,
+                           .memory = &memory,
+                           .blocks = use_blocks ? &blocks : NULL,
+                           .instruction_limit = instruction_limit};
+    passed = deadline_ms == 0 || rv_set_deadline(&context, deadline_ms);
+    if (passed) {
+      rv_run(&context);
+      if (context.deadline_expired)
+        rv_clear_deadline(&context);
+    }
+    *result = context;
+  }
+
+  free_block_cache(&blocks);
+  free_memory(&memory);
+  return passed;
+}
+
+// Runs `program` on both engines until the budget ends it.
+static bool run_both_limited(const uint32_t *program, size_t count,
+                             uint64_t instruction_limit, CPU_t *interp_cpu,
+                             CPU_t *block_cpu) {
+  RvContext_t interp;
+  RvContext_t block;
+  return run_limited(program, count, false, instruction_limit, 0, interp_cpu,
+                     &interp) &&
+         interp.stop_reason == RV_STOP_BUDGET &&
+         interp.instructions_retired == instruction_limit &&
+         run_limited(program, count, true, instruction_limit, 0, block_cpu,
+                     &block) &&
+         block.stop_reason == RV_STOP_BUDGET &&
+         block.instructions_retired == instruction_limit &&
+         interp_cpu->pc == block_cpu->pc &&
+         memcmp(interp_cpu->regs, block_cpu->regs, sizeof(block_cpu->regs)) ==
+             0;
+}
+
+// The budget ends the run partway through a block, at the same instruction
+// on both engines, also when blocks leave early after a store into their
+// own code and are charged only what they ran.
+static bool test_limits_stop_runs(void) {
+  const uint32_t counting_loop[] = {
+      build_i_type(OPCODE_OP_IMM, 5, 0b000, 5, 1),
+      build_i_type(OPCODE_OP_IMM, 6, 0b000, 6, 1),
+      build_j_type(OPCODE_JAL, 0, -8),
+  };
+  // Rewrites its fourth instruction with itself, so its block leaves after
+  // the store.
+  const uint32_t self_modifying_loop[] = {
+      build_i_type(OPCODE_LOAD, 7, 0b010, 0, 12),
+      build_s_type(OPCODE_STORE, 0b010, 0, 7, 12),
+      build_i_type(OPCODE_OP_IMM, 5, 0b000, 5, 1),
+      build_i_type(OPCODE_OP_IMM, 6, 0b000, 6, 1),
+      build_j_type(OPCODE_JAL, 0, -16),
+  };
+  CPU_t interp_cpu;
+  CPU_t block_cpu;
+  CPU_t deadline_cpu;
+  RvContext_t deadline;
+
+  return run_both_limited(counting_loop, 3, 1001, &interp_cpu, &block_cpu) &&
+         block_cpu.pc == 8 && read_reg(&block_cpu, 5) == 334 &&
+         run_both_limited(self_modifying_loop, 5, 1001, &interp_cpu,
+                          &block_cpu) &&
+         block_cpu.pc == 4 && read_reg(&block_cpu, 5) == 200 &&
+         run_limited(counting_loop, 3, true, 0, 20, &deadline_cpu,
+                     &deadline) &&
+         deadline.stop_reason == RV_STOP_DEADLINE &&
+         deadline.deadline_expired == NULL && deadline_cpu.exit_code == 0;
+}
+
+// A counter on its own page is bumped once per run; resetting to the
+// baseline restores just that page, so every run sees the same start value.
+static bool test_reset_to_baseline(void) {
+  const uint32_t program[] = {
+      build_u_type(OPCODE_LUI, 5, 0x1000),
+      build_i_type(OPCODE_LOAD, 10, 0b010, 5, 0),
+      build_i_type(OPCODE_OP_IMM, 10, 0b000, 10, 1),
+      build_s_type(OPCODE_STORE, 0b010, 5, 10, 0),
+      build_i_type(OPCODE_OP_IMM, 17, 0b000, 0, 93),
+      build_i_type(OPCODE_SYSTEM, 0, 0b000, 0, 0),
+  };
+
+  CPU_t cpu;
+  init_cpu(&cpu);
+  Memory_t memory;
+  if (!init_memory(&memory, 4 * GUEST_PAGE_SIZE))
+    return false;
+  BlockCache_t blocks;
+  if (!init_block_cache(&blocks)) {
+    free_memory(&memory);
+    return false;
+  }
+
+  bool passed = write_program(&memory, program, 6, 0) &&
+                write_word(&memory, 0x1000, 41) &&
+                memory_capture_baseline(&memory);
+  CPU_t initial = cpu;
+  RvContext_t context = {.cpu = &cpu, .memory = &memory, .blocks = &blocks};
+  for (int run = 0; passed && run < 3; run++) {
+    cpu = initial;
+    rv_run(&context);
+    passed = cpu.exit_code == 42 && memory.dirty_count == 1;
+    memory_reset_to_baseline(&memory);
+    passed = passed && memory.dirty_count == 0;
+  }
+  passed = passed && blocks.stats.builds == 1 &&
+           blocks.stats.invalidations == 0;
+
+  free_block_cache(&blocks);
+  free_memory(&memory);
+  return passed;
+}
+
+// Counts the edges recorded for a three-iteration loop: one per branch on
+// the interpreter, one per block entered on predecoded blocks.
+static bool count_edges(bool use_blocks, uint32_t *edges) {
+  const uint32_t program[] = {
+      build_i_type(OPCODE_OP_IMM, 5, 0b000, 0, 3),
+      build_i_type(OPCODE_OP_IMM, 5, 0b000, 5, -1),
+      build_b_type(OPCODE_BRANCH, 0b001, 5, 0, -4),
+      build_i_type(OPCODE_OP_IMM, 17, 0b000, 0, 93),
+      build_i_type(OPCODE_SYSTEM, 0, 0b000, 0, 0),
+  };
+
+  CPU_t cpu;
+  init_cpu(&cpu);
+  Memory_t memory;
+  if (!init_memory(&memory, 64))
+    return false;
+  BlockCache_t blocks;
+  if (!init_block_cache(&blocks)) {
+    free_memory(&memory);
+    return false;
+  }
+  Coverage_t coverage;
+  if (!init_coverage(&coverage)) {
+    free_block_cache(&blocks);
+    free_memory(&memory);
+    return false;
+  }
+
+  bool passed = write_program(&memory, program, 5, 0);
+  if (passed) {
+    RvContext_t context = {.cpu = &cpu,
+                           .memory = &memory,
+                           .blocks = use_blocks ? &blocks : NULL,
+                           .coverage = &coverage};
+    rv_run(&context);
+    passed = cpu.halt && cpu.exit_code == 0;
+    *edges = 0;
+    for (uint32_t i = 0; i < COVERAGE_MAP_SIZE; i++)
+      *edges += coverage.map[i];
+  }
+
+  free_coverage(&coverage);
+  free_block_cache(&blocks);
+  free_memory(&memory);
+  return passed;
+}
+
+static bool test_coverage_edges(void) {
+  uint32_t interp_edges;
+  uint32_t block_edges;
+  return count_edges(false, &interp_edges) && interp_edges == 3 &&
+         count_edges(true, &block_edges) && block_edges == 4;
+}
+
+int main(void) {
+  bool passed = test_direct_call_returns() && test_indirect_call_targets() &&
+                test_matches_interpreter() && test_saved_blocks_reload() &&
+                test_optimized_tier_matches_interpreter() &&
+                test_loop_idioms_match_interpreter() &&
+                test_limits_stop_runs() && test_reset_to_baseline() &&
+                test_coverage_edges();
+
+  if (!passed) {
+    fprintf(stderr, "FAIL  block_cache_validation\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("PASS  block_cache_validation\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,121 @@
+#include "cache_sim.h"
+#include "cpu.h"
+#include "emulator.h"
+#include "memory.h"
+#include "opcodes.h"
+#include "rv_context.h"
+#include "utils.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static const CacheSimEntry_t *find(const CacheSimTable_t *table,
+                                   uint32_t key) {
+  for (size_t i = 0; i <= table->mask; i++) {
+    if (table->entries[i].used && table->entries[i].key == key)
+      return &table->entries[i];
+  }
+  return NULL;
+}
+
+static bool test_parse(void) {
+  CacheConfig_t configs[CACHE_LEVELS];
+  cache_sim_default_config(configs);
+  return cache_sim_parse("l1d=8k:2:64,l2=1m:16:64", configs) &&
+         configs[CACHE_L1D].size == 8192 && configs[CACHE_L1D].ways == 2 &&
+         configs[CACHE_L1D].line == 64 && configs[CACHE_L2].size == 1 << 20 &&
+         configs[CACHE_L1I].size == 16 * 1024 &&
+         !cache_sim_parse("l1d=8k:3:64", configs) &&
+         !cache_sim_parse("l3=8k:2:64", configs) &&
+         !cache_sim_parse("l1i=8k:2", configs);
+}
+
+// Two sets of two ways: lines 0, 64 and 128 share set 0, so touching 128
+// evicts whichever of the others was used least recently.
+static bool test_lru(void) {
+  CacheConfig_t configs[CACHE_LEVELS];
+  cache_sim_default_config(configs);
+  configs[CACHE_L1D] = (CacheConfig_t){128, 2, 32};
+  CacheSim_t sim;
+  if (!init_cache_sim(&sim, configs, NULL))
+    return false;
+
+  const uint32_t addrs[] = {0, 64, 0, 128, 0, 64};
+  for (size_t i = 0; i < sizeof(addrs) / sizeof(addrs[0]); i++)
+    cache_sim_access(&sim, addrs[i], 4, MEMORY_PROT_READ);
+  const CacheLevel_t *l1d = &sim.levels[CACHE_L1D];
+  const CacheLevel_t *l2 = &sim.levels[CACHE_L2];
+  bool passed = l1d->hits == 2 && l1d->misses == 4 && l2->hits == 1 &&
+                l2->misses == 3;
+
+  // A word straddling two lines touches both.
+  cache_sim_access(&sim, 30, 4, MEMORY_PROT_WRITE);
+  passed = passed && l1d->hits == 3 && l1d->misses == 5;
+
+  free_cache_sim(&sim);
+  return passed;
+}
+
+// Runs a three-iteration loop around one load on the interpreter: the load
+// misses once and its data is charged to its pc and page.
+static bool test_attribution(void) {
+  const uint32_t program[] = {
+      build_i_type(OPCODE_OP_IMM, 5, 0b000, 0, 3),
+      build_i_type(OPCODE_LOAD, 6, 0b010, 0, 0x100),
+      build_i_type(OPCODE_OP_IMM, 5, 0b000, 5, -1),
+      build_b_type(OPCODE_BRANCH, 0b001, 5, 0, -8),
+      build_i_type(OPCODE_OP_IMM, 17, 0b000, 0, 93),
+      build_i_type(OPCODE_SYSTEM, 0, 0b000, 0, 0),
+  };
+
+  CPU_t cpu;
+  init_cpu(&cpu);
+  Memory_t memory;
+  if (!init_memory(&memory, 512))
+    return false;
+  CacheConfig_t configs[CACHE_LEVELS];
+  cache_sim_default_config(configs);
+  CacheSim_t sim;
+  if (!init_cache_sim(&sim, configs, &cpu)) {
+    free_memory(&memory);
+    return false;
+  }
+
+  bool passed = true;
+  for (size_t i = 0; i < sizeof(program) / sizeof(program[0]); i++)
+    passed = passed && write_word(&memory, (uint32_t)(i * 4), program[i]);
+  if (passed) {
+    cache_sim_attach(&sim, &memory);
+    RvContext_t context = {.cpu = &cpu, .memory = &memory};
+    rv_run(&context);
+
+    const CacheSimEntry_t *load = find(&sim.pcs, 4);
+    const CacheSimEntry_t *branch = find(&sim.pcs, 12);
+    const CacheSimEntry_t *page = find(&sim.regions, 0);
+    passed = cpu.halt && cpu.exit_code == 0 && load && branch && page &&
+             load->fetch.accesses == 3 && load->data.accesses == 3 &&
+             load->data.l1_misses == 1 && load->data.l2_misses == 1 &&
+             branch->fetch.accesses == 3 && branch->data.accesses == 0 &&
+             page->data.accesses == 3 && sim.regions.count == 1 &&
+             sim.levels[CACHE_L1I].misses == 1 &&
+             sim.levels[CACHE_L1I].hits == 11;
+  }
+
+  free_cache_sim(&sim);
+  free_memory(&memory);
+  return passed;
+}
+
+int main(void) {
+  bool passed = test_parse() && test_lru() && test_attribution();
+
+  if (!passed) {
+    fprintf(stderr, "FAIL  cache_sim_validation\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("PASS  cache_sim_validation\n");
+  return EXIT_SUCCESS;
+}
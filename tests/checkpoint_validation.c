@@ -0,0 +1,142 @@
+#include "bbv.h"
+#include "block_cache.h"
+#include "checkpoint.h"
+#include "cpu.h"
+#include "emulator.h"
+#include "memory.h"
+#include "opcodes.h"
+#include "rv_context.h"
+#include "syscall.h"
+#include "utils.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BBV_FILE "/tmp/riscv-checkpoint-validation.bb"
+#define CHECKPOINT_FILE "/tmp/riscv-checkpoint-validation.ckpt"
+
+// A three-iteration loop on predecoded blocks: the entry block runs the
+// first iteration and the block at the branch target the other two, then
+// the exit block, whose ecall stops the guest and so does not retire; cut
+// into intervals of four instructions.
+static bool test_bbv(void) {
+  const uint32_t program[] = {
+      build_i_type(OPCODE_OP_IMM, 5, 0b000, 0, 3),
+      build_i_type(OPCODE_OP_IMM, 5, 0b000, 5, -1),
+      build_b_type(OPCODE_BRANCH, 0b001, 5, 0, -4),
+      build_i_type(OPCODE_OP_IMM, 17, 0b000, 0, 93),
+      build_i_type(OPCODE_SYSTEM, 0, 0b000, 0, 0),
+  };
+
+  CPU_t cpu;
+  init_cpu(&cpu);
+  Memory_t memory;
+  if (!init_memory(&memory, 64))
+    return false;
+  BlockCache_t blocks;
+  if (!init_block_cache(&blocks)) {
+    free_memory(&memory);
+    return false;
+  }
+  Bbv_t bbv;
+  if (!bbv_open(&bbv, BBV_FILE, 4)) {
+    free_block_cache(&blocks);
+    free_memory(&memory);
+    return false;
+  }
+
+  bool passed = true;
+  for (size_t i = 0; i < sizeof(program) / sizeof(program[0]); i++)
+    passed = passed && write_word(&memory, (uint32_t)(i * 4), program[i]);
+  if (passed) {
+    RvContext_t context = {
+        .cpu = &cpu, .memory = &memory, .blocks = &blocks, .bbv = &bbv};
+    rv_run(&context);
+    passed = cpu.halt && cpu.exit_code == 0 && bbv.intervals == 2;
+  }
+  passed = bbv_close(&bbv) && passed;
+
+  char text[256] = {0};
+  FILE *fp = fopen(BBV_FILE, "r");
+  if (fp) {
+    size_t length = fread(text, 1, sizeof(text) - 1, fp);
+    text[length] = '\0';
+    fclose(fp);
+  }
+  passed = passed && strcmp(text, "T:1:3 :2:2 \nT:2:2 :3:1 \n") == 0;
+  if (!passed)
+    fprintf(stderr, "basic-block vectors: %s\n", text);
+
+  unlink(BBV_FILE);
+  free_block_cache(&blocks);
+  free_memory(&memory);
+  return passed;
+}
+
+// Registers, contents, protection and the program break all survive a
+// round trip into memory that held something else.
+static bool test_checkpoint_round_trip(void) {
+  Memory_t saved;
+  Memory_t restored;
+  if (!init_memory(&saved, 4 * GUEST_PAGE_SIZE))
+    return false;
+  if (!init_memory(&restored, 4 * GUEST_PAGE_SIZE)) {
+    free_memory(&saved);
+    return false;
+  }
+
+  CPU_t cpu;
+  init_cpu(&cpu);
+  for (uint32_t i = 1; i < 32; i++)
+    cpu.regs[i] = i * 0x01010101u;
+  cpu.pc = 0x1234;
+  SyscallState_t syscalls;
+  init_syscall_state(&syscalls);
+
+  bool passed = write_word(&saved, 0x10, 0xdeadbeef) &&
+                write_word(&saved, 3 * GUEST_PAGE_SIZE + 8, 0x55aa55aa) &&
+                write_word(&restored, GUEST_PAGE_SIZE, 0xffffffff);
+  memory_protect(&saved, 0, GUEST_PAGE_SIZE,
+                 MEMORY_PROT_READ | MEMORY_PROT_EXEC);
+  saved.program_break = 0x2000;
+  passed = passed && checkpoint_save(CHECKPOINT_FILE, &cpu, &saved, &syscalls,
+                                     42, 1000);
+
+  CPU_t resumed;
+  init_cpu(&resumed);
+  uint64_t position = 0;
+  passed = passed &&
+           !checkpoint_restore(CHECKPOINT_FILE, &resumed, &restored, 7,
+                               &position) &&
+           checkpoint_restore(CHECKPOINT_FILE, &resumed, &restored, 42,
+                              &position) &&
+           position == 1000 && resumed.pc == cpu.pc &&
+           memcmp(resumed.regs, cpu.regs, sizeof(cpu.regs)) == 0 &&
+           restored.program_break == 0x2000 &&
+           memcmp(restored.data, saved.data, saved.size) == 0;
+  for (size_t i = 0; passed && i < saved.page_count; i++)
+    passed = (restored.pages[i] & MEMORY_PROT_MASK) ==
+             (saved.pages[i] & MEMORY_PROT_MASK);
+
+  unlink(CHECKPOINT_FILE);
+  free_syscall_state(&syscalls);
+  free_memory(&restored);
+  free_memory(&saved);
+  return passed;
+}
+
+int main(void) {
+  bool passed = test_bbv() && test_checkpoint_round_trip();
+
+  if (!passed) {
+    fprintf(stderr, "FAIL  checkpoint_validation\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("PASS  checkpoint_validation\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,162 @@
+#include "coverage.h"
+#include "loader.h"
+#include "opcodes.h"
+#include "utils.h"
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define TEXT_VADDR 0x00010000
+
+// Writes `program` as a one-segment executable at TEXT_VADDR.
+static bool write_program_elf(char path[], const uint32_t *program,
+                              size_t count) {
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    perror("mkstemp");
+    return false;
+  }
+  FILE *fp = fdopen(fd, "wb");
+  if (!fp) {
+    perror("fdopen");
+    close(fd);
+    unlink(path);
+    return false;
+  }
+
+  Elf32_Ehdr_t header = {0};
+  memcpy(header.e_ident, "\x7f" "ELF", 4);
+  header.e_ident[EI_CLASS] = ELFCLASS32;
+  header.e_type = ET_EXEC;
+  header.e_machine = EM_RISCV;
+  header.e_version = 1;
+  header.e_entry = TEXT_VADDR;
+  header.e_phoff = sizeof(Elf32_Ehdr_t);
+  header.e_phentsize = sizeof(Elf32_Phdr_t);
+  header.e_phnum = 1;
+  Elf32_Phdr_t segment = {
+      .p_type = PT_LOAD,
+      .p_offset = sizeof(Elf32_Ehdr_t) + sizeof(Elf32_Phdr_t),
+      .p_vaddr = TEXT_VADDR,
+      .p_filesz = (uint32_t)(count * 4),
+      .p_memsz = (uint32_t)(count * 4),
+      .p_flags = PF_R | PF_X,
+  };
+
+  bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+            fwrite(&segment, sizeof(segment), 1, fp) == 1 &&
+            fwrite(program, 4, count, fp) == count;
+  if (fclose(fp) != 0)
+    ok = false;
+  if (!ok)
+    unlink(path);
+  return ok;
+}
+
+// Runs `program` on `emulator` as afl-fuzz would: with a shared map and the
+// fork server pipes, asking for one child. Returns the child's wait status,
+// as the fork server reports it, in `status`.
+static bool run_forked(const char *emulator, const uint32_t *program,
+                       size_t count, int *status) {
+  char path[] = "/tmp/riscv-coverage-validation-XXXXXX";
+  if (!write_program_elf(path, program, count))
+    return false;
+  int shm_id = shmget(IPC_PRIVATE, COVERAGE_MAP_SIZE, IPC_CREAT | 0600);
+  if (shm_id < 0) {
+    perror("shmget");
+    unlink(path);
+    return false;
+  }
+  char shm_text[16];
+  snprintf(shm_text, sizeof(shm_text), "%d", shm_id);
+
+  int control[2];
+  int replies[2];
+  bool passed = pipe(control) == 0;
+  if (passed && pipe(replies) != 0) {
+    close(control[0]);
+    close(control[1]);
+    passed = false;
+  }
+  pid_t server = passed ? fork() : -1;
+  if (server == 0) {
+    // The aborting child must not leave a core file behind.
+    struct rlimit no_core = {0, 0};
+    setrlimit(RLIMIT_CORE, &no_core);
+    dup2(control[0], COVERAGE_FORKSRV_FD);
+    dup2(replies[1], COVERAGE_FORKSRV_FD + 1);
+    for (int i = 0; i < 2; i++) {
+      close(control[i]);
+      close(replies[i]);
+    }
+    setenv(COVERAGE_SHM_ENV, shm_text, 1);
+    execl(emulator, emulator, path, (char *)NULL);
+    _exit(127);
+  }
+
+  if (passed) {
+    close(control[0]);
+    close(replies[1]);
+    uint32_t hello;
+    uint32_t request = 0;
+    uint32_t child;
+    uint32_t child_status;
+    passed = server > 0 && read(replies[0], &hello, 4) == 4 &&
+             write(control[1], &request, 4) == 4 &&
+             read(replies[0], &child, 4) == 4 &&
+             read(replies[0], &child_status, 4) == 4;
+    *status = (int)child_status;
+    // Closing the request pipe ends the fork server.
+    close(control[1]);
+    close(replies[0]);
+    int server_status;
+    passed = server > 0 && waitpid(server, &server_status, 0) == server &&
+             WIFEXITED(server_status) && WEXITSTATUS(server_status) == 0 &&
+             passed;
+  }
+
+  shmctl(shm_id, IPC_RMID, NULL);
+  unlink(path);
+  return passed;
+}
+
+// afl-fuzz counts a child as crashed only when a signal ended it: guest
+// faults must, guest exits must not.
+static bool test_faults_crash_children(const char *emulator) {
+  const uint32_t exits[] = {
+      build_i_type(OPCODE_OP_IMM, 10, 0b000, 0, 0),
+      build_i_type(OPCODE_OP_IMM, 17, 0b000, 0, 93),
+      build_i_type(OPCODE_SYSTEM, 0, 0b000, 0, 0),
+  };
+  const uint32_t faults[] = {
+      build_i_type(OPCODE_LOAD, 5, 0b010, 0, 0),
+  };
+  int status;
+  return run_forked(emulator, exits, 3, &status) && WIFEXITED(status) &&
+         WEXITSTATUS(status) == 0 &&
+         run_forked(emulator, faults, 1, &status) && WIFSIGNALED(status) &&
+         WTERMSIG(status) == SIGABRT;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s <emulator>\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (!test_faults_crash_children(argv[1])) {
+    fprintf(stderr, "FAIL  coverage_validation\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("PASS  coverage_validation\n");
+  return EXIT_SUCCESS;
+}
@@ -1,5 +1,6 @@
 #include "cpu.h"
 #include "decoder.h"
+#include "isa.h"
 #include "memory.h"
 #include "opcodes.h"
 #include "rv_context.h"
@@ -42,10 +43,12 @@ static bool is_illegal(uint32_t inst) {
 }
 
 int main(void) {
+  uint32_t bad_funct7 = build_r_type(OPCODE_OP, 1, 0b000, 0, 0, 0b1111111);
+  uint32_t mul = build_r_type(OPCODE_OP, 1, 0b000, 0, 0, 0b0000001);
   bool passed = test_valid_addi() && is_illegal(0) &&
                 is_illegal(build_i_type(OPCODE_JALR, 1, 0b001, 0, 0)) &&
                 is_illegal(build_b_type(OPCODE_BRANCH, 0b010, 0, 0, 0)) &&
-                is_illegal(build_r_type(OPCODE_OP, 1, 0b000, 0, 0, 0b1111111));
+                is_illegal(bad_funct7) && (RV_ISA_HAS_M || is_illegal(mul));
 
   if (!passed) {
     fprintf(stderr, "FAIL  decoder_validation\n");
@@ -1,6 +1,7 @@
 #include "compressed_decoder.h"
 #include "cpu.h"
 #include "fetch.h"
+#include "isa.h"
 #include "memory.h"
 #include "opcodes.h"
 #include "utils.h"
@@ -60,9 +61,36 @@ static bool test_negative_compressed_immediates(void) {
          get_imm_u(lui) == UINT32_C(0xfffff000);
 }
 
+// Instructions that straddle a page, and a compressed instruction in the
+// last halfword of memory, go through the slow fetch path.
+static bool test_boundary_fetch(void) {
+  if (!RV_ISA_HAS_C)
+    return true;
+
+  Memory_t memory;
+  if (!init_memory(&memory, 2 * GUEST_PAGE_SIZE))
+    return false;
+
+  uint32_t straddle = GUEST_PAGE_SIZE - 2;
+  uint32_t last = 2 * GUEST_PAGE_SIZE - 2;
+  bool wrote = write_half(&memory, straddle, UINT16_C(0x0093)) &&
+               write_half(&memory, straddle + 2, UINT16_C(0xfff1)) &&
+               write_half(&memory, last, UINT16_C(0x0001));
+
+  FetchResult_t wide = fetch_instruction(&memory, straddle);
+  FetchResult_t compressed = fetch_instruction(&memory, last);
+  bool passed = wrote && wide.success && wide.len == 4 &&
+                wide.inst == UINT32_C(0xfff10093) && compressed.success &&
+                compressed.len == 2 && compressed.inst == 0x0001;
+
+  free_memory(&memory);
+  return passed;
+}
+
 int main(void) {
   bool passed = test_sign_extension() && test_instruction_builders() &&
-                test_high_bit_fetch() && test_negative_compressed_immediates();
+                test_high_bit_fetch() &&
+                test_negative_compressed_immediates() && test_boundary_fetch();
 
   if (!passed) {
     fprintf(stderr, "FAIL  encoding_validation\n");
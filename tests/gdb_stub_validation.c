@@ -0,0 +1,151 @@
+#include "block_cache.h"
+#include "breakpoints.h"
+#include "cpu.h"
+#include "gdb_stub.h"
+#include "memory.h"
+#include "opcodes.h"
+#include "rv_context.h"
+#include "utils.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Appends `data` framed as a packet.
+static void append_packet(char *out, const char *data) {
+  uint8_t checksum = 0;
+  for (const char *p = data; *p; p++)
+    checksum += (uint8_t)*p;
+  sprintf(out + strlen(out), "$%s#%02x", data, checksum);
+}
+
+// Pcs that share a slot must all stay reachable after removals.
+static bool test_breakpoint_set(void) {
+  Breakpoints_t breakpoints;
+  if (!init_breakpoints(&breakpoints))
+    return false;
+
+  uint32_t stride = 2 * BREAKPOINTS_INITIAL_SLOTS;
+  bool passed = true;
+  for (uint32_t i = 0; i < 40; i++)
+    passed = passed && breakpoints_insert(&breakpoints, 0x1000 + i * stride);
+  for (uint32_t i = 0; i < 40; i += 2)
+    breakpoints_remove(&breakpoints, 0x1000 + i * stride);
+  for (uint32_t i = 0; i < 40; i++) {
+    bool expected = i % 2 == 1;
+    passed = passed && breakpoints_contains(&breakpoints,
+                                            0x1000 + i * stride) == expected;
+  }
+  passed = passed && breakpoints.count == 20 &&
+           !breakpoints_insert(&breakpoints, 0x1001) &&
+           !breakpoints_contains(&breakpoints, 0x1000 + 40 * stride);
+
+  free_breakpoints(&breakpoints);
+  return passed;
+}
+
+// Drives a whole session over a socket pair: the breakpoint sits inside the
+// loop's block, so the block cache has to split there.
+static bool test_session(void) {
+  const uint32_t program[] = {
+      build_i_type(OPCODE_OP_IMM, 5, 0b000, 0, 3),
+      build_i_type(OPCODE_OP_IMM, 6, 0b000, 6, 1),
+      build_i_type(OPCODE_OP_IMM, 5, 0b000, 5, -1),
+      build_b_type(OPCODE_BRANCH, 0b001, 5, 0, -8),
+      build_i_type(OPCODE_OP_IMM, 10, 0b000, 6, 4),
+      build_i_type(OPCODE_OP_IMM, 17, 0b000, 0, 93),
+      build_i_type(OPCODE_SYSTEM, 0, 0b000, 0, 0),
+  };
+  // Request and expected reply pairs.
+  const char *exchange[][2] = {
+      {"qSupported:swbreak+", "PacketSize=1000;qXfer:features:read+"},
+      {"?", "S05"},
+      {"Z0,8,4", "OK"},
+      {"c", "S05"},
+      {"p20", "08000000"},
+      {"p6", "01000000"},
+      {"c", "S05"},
+      {"p6", "02000000"},
+      {"z0,8,4", "OK"},
+      {"s", "S05"},
+      {"p20", "0c000000"},
+      {"M100,4:2a000000", "OK"},
+      {"m100,4", "2a000000"},
+      {"P6=05000000", "OK"},
+      {"vCont?", ""},
+      {"c", "W0a"},
+  };
+  size_t count = sizeof(exchange) / sizeof(exchange[0]);
+
+  static char requests[4096];
+  static char expected[4096];
+  requests[0] = '\0';
+  expected[0] = '\0';
+  for (size_t i = 0; i < count; i++) {
+    append_packet(requests, exchange[i][0]);
+    strcat(expected, "+");
+    append_packet(expected, exchange[i][1]);
+  }
+
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    return false;
+
+  CPU_t cpu;
+  init_cpu(&cpu);
+  Memory_t memory;
+  BlockCache_t blocks;
+  bool passed = init_memory(&memory, 1024);
+  if (passed && !init_block_cache(&blocks)) {
+    free_memory(&memory);
+    passed = false;
+  }
+
+  if (passed) {
+    passed = write_word(&memory, 0, program[0]);
+    for (size_t i = 1; i < sizeof(program) / sizeof(program[0]); i++)
+      passed = passed && write_word(&memory, (uint32_t)(i * 4), program[i]);
+
+    // gdb hangs up after the last request.
+    size_t length = strlen(requests);
+    passed = passed && write(fds[0], requests, length) == (ssize_t)length &&
+             shutdown(fds[0], SHUT_WR) == 0;
+
+    RvContext_t context = {.cpu = &cpu, .memory = &memory, .blocks = &blocks};
+    passed = passed && gdb_serve_fd(&context, fds[1]);
+    close(fds[1]);
+
+    static char replies[4096];
+    ssize_t received = read(fds[0], replies, sizeof(replies) - 1);
+    passed = passed && received >= 0;
+    if (passed) {
+      replies[received] = '\0';
+      passed = strcmp(replies, expected) == 0 && cpu.exit_code == 10 &&
+               context.breakpoints == NULL;
+      if (!passed)
+        fprintf(stderr, "gdb replies: %s\n", replies);
+    }
+
+    free_block_cache(&blocks);
+    free_memory(&memory);
+  }
+
+  close(fds[0]);
+  return passed;
+}
+
+int main(void) {
+  bool passed = test_breakpoint_set() && test_session();
+
+  if (!passed) {
+    fprintf(stderr, "FAIL  gdb_stub_validation\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("PASS  gdb_stub_validation\n");
+  return EXIT_SUCCESS;
+}
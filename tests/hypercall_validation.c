@@ -0,0 +1,202 @@
+#include "block_cache.h"
+#include "cpu.h"
+#include "decoder.h"
+#include "emulator.h"
+#include "hypercall.h"
+#include "instructions/instructions.h"
+#include "memory.h"
+#include "opcodes.h"
+#include "rv_context.h"
+#include "utils.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BUFFER_ADDR 0x1000
+#define SCALE_NUMBER (HYPERCALL_CUSTOM_1_BASE + 2 * 128 + 5)
+
+// Multiplies a1 words at a0 in place by the factor in `arg` and returns
+// their new sum.
+static bool kernel_scale(RvContext_t *context, uint32_t *args, void *arg) {
+  uint32_t factor = *(const uint32_t *)arg;
+  uint8_t *words = hypercall_buffer(context, args[0], args[1] * 4,
+                                    MEMORY_PROT_READ | MEMORY_PROT_WRITE);
+  if (!words)
+    return false;
+  uint32_t sum = 0;
+  for (uint32_t i = 0; i < args[1]; i++) {
+    uint32_t word;
+    memcpy(&word, words + i * 4, 4);
+    word *= factor;
+    memcpy(words + i * 4, &word, 4);
+    sum += word;
+  }
+  args[0] = sum;
+  return true;
+}
+
+static bool test_registration(void) {
+  Hypercalls_t hypercalls;
+  if (!init_hypercalls(&hypercalls))
+    return false;
+  uint32_t factor = 1;
+  bool passed =
+      hypercall_register_builtins(&hypercalls) &&
+      !hypercall_register(&hypercalls, HYPERCALL_HASH, "again", kernel_scale,
+                          &factor) &&
+      !hypercall_register(&hypercalls, HYPERCALL_COUNT, "outside",
+                          kernel_scale, &factor) &&
+      hypercall_number(build_r_type(OPCODE_CUSTOM_1, 0, 2, 0, 0, 5)) ==
+          SCALE_NUMBER &&
+      decode_instruction(build_r_type(OPCODE_CUSTOM_0, 0, 0, 0, 0, 0)) ==
+          handle_hypercall &&
+      decode_instruction(build_r_type(OPCODE_CUSTOM_0, 10, 0, 0, 0, 0)) ==
+          handle_illegal_instruction;
+  free_hypercalls(&hypercalls);
+  return passed;
+}
+
+// Calls hypercall `number` on three words at BUFFER_ADDR, on a page of
+// their own with `buffer_prot`, then exits with a0.
+static bool run_scale(uint32_t number, uint8_t buffer_prot, CPU_t *cpu,
+                      uint32_t words[3]) {
+  uint32_t funct3 = number % HYPERCALL_CUSTOM_1_BASE / 128;
+  uint32_t opcode =
+      number >= HYPERCALL_CUSTOM_1_BASE ? OPCODE_CUSTOM_1 : OPCODE_CUSTOM_0;
+  const uint32_t program[] = {
+      build_u_type(OPCODE_LUI, 10, BUFFER_ADDR),
+      build_i_type(OPCODE_OP_IMM, 11, 0b000, 0, 3),
+      build_r_type(opcode, 0, funct3, 0, 0, number % 128),
+      build_i_type(OPCODE_OP_IMM, 17, 0b000, 0, 93),
+      build_i_type(OPCODE_SYSTEM, 0, 0b000, 0, 0),
+  };
+
+  init_cpu(cpu);
+  Memory_t memory;
+  if (!init_memory(&memory, 2 * GUEST_PAGE_SIZE))
+    return false;
+  Hypercalls_t hypercalls;
+  if (!init_hypercalls(&hypercalls)) {
+    free_memory(&memory);
+    return false;
+  }
+
+  uint32_t factor = 3;
+  bool passed = hypercall_register(&hypercalls, SCALE_NUMBER, "scale",
+                                   kernel_scale, &factor);
+  for (uint32_t i = 0; passed && i < sizeof(program) / sizeof(program[0]);
+       i++)
+    passed = write_word(&memory, i * 4, program[i]);
+  for (uint32_t i = 0; passed && i < 3; i++)
+    passed = write_word(&memory, BUFFER_ADDR + i * 4, i + 1);
+  memory_protect(&memory, BUFFER_ADDR, GUEST_PAGE_SIZE, buffer_prot);
+
+  if (passed) {
+    RvContext_t context = {
+        .cpu = cpu, .memory = &memory, .hypercalls = &hypercalls};
+    rv_run(&context);
+    for (uint32_t i = 0; i < 3; i++) {
+      uint8_t *host;
+      passed = passed &&
+               memory_get_pointer(&memory, BUFFER_ADDR + i * 4, 4, &host);
+      if (passed)
+        memcpy(&words[i], host, 4);
+    }
+  }
+
+  free_hypercalls(&hypercalls);
+  free_memory(&memory);
+  return passed;
+}
+
+// The kernel works on guest memory in place; unregistered numbers and
+// buffers the guest may not write stop the guest.
+static bool test_calls(void) {
+  const uint8_t all = MEMORY_PROT_READ | MEMORY_PROT_WRITE | MEMORY_PROT_EXEC;
+  CPU_t cpu;
+  uint32_t words[3];
+  return run_scale(SCALE_NUMBER, all, &cpu, words) &&
+         cpu.halt && cpu.exit_code == 18 && words[0] == 3 && words[2] == 9 &&
+         run_scale(SCALE_NUMBER - 1, all, &cpu, words) &&
+         cpu.exit_code == 1 && cpu.pc == 8 && words[0] == 1 &&
+         run_scale(SCALE_NUMBER, MEMORY_PROT_READ, &cpu, words) &&
+         cpu.exit_code == 1 && cpu.pc == 8 && words[0] == 1;
+}
+
+// Runs a loop around the hash hypercall on predecoded blocks, optimized
+// after their first run, or on the interpreter. The hypercall replaces a0
+// and a1, which the block set to constants before it.
+static bool run_hash_loop(bool use_blocks, CPU_t *cpu) {
+  const uint32_t program[] = {
+      build_u_type(OPCODE_LUI, 10, BUFFER_ADDR),
+      build_i_type(OPCODE_OP_IMM, 11, 0b000, 0, 8),
+      build_r_type(OPCODE_CUSTOM_0, 0, 0, 0, 0, HYPERCALL_HASH),
+      build_i_type(OPCODE_OP_IMM, 12, 0b000, 10, 0),
+      build_i_type(OPCODE_OP_IMM, 13, 0b000, 11, 0),
+      build_i_type(OPCODE_OP_IMM, 5, 0b000, 5, 1),
+      build_i_type(OPCODE_OP_IMM, 6, 0b000, 0, 3),
+      build_b_type(OPCODE_BRANCH, 0b001, 5, 6, -28),
+      build_i_type(OPCODE_SYSTEM, 0, 0b000, 0, 1),
+  };
+
+  init_cpu(cpu);
+  Memory_t memory;
+  if (!init_memory(&memory, 2 * GUEST_PAGE_SIZE))
+    return false;
+  Hypercalls_t hypercalls;
+  if (!init_hypercalls(&hypercalls)) {
+    free_memory(&memory);
+    return false;
+  }
+  BlockCache_t blocks;
+  if (!init_block_cache(&blocks)) {
+    free_hypercalls(&hypercalls);
+    free_memory(&memory);
+    return false;
+  }
+  blocks.hot_threshold = 1;
+
+  bool passed = hypercall_register_builtins(&hypercalls);
+  for (uint32_t i = 0; passed && i < sizeof(program) / sizeof(program[0]);
+       i++)
+    passed = write_word(&memory, i * 4, program[i]);
+  if (passed) {
+    RvContext_t context = {.cpu = cpu,
+                           .memory = &memory,
+                           .blocks = use_blocks ? &blocks : NULL,
+                           .hypercalls = &hypercalls};
+    rv_run(&context);
+    passed = !use_blocks || blocks.stats.optimized > 0;
+  }
+
+  free_block_cache(&blocks);
+  free_hypercalls(&hypercalls);
+  free_memory(&memory);
+  return passed;
+}
+
+// The optimized tier must not fold a0-a7 across a hypercall.
+static bool test_optimized_tier(void) {
+  CPU_t interp_cpu;
+  CPU_t block_cpu;
+  return run_hash_loop(false, &interp_cpu) && run_hash_loop(true, &block_cpu) &&
+         interp_cpu.pc == 32 && block_cpu.pc == interp_cpu.pc &&
+         read_reg(&block_cpu, 12) != BUFFER_ADDR &&
+         memcmp(interp_cpu.regs, block_cpu.regs, sizeof(block_cpu.regs)) == 0;
+}
+
+int main(void) {
+  bool passed =
+      test_registration() && test_calls() && test_optimized_tier();
+
+  if (!passed) {
+    fprintf(stderr, "FAIL  hypercall_validation\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("PASS  hypercall_validation\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,151 @@
+#include "block_cache.h"
+#include "cpu.h"
+#include "emulator.h"
+#include "intercept.h"
+#include "memory.h"
+#include "opcodes.h"
+#include "rv_context.h"
+#include "utils.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MEMCPY_PC 0x40
+#define STRLEN_PC 0x48
+#define MEMSET_PC 0x50
+#define PROTECTED_PAGE 0x1000
+
+static bool test_parse(void) {
+  uint32_t allowed = 0;
+  return intercept_parse("memcpy,strlen", &allowed) &&
+         allowed == ((1u << INTERCEPT_MEMCPY) | (1u << INTERCEPT_STRLEN)) &&
+         !intercept_parse("memcpy,strncpy", &allowed) &&
+         !intercept_parse("", &allowed) &&
+         !intercept_parse("memcpy,,strlen", &allowed) &&
+         !intercept_parse("memcpy,", &allowed) &&
+         !intercept_parse(",memcpy", &allowed);
+}
+
+// Loads `program` at 0 and guest versions of the routines, which return a
+// marker instead of doing the work, then runs it and returns the exit code.
+static uint32_t run_program(const uint32_t *program, size_t count,
+                            Intercepts_t *intercepts, bool use_blocks,
+                            Memory_t *memory) {
+  const uint32_t fallback[] = {
+      build_i_type(OPCODE_OP_IMM, 10, 0b000, 0, 99),
+      build_i_type(OPCODE_JALR, 0, 0b000, 1, 0),
+  };
+  CPU_t cpu;
+  init_cpu(&cpu);
+  BlockCache_t blocks;
+  if (!init_memory(memory, 2 * GUEST_PAGE_SIZE))
+    return UINT32_MAX;
+  if (!init_block_cache(&blocks)) {
+    free_memory(memory);
+    return UINT32_MAX;
+  }
+
+  bool loaded = true;
+  for (size_t i = 0; i < count; i++)
+    loaded = loaded && write_word(memory, (uint32_t)(i * 4), program[i]);
+  const uint32_t entries[] = {MEMCPY_PC, STRLEN_PC, MEMSET_PC};
+  for (size_t i = 0; i < sizeof(entries) / sizeof(entries[0]); i++) {
+    loaded = loaded && write_word(memory, entries[i], fallback[0]) &&
+             write_word(memory, entries[i] + 4, fallback[1]);
+  }
+  uint8_t *source;
+  loaded = loaded && memory_get_pointer(memory, 0x200, 6, &source);
+  if (loaded)
+    memcpy(source, "hello", 6);
+  memory_revoke(memory, PROTECTED_PAGE, GUEST_PAGE_SIZE, MEMORY_PROT_WRITE);
+
+  uint32_t exit_code = UINT32_MAX;
+  if (loaded) {
+    RvContext_t context = {.cpu = &cpu,
+                           .memory = memory,
+                           .blocks = use_blocks ? &blocks : NULL,
+                           .intercepts = intercepts};
+    rv_run(&context);
+    if (cpu.halt)
+      exit_code = (uint32_t)cpu.exit_code;
+  }
+  free_block_cache(&blocks);
+  return exit_code;
+}
+
+// memcpy then strlen of the copy, both on the host: the guest versions
+// would leave 99 in a0.
+static bool test_calls(bool use_blocks) {
+  const uint32_t program[] = {
+      build_i_type(OPCODE_OP_IMM, 10, 0b000, 0, 0x100),
+      build_i_type(OPCODE_OP_IMM, 11, 0b000, 0, 0x200),
+      build_i_type(OPCODE_OP_IMM, 12, 0b000, 0, 5),
+      build_j_type(OPCODE_JAL, 1, MEMCPY_PC - 0x0c),
+      build_j_type(OPCODE_JAL, 1, STRLEN_PC - 0x10),
+      build_i_type(OPCODE_OP_IMM, 17, 0b000, 0, 93),
+      build_i_type(OPCODE_SYSTEM, 0, 0b000, 0, 0),
+  };
+  Intercepts_t intercepts;
+  init_intercepts(&intercepts, INTERCEPT_ALL);
+  bool passed = intercept_add(&intercepts, MEMCPY_PC, INTERCEPT_MEMCPY) &&
+                intercept_add(&intercepts, STRLEN_PC, INTERCEPT_STRLEN);
+
+  Memory_t memory;
+  uint32_t exit_code = run_program(
+      program, sizeof(program) / sizeof(program[0]), &intercepts, use_blocks,
+      &memory);
+  if (exit_code == UINT32_MAX)
+    return false;
+  uint8_t *copy;
+  passed = passed && exit_code == 5 &&
+           memory_get_pointer(&memory, 0x100, 6, &copy) &&
+           memcmp(copy, "hello", 6) == 0 &&
+           intercepts.calls[INTERCEPT_MEMCPY] == 1 &&
+           intercepts.calls[INTERCEPT_STRLEN] == 1;
+  free_memory(&memory);
+  return passed;
+}
+
+// A memset the guest may not do itself runs the guest routine.
+static bool test_fallback(void) {
+  const uint32_t program[] = {
+      build_u_type(OPCODE_LUI, 10, PROTECTED_PAGE),
+      build_i_type(OPCODE_OP_IMM, 11, 0b000, 0, 0x2a),
+      build_i_type(OPCODE_OP_IMM, 12, 0b000, 0, 4),
+      build_j_type(OPCODE_JAL, 1, MEMSET_PC - 0x0c),
+      build_i_type(OPCODE_OP_IMM, 17, 0b000, 0, 93),
+      build_i_type(OPCODE_SYSTEM, 0, 0b000, 0, 0),
+  };
+  Intercepts_t intercepts;
+  init_intercepts(&intercepts, INTERCEPT_ALL);
+  bool passed = intercept_add(&intercepts, MEMSET_PC, INTERCEPT_MEMSET);
+
+  Memory_t memory;
+  uint32_t exit_code = run_program(
+      program, sizeof(program) / sizeof(program[0]), &intercepts, true,
+      &memory);
+  if (exit_code == UINT32_MAX)
+    return false;
+  uint8_t *target;
+  passed = passed && exit_code == 99 &&
+           memory_get_pointer(&memory, PROTECTED_PAGE, 1, &target) &&
+           *target == 0 && intercepts.calls[INTERCEPT_MEMSET] == 0;
+  free_memory(&memory);
+  return passed;
+}
+
+int main(void) {
+  bool passed = test_parse() && test_calls(true) && test_calls(false) &&
+                test_fallback();
+
+  if (!passed) {
+    fprintf(stderr, "FAIL  intercept_validation\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("PASS  intercept_validation\n");
+  return EXIT_SUCCESS;
+}
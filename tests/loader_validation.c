@@ -1,6 +1,8 @@
 #include "cpu.h"
+#include "fetch.h"
 #include "loader.h"
 #include "memory.h"
+#include "utils.h"
 
 #include <stdbool.h>
 #include <stdint.h>
@@ -71,7 +73,8 @@ static bool load_test_elf(const Elf32_Phdr_t *program_header,
     unlink(path);
     return false;
   }
-  load_elf(&cpu, &memory, path);
+  ElfInfo_t info;
+  load_elf(&cpu, &memory, path, &info);
 
   bool passed = cpu.halt == expect_failure;
   if (passed && check_contents) {
@@ -81,6 +84,9 @@ static bool load_test_elf(const Elf32_Phdr_t *program_header,
              memory.data[4] == 0 && memory.data[5] == 0 &&
              memory.data[6] == 0 && memory.data[7] == 0;
   }
+  if (passed && check_contents && (program_header->p_flags & PF_X)) {
+    passed = info.exec_segment_count == 1 && info.exec_hash != HASH_SEED;
+  }
 
   free_memory(&memory);
   unlink(path);
@@ -95,6 +101,7 @@ static bool test_valid_segment(void) {
       .p_vaddr = test_vaddr,
       .p_filesz = sizeof(data),
       .p_memsz = 8,
+      .p_flags = PF_R | PF_X,
   };
   return load_test_elf(&ph, data, sizeof(data), false, true);
 }
@@ -144,10 +151,54 @@ static bool test_segment_outside_file(void) {
   return load_test_elf(&ph, NULL, 0, true, false);
 }
 
+// A read-execute segment rejects stores and a read-write stack rejects
+// fetches, and a protection change reaches accesses that hit in the TLB.
+static bool test_segment_permissions(void) {
+  uint8_t data[] = {0x13, 0x00, 0x00, 0x00};
+  Elf32_Phdr_t ph = {
+      .p_type = PT_LOAD,
+      .p_offset = sizeof(Elf32_Ehdr_t) + sizeof(Elf32_Phdr_t),
+      .p_vaddr = test_vaddr,
+      .p_filesz = sizeof(data),
+      .p_memsz = sizeof(data),
+      .p_flags = PF_R | PF_X,
+  };
+  char path[] = "/tmp/riscv-loader-test-XXXXXX";
+  if (!write_test_elf(path, &ph, data, sizeof(data)))
+    return false;
+
+  CPU_t cpu;
+  init_cpu(&cpu);
+  Memory_t memory;
+  if (!init_memory(&memory, MEMORY_SIZE_BYTES)) {
+    unlink(path);
+    return false;
+  }
+  load_elf(&cpu, &memory, path, NULL);
+
+  uint32_t word = 0;
+  uint32_t stack = cpu.regs[2] - GUEST_PAGE_SIZE;
+  bool passed = !cpu.halt && fetch_instruction(&memory, test_vaddr).success &&
+                read_word(&memory, test_vaddr, &word) && word == 0x13 &&
+                !write_word(&memory, test_vaddr, 0) &&
+                write_word(&memory, stack, 1) &&
+                read_word(&memory, stack, &word) && word == 1 &&
+                !fetch_instruction(&memory, stack).success;
+
+  memory_protect(&memory, stack, GUEST_PAGE_SIZE, MEMORY_PROT_READ);
+  passed = passed && read_word(&memory, stack, &word) &&
+           !write_word(&memory, stack, 2);
+
+  free_memory(&memory);
+  unlink(path);
+  return passed;
+}
+
 int main(void) {
   bool passed = test_valid_segment() && test_filesz_exceeds_memsz() &&
                 test_virtual_address_overflow() &&
-                test_memory_window_overflow() && test_segment_outside_file();
+                test_memory_window_overflow() && test_segment_outside_file() &&
+                test_segment_permissions();
 
   if (!passed) {
     fprintf(stderr, "FAIL  loader_validation\n");
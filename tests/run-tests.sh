@@ -4,9 +4,12 @@ emulator=${1:-}
 test_dir=${2:-}
 
 if [ -z "$emulator" ] || [ -z "$test_dir" ]; then
-    printf "Usage: %s <emulator> <test-directory>\n" "$0" >&2
+    printf "Usage: %s <emulator> <test-directory> [emulator-options...]\n" "$0" >&2
+    printf "When <emulator> is a directory, each test runs on <emulator>/<test>.\n" >&2
+    printf "%%n in an emulator option is replaced by the test name.\n" >&2
     exit 2
 fi
+shift 2
 
 failures=0
 test_count=0
@@ -14,11 +17,18 @@ test_count=0
 for test_elf in "$test_dir"/*.elf; do
     test_count=$((test_count + 1))
     test_name=$(basename "$test_elf" .elf)
+    runner=$emulator
+    if [ -d "$emulator" ]; then
+        runner=$emulator/$test_name
+    fi
+
+    # "%n" in an emulator option stands for the test name.
+    options=$(printf '%s' "$*" | sed "s/%n/$test_name/g")
 
     if [ "$test_name" = syscall_read ]; then
-        "$emulator" "$test_elf" < tests/fixtures/read-input.txt
+        "$runner" $options "$test_elf" < tests/fixtures/read-input.txt
     else
-        "$emulator" "$test_elf"
+        "$runner" $options "$test_elf"
     fi
     result=$?
 
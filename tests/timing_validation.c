@@ -0,0 +1,115 @@
+#include "cpu.h"
+#include "emulator.h"
+#include "isa.h"
+#include "memory.h"
+#include "opcodes.h"
+#include "rv_context.h"
+#include "timing.h"
+#include "utils.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static bool test_parse(void) {
+  TimingConfig_t config;
+  timing_default_config(&config);
+  return timing_parse("predictor=bimodal,entries=64,div=20", &config) &&
+         config.predictor == TIMING_PREDICT_BIMODAL && config.entries == 64 &&
+         config.div_latency == 20 && config.mul_latency == 3 &&
+         !timing_parse("entries=48", &config) &&
+         !timing_parse("predictor=perceptron", &config) &&
+         !timing_parse("mul", &config) && config.entries == 64;
+}
+
+// Multiplies and divides block the pipeline for their whole latency.
+static bool test_muldiv_latency(void) {
+  TimingConfig_t config;
+  timing_default_config(&config);
+  Timing_t timing;
+  if (!init_timing(&timing, &config))
+    return false;
+  timing_retire(&timing, build_r_type(OPCODE_OP, 5, 0b000, 6, 7, 1));
+  timing_retire(&timing, build_r_type(OPCODE_OP, 5, 0b101, 6, 7, 1));
+  timing_retire(&timing, build_r_type(OPCODE_OP, 5, 0b000, 6, 7, 0));
+  bool passed = timing.instructions == 3 &&
+                timing.cycles == config.mul_latency + config.div_latency + 1;
+  free_timing(&timing);
+  return passed;
+}
+
+// Runs ten iterations of a loop whose load feeds the next instruction and
+// returns the model's counts.
+static bool run_loop(TimingPredictor predictor, Timing_t *timing) {
+  const uint32_t program[] = {
+      build_i_type(OPCODE_OP_IMM, 5, 0b000, 0, 10),
+      build_i_type(OPCODE_LOAD, 6, 0b010, 0, 0x100),
+      build_r_type(OPCODE_OP, 7, 0b000, 6, 6, 0),
+      build_r_type(OPCODE_OP, 8, 0b000, 7, 7, RV_ISA_HAS_M ? 1 : 0),
+      build_i_type(OPCODE_OP_IMM, 5, 0b000, 5, -1),
+      build_b_type(OPCODE_BRANCH, 0b001, 5, 0, -16),
+      build_i_type(OPCODE_OP_IMM, 17, 0b000, 0, 93),
+      build_i_type(OPCODE_SYSTEM, 0, 0b000, 0, 0),
+  };
+
+  TimingConfig_t config;
+  timing_default_config(&config);
+  config.predictor = predictor;
+  if (!init_timing(timing, &config))
+    return false;
+  CPU_t cpu;
+  init_cpu(&cpu);
+  Memory_t memory;
+  if (!init_memory(&memory, 512)) {
+    free_timing(timing);
+    return false;
+  }
+
+  bool passed = true;
+  for (size_t i = 0; i < sizeof(program) / sizeof(program[0]); i++)
+    passed = passed && write_word(&memory, (uint32_t)(i * 4), program[i]);
+  if (passed) {
+    RvContext_t context = {.cpu = &cpu, .memory = &memory, .timing = timing};
+    rv_run(&context);
+    passed = cpu.halt && cpu.exit_code == 0 &&
+             timing->instructions == context.instructions_retired;
+  }
+
+  free_memory(&memory);
+  free_timing(timing);
+  return passed;
+}
+
+// A bimodal counter mispredicts the loop branch only on the first taken and
+// the final fall-through; a static not-taken guess misses every taken one.
+static bool test_loop(void) {
+  Timing_t bimodal;
+  Timing_t not_taken;
+  if (!run_loop(TIMING_PREDICT_BIMODAL, &bimodal) ||
+      !run_loop(TIMING_PREDICT_NOT_TAKEN, &not_taken))
+    return false;
+
+  const TimingConfig_t *config = &bimodal.config;
+  uint64_t muldiv = RV_ISA_HAS_M ? 10 * (config->mul_latency - 1) : 0;
+  uint64_t base = 52 + 10 * config->load_use + muldiv;
+  return bimodal.instructions == 52 && bimodal.load_use_stalls == 10 &&
+         bimodal.muldiv_cycles == muldiv && bimodal.branches == 10 &&
+         bimodal.mispredicts == 2 &&
+         bimodal.cycles ==
+             base + 2 * config->mispredict + 8 * config->taken &&
+         not_taken.mispredicts == 9 &&
+         not_taken.cycles == base + 9 * config->mispredict;
+}
+
+int main(void) {
+  bool passed = test_parse() && test_muldiv_latency() && test_loop();
+
+  if (!passed) {
+    fprintf(stderr, "FAIL  timing_validation\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("PASS  timing_validation\n");
+  return EXIT_SUCCESS;
+}
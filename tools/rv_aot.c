@@ -0,0 +1,668 @@
+// rv-aot: translates the executable segments of an RV32IMC ELF into host C,
+// one function per guest block. Blocks are discovered by following control
+// flow from the entry point and every symbol in an executable segment.
+// The output is linked with the emulator objects and a main.c built with
+// -DRV_AOT; see include/aot.h.
+
+#include "aot.h"
+#include "compressed_decoder.h"
+#include "cpu.h"
+#include "decoder.h"
+#include "fetch.h"
+#include "instructions/instructions.h"
+#include "instructions/instructions_m.h"
+#include "isa.h"
+#include "loader.h"
+#include "memory.h"
+#include "opcodes.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct Range {
+  uint32_t start;
+  uint32_t end;
+} Range_t;
+
+typedef struct Instruction {
+  uint32_t pc;
+  uint32_t inst;
+  uint8_t len;
+  InstructionHandler handler;
+} Instruction_t;
+
+typedef struct TranslatedBlock {
+  uint32_t start_pc;
+  uint32_t end_pc;
+  size_t first;
+  size_t count;
+} TranslatedBlock_t;
+
+typedef struct Translator {
+  CPU_t cpu;
+  Memory_t memory;
+  Range_t ranges[16];
+  size_t range_count;
+
+  uint32_t *worklist;
+  size_t work_count;
+  size_t work_capacity;
+  uint8_t *seen; // One bit per halfword in [seen_base, seen_end).
+  uint32_t seen_base;
+  uint32_t seen_end;
+
+  TranslatedBlock_t *blocks;
+  size_t block_count;
+  size_t block_capacity;
+  Instruction_t *insns;
+  size_t insn_count;
+  size_t insn_capacity;
+} Translator_t;
+
+typedef struct OperationRule {
+  InstructionHandler handler;
+  const char *helper;
+} OperationRule_t;
+
+static const OperationRule_t register_rules[] = {
+    {handle_add, "aot_add"},       {handle_sub, "aot_sub"},
+    {handle_sll, "aot_sll"},       {handle_slt, "aot_slt"},
+    {handle_sltu, "aot_sltu"},     {handle_xor, "aot_xor"},
+    {handle_srl, "aot_srl"},       {handle_sra, "aot_sra"},
+    {handle_or, "aot_or"},         {handle_and, "aot_and"},
+    {handle_mul, "aot_mul"},       {handle_mulh, "aot_mulh"},
+    {handle_mulhsu, "aot_mulhsu"}, {handle_mulhu, "aot_mulhu"},
+    {handle_div, "aot_div"},       {handle_divu, "aot_divu"},
+    {handle_rem, "aot_rem"},       {handle_remu, "aot_remu"},
+};
+
+static const OperationRule_t immediate_rules[] = {
+    {handle_addi, "aot_add"}, {handle_slti, "aot_slt"},
+    {handle_sltiu, "aot_sltu"}, {handle_xori, "aot_xor"},
+    {handle_ori, "aot_or"},   {handle_andi, "aot_and"},
+    {handle_slli, "aot_sll"}, {handle_srli, "aot_srl"},
+    {handle_srai, "aot_sra"},
+};
+
+static const OperationRule_t load_rules[] = {
+    {handle_lb, "aot_lb"},   {handle_lh, "aot_lh"}, {handle_lw, "aot_lw"},
+    {handle_lbu, "aot_lbu"}, {handle_lhu, "aot_lhu"},
+};
+
+static const OperationRule_t store_rules[] = {
+    {handle_sb, "aot_sb"},
+    {handle_sh, "aot_sh"},
+    {handle_sw, "aot_sw"},
+};
+
+static const OperationRule_t branch_rules[] = {
+    {handle_beq, "aot_eq"}, {handle_bne, "aot_ne"},   {handle_blt, "aot_lt"},
+    {handle_bge, "aot_ge"}, {handle_bltu, "aot_ltu"}, {handle_bgeu, "aot_geu"},
+};
+
+#define RULE_COUNT(rules) (sizeof(rules) / sizeof((rules)[0]))
+
+static const char *find_rule(const OperationRule_t *rules, size_t count,
+                             InstructionHandler handler) {
+  for (size_t i = 0; i < count; i++) {
+    if (rules[i].handler == handler)
+      return rules[i].helper;
+  }
+  return NULL;
+}
+
+static bool grow(void **items, size_t *capacity, size_t needed,
+                 size_t item_size) {
+  if (needed <= *capacity)
+    return true;
+
+  size_t new_capacity = *capacity ? *capacity * 2 : 256;
+  while (new_capacity < needed)
+    new_capacity *= 2;
+  void *grown = realloc(*items, new_capacity * item_size);
+  if (!grown) {
+    perror("Error: Failed to allocate translator state");
+    return false;
+  }
+  *items = grown;
+  *capacity = new_capacity;
+  return true;
+}
+
+static bool in_ranges(const Translator_t *translator, uint32_t pc,
+                      uint32_t size) {
+  for (size_t i = 0; i < translator->range_count; i++) {
+    const Range_t *range = &translator->ranges[i];
+    if (pc >= range->start && pc < range->end && size <= range->end - pc)
+      return true;
+  }
+  return false;
+}
+
+static bool push_work(Translator_t *translator, uint32_t pc) {
+  if (pc % RV_INSTRUCTION_ALIGN != 0 || !in_ranges(translator, pc, 2))
+    return true;
+
+  uint32_t bit = (pc - translator->seen_base) / 2;
+  if (translator->seen[bit / 8] & (1u << (bit % 8)))
+    return true;
+  translator->seen[bit / 8] |= (uint8_t)(1u << (bit % 8));
+
+  if (!grow((void **)&translator->worklist, &translator->work_capacity,
+            translator->work_count + 1, sizeof(uint32_t)))
+    return false;
+  translator->worklist[translator->work_count++] = pc;
+  return true;
+}
+
+static bool read_file(const char *path, uint8_t **data, size_t *size) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    perror("Error: Failed to open ELF file");
+    return false;
+  }
+
+  fseek(fp, 0, SEEK_END);
+  long length = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  *data = length > 0 ? (uint8_t *)malloc((size_t)length) : NULL;
+  if (!*data || fread(*data, 1, (size_t)length, fp) != (size_t)length) {
+    fprintf(stderr, "Error: Failed to read ELF file: %s\n", path);
+    free(*data);
+    fclose(fp);
+    return false;
+  }
+  fclose(fp);
+  *size = (size_t)length;
+  return true;
+}
+
+// load_elf has already validated the headers; this only collects executable
+// segments and symbol addresses from the same file.
+static bool collect_entry_points(Translator_t *translator, const char *path) {
+  uint8_t *file;
+  size_t file_size;
+  if (!read_file(path, &file, &file_size))
+    return false;
+
+  Elf32_Ehdr_t header;
+  memcpy(&header, file, sizeof(header));
+
+  bool ok = true;
+  for (uint16_t i = 0; i < header.e_phnum; i++) {
+    Elf32_Phdr_t ph;
+    memcpy(&ph, file + header.e_phoff + i * sizeof(Elf32_Phdr_t), sizeof(ph));
+    if (ph.p_type != PT_LOAD || !(ph.p_flags & PF_X) || ph.p_filesz == 0)
+      continue;
+    if (translator->range_count == sizeof(translator->ranges) /
+                                       sizeof(translator->ranges[0])) {
+      fprintf(stderr, "Error: Too many executable segments\n");
+      ok = false;
+      break;
+    }
+    translator->ranges[translator->range_count++] =
+        (Range_t){.start = ph.p_vaddr, .end = ph.p_vaddr + ph.p_filesz};
+  }
+
+  if (ok && translator->range_count == 0) {
+    fprintf(stderr, "Error: No executable segments found in ELF file\n");
+    ok = false;
+  }
+
+  if (ok) {
+    translator->seen_base = translator->ranges[0].start;
+    translator->seen_end = translator->ranges[0].end;
+    for (size_t i = 1; i < translator->range_count; i++) {
+      if (translator->ranges[i].start < translator->seen_base)
+        translator->seen_base = translator->ranges[i].start;
+      if (translator->ranges[i].end > translator->seen_end)
+        translator->seen_end = translator->ranges[i].end;
+    }
+    size_t bits = (translator->seen_end - translator->seen_base) / 2 + 1;
+    translator->seen = (uint8_t *)calloc(bits / 8 + 1, 1);
+    ok = translator->seen && push_work(translator, translator->cpu.pc);
+  }
+
+  size_t shoff = header.e_shoff;
+  for (uint16_t i = 0; ok && shoff != 0 && i < header.e_shnum; i++) {
+    if (shoff + (i + 1) * sizeof(Elf32_Shdr_t) > file_size)
+      break;
+    Elf32_Shdr_t section;
+    memcpy(&section, file + shoff + i * sizeof(Elf32_Shdr_t),
+           sizeof(section));
+    if (section.sh_type != SHT_SYMTAB ||
+        (uint64_t)section.sh_offset + section.sh_size > file_size)
+      continue;
+
+    for (uint32_t offset = 0; ok && offset + sizeof(Elf32_Sym_t) <=
+                                        section.sh_size;
+         offset += sizeof(Elf32_Sym_t)) {
+      Elf32_Sym_t symbol;
+      memcpy(&symbol, file + section.sh_offset + offset, sizeof(symbol));
+      uint8_t type = ELF32_ST_TYPE(symbol.st_info);
+      if (symbol.st_shndx != SHN_UNDEF &&
+          (type == STT_FUNC || type == STT_NOTYPE))
+        ok = push_work(translator, symbol.st_value);
+    }
+  }
+
+  free(file);
+  return ok;
+}
+
+static bool ends_block(const Instruction_t *insn) {
+  InstructionHandler handler = insn->handler;
+  if (handler == handle_illegal_instruction || handler == handle_fence_i)
+    return true;
+
+  switch (get_opcode(insn->inst)) {
+  case OPCODE_BRANCH:
+  case OPCODE_JAL:
+  case OPCODE_JALR:
+  case OPCODE_SYSTEM:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Queues the addresses control can reach from the end of a block. Indirect
+// jumps are resolved at run time; returns come back to the instruction after
+// a call, so calls queue their fallthrough too.
+static bool queue_successors(Translator_t *translator,
+                             const Instruction_t *last, uint32_t end_pc) {
+  uint32_t inst = last->inst;
+  switch (get_opcode(inst)) {
+  case OPCODE_BRANCH:
+    return push_work(translator, last->pc + get_imm_b(inst)) &&
+           push_work(translator, end_pc);
+  case OPCODE_JAL:
+    return push_work(translator, last->pc + get_imm_j(inst)) &&
+           (get_rd(inst) == 0 || push_work(translator, end_pc));
+  case OPCODE_JALR:
+    return get_rd(inst) == 0 || push_work(translator, end_pc);
+  default:
+    return push_work(translator, end_pc);
+  }
+}
+
+static bool translate_block(Translator_t *translator, uint32_t start_pc) {
+  if (!grow((void **)&translator->blocks, &translator->block_capacity,
+            translator->block_count + 1, sizeof(TranslatedBlock_t)) ||
+      !grow((void **)&translator->insns, &translator->insn_capacity,
+            translator->insn_count + AOT_MAX_BLOCK_INSTRUCTIONS,
+            sizeof(Instruction_t)))
+    return false;
+
+  TranslatedBlock_t *block = &translator->blocks[translator->block_count];
+  block->start_pc = start_pc;
+  block->first = translator->insn_count;
+  block->count = 0;
+
+  uint32_t pc = start_pc;
+  Instruction_t *last = NULL;
+  while (block->count < AOT_MAX_BLOCK_INSTRUCTIONS &&
+         in_ranges(translator, pc, 2)) {
+    FetchResult_t fetch = fetch_instruction(&translator->memory, pc);
+    if (!fetch.success || !in_ranges(translator, pc, (uint32_t)fetch.len))
+      break;
+
+    uint32_t inst = fetch.inst;
+    if (RV_ISA_HAS_C && fetch.len == 2)
+      inst = expand_compressed((uint16_t)fetch.inst);
+
+    last = &translator->insns[block->first + block->count++];
+    *last = (Instruction_t){.pc = pc,
+                            .inst = inst,
+                            .len = (uint8_t)fetch.len,
+                            .handler = decode_instruction(inst)};
+    pc += (uint32_t)fetch.len;
+    if (ends_block(last))
+      break;
+  }
+
+  if (block->count == 0)
+    return true;
+
+  block->end_pc = pc;
+  translator->insn_count += block->count;
+  translator->block_count++;
+  return queue_successors(translator, last, pc);
+}
+
+// Guest registers live in locals (x1, x2, ...) for the whole block. `dirty`
+// tracks the locals assigned so far; they are stored back to cpu->regs on
+// every way out of the block and before the interpreter runs an
+// instruction, so cpu->regs is exact whenever anything else can see it.
+// Every way out returns how many guest instructions retired; `index` is the
+// position of the instruction being emitted.
+typedef struct Emitter {
+  FILE *out;
+  uint32_t dirty;
+  uint32_t index;
+} Emitter_t;
+
+static uint32_t register_bit(uint8_t reg) { return UINT32_C(1) << reg; }
+
+static void print_reg(FILE *out, uint8_t reg) {
+  if (reg == 0)
+    fprintf(out, "0u");
+  else
+    fprintf(out, "x%u", reg);
+}
+
+static void assign_reg(Emitter_t *emitter, uint8_t reg) {
+  fprintf(emitter->out, "  x%u = ", reg);
+  emitter->dirty |= register_bit(reg);
+}
+
+static void emit_writeback(const Emitter_t *emitter, const char *indent) {
+  for (uint8_t reg = 1; reg < 32; reg++) {
+    if (emitter->dirty & register_bit(reg))
+      fprintf(emitter->out, "%scpu->regs[%u] = x%u;\n", indent, reg, reg);
+  }
+}
+
+// Leaves the block after a failed memory access; the helper already
+// stopped the guest, so the access does not retire.
+static void emit_checked_exit(const Emitter_t *emitter) {
+  fprintf(emitter->out, "))%s\n", emitter->dirty ? " {" : "");
+  emit_writeback(emitter, "    ");
+  fprintf(emitter->out, "    return %u;\n%s", emitter->index,
+          emitter->dirty ? "  }\n" : "");
+}
+
+// Locals are reloaded afterwards unless the block ends here. An instruction
+// that writes memory, such as a hypercall, can rewrite the rest of the
+// block, which then runs on the interpreter as after a store.
+static void emit_fallback(Emitter_t *emitter, const Instruction_t *insn,
+                          bool last, uint32_t used) {
+  emit_writeback(emitter, "  ");
+  emitter->dirty = 0;
+  fprintf(emitter->out,
+          "  cpu->pc = 0x%08xu;\n"
+          "  cpu->current_inst_len = %u;\n"
+          "  cpu->next_pc = 0x%08xu;\n"
+          "  decode_and_execute(0x%08xu, context);\n"
+          "  if (cpu->halt)\n"
+          "    return %u;\n"
+          "  cpu->pc = cpu->next_pc;\n",
+          insn->pc, insn->len, insn->pc + insn->len, insn->inst,
+          emitter->index);
+  if (!last)
+    fprintf(emitter->out,
+            "  if (context->aot->code_written)\n"
+            "    return %u;\n",
+            emitter->index + 1);
+  for (uint8_t reg = 1; reg < 32 && !last; reg++) {
+    if (used & register_bit(reg))
+      fprintf(emitter->out, "  x%u = cpu->regs[%u];\n", reg, reg);
+  }
+}
+
+// Emits one instruction. Control transfers set cpu->pc and return; every
+// other instruction falls through to the next one in the block.
+static void emit_instruction(Emitter_t *emitter, const Instruction_t *insn,
+                             bool last, uint32_t used) {
+  FILE *out = emitter->out;
+  uint32_t inst = insn->inst;
+  InstructionHandler handler = insn->handler;
+  uint8_t rd = get_rd(inst);
+  uint8_t rs1 = get_rs1(inst);
+  uint8_t rs2 = get_rs2(inst);
+  uint32_t next_pc = insn->pc + insn->len;
+  uint32_t retired = emitter->index + 1;
+  const char *helper;
+
+  if ((helper = find_rule(register_rules, RULE_COUNT(register_rules),
+                          handler))) {
+    if (rd == 0)
+      return;
+    assign_reg(emitter, rd);
+    fprintf(out, "%s(", helper);
+    print_reg(out, rs1);
+    fprintf(out, ", ");
+    print_reg(out, rs2);
+    fprintf(out, ");\n");
+  } else if ((helper = find_rule(immediate_rules, RULE_COUNT(immediate_rules),
+                                 handler))) {
+    if (rd == 0)
+      return;
+    assign_reg(emitter, rd);
+    fprintf(out, "%s(", helper);
+    print_reg(out, rs1);
+    fprintf(out, ", 0x%08xu);\n", (uint32_t)get_imm_i(inst));
+  } else if ((helper = find_rule(load_rules, RULE_COUNT(load_rules),
+                                 handler))) {
+    fprintf(out, "  if (!%s(context, 0x%08xu, ", helper, insn->pc);
+    print_reg(out, rs1);
+    fprintf(out, " + 0x%08xu, &value", (uint32_t)get_imm_i(inst));
+    emit_checked_exit(emitter);
+    if (rd != 0) {
+      assign_reg(emitter, rd);
+      fprintf(out, "value;\n");
+    }
+  } else if ((helper = find_rule(store_rules, RULE_COUNT(store_rules),
+                                 handler))) {
+    fprintf(out, "  if (!%s(context, 0x%08xu, ", helper, insn->pc);
+    print_reg(out, rs1);
+    fprintf(out, " + 0x%08xu, ", (uint32_t)get_imm_s(inst));
+    print_reg(out, rs2);
+    emit_checked_exit(emitter);
+    if (!last) {
+      fprintf(out, "  if (context->aot->code_written) {\n");
+      emit_writeback(emitter, "    ");
+      fprintf(out,
+              "    cpu->pc = 0x%08xu;\n"
+              "    return %u;\n"
+              "  }\n",
+              next_pc, retired);
+    }
+  } else if ((helper = find_rule(branch_rules, RULE_COUNT(branch_rules),
+                                 handler))) {
+    emit_writeback(emitter, "  ");
+    fprintf(out, "  cpu->pc = %s(", helper);
+    print_reg(out, rs1);
+    fprintf(out, ", ");
+    print_reg(out, rs2);
+    fprintf(out, ") ? 0x%08xu : 0x%08xu;\n  return %u;\n",
+            insn->pc + get_imm_b(inst), next_pc, retired);
+  } else if (handler == handle_lui || handler == handle_auipc) {
+    if (rd == 0)
+      return;
+    uint32_t value = get_imm_u(inst);
+    if (handler == handle_auipc)
+      value += insn->pc;
+    assign_reg(emitter, rd);
+    fprintf(out, "0x%08xu;\n", value);
+  } else if (handler == handle_jal) {
+    if (rd != 0) {
+      assign_reg(emitter, rd);
+      fprintf(out, "0x%08xu;\n", next_pc);
+    }
+    emit_writeback(emitter, "  ");
+    fprintf(out, "  cpu->pc = 0x%08xu;\n  return %u;\n",
+            insn->pc + get_imm_j(inst), retired);
+  } else if (handler == handle_jalr) {
+    fprintf(out, "  target = (");
+    print_reg(out, rs1);
+    fprintf(out, " + 0x%08xu) & ~1u;\n", (uint32_t)get_imm_i(inst));
+    if (rd != 0) {
+      assign_reg(emitter, rd);
+      fprintf(out, "0x%08xu;\n", next_pc);
+    }
+    emit_writeback(emitter, "  ");
+    fprintf(out, "  cpu->pc = target;\n  return %u;\n", retired);
+  } else if (handler == handle_fence) {
+    return;
+  } else {
+    emit_fallback(emitter, insn, last, used);
+    if (last)
+      fprintf(out, "  return %u;\n", retired);
+  }
+}
+
+// Registers the translation of an instruction reads or writes. Fallbacks
+// work on cpu->regs and use none.
+static uint32_t instruction_registers(const Instruction_t *insn) {
+  uint32_t inst = insn->inst;
+  InstructionHandler handler = insn->handler;
+  uint32_t rd = register_bit(get_rd(inst));
+  uint32_t rs1 = register_bit(get_rs1(inst));
+  uint32_t rs2 = register_bit(get_rs2(inst));
+  uint32_t regs = 0;
+
+  if (find_rule(register_rules, RULE_COUNT(register_rules), handler))
+    regs = rd | rs1 | rs2;
+  else if (find_rule(immediate_rules, RULE_COUNT(immediate_rules), handler) ||
+           find_rule(load_rules, RULE_COUNT(load_rules), handler) ||
+           handler == handle_jalr)
+    regs = rd | rs1;
+  else if (find_rule(store_rules, RULE_COUNT(store_rules), handler) ||
+           find_rule(branch_rules, RULE_COUNT(branch_rules), handler))
+    regs = rs1 | rs2;
+  else if (handler == handle_lui || handler == handle_auipc ||
+           handler == handle_jal)
+    regs = rd;
+  return regs & ~register_bit(0);
+}
+
+static bool emit_block(FILE *out, const Translator_t *translator,
+                       const TranslatedBlock_t *block) {
+  char *body = NULL;
+  size_t body_size = 0;
+  FILE *stream = open_memstream(&body, &body_size);
+  if (!stream) {
+    perror("Error: Failed to buffer generated code");
+    return false;
+  }
+
+  const Instruction_t *insns = &translator->insns[block->first];
+  uint32_t used = 0;
+  for (size_t i = 0; i < block->count; i++)
+    used |= instruction_registers(&insns[i]);
+
+  Emitter_t emitter = {.out = stream, .dirty = 0, .index = 0};
+  bool returned = false;
+  for (size_t i = 0; i < block->count; i++) {
+    const Instruction_t *insn = &insns[i];
+    bool last = i + 1 == block->count;
+    fprintf(stream, "  /* 0x%08x: 0x%08x */\n", insn->pc, insn->inst);
+    emitter.index = (uint32_t)i;
+    emit_instruction(&emitter, insn, last, used);
+    returned = last && ends_block(insn);
+  }
+  if (!returned) {
+    emit_writeback(&emitter, "  ");
+    fprintf(stream, "  cpu->pc = 0x%08xu;\n  return %zuu;\n", block->end_pc,
+            block->count);
+  }
+  fclose(stream);
+
+  fprintf(out, "static uint32_t block_%08x(RvContext_t *context) {\n",
+          block->start_pc);
+  fprintf(out, "  CPU_t *cpu = context->cpu;\n");
+  for (uint8_t reg = 1; reg < 32; reg++) {
+    if (used & register_bit(reg))
+      fprintf(out, "  uint32_t x%u = cpu->regs[%u];\n", reg, reg);
+  }
+  if (strstr(body, "&value"))
+    fprintf(out, "  uint32_t value;\n");
+  if (strstr(body, "target ="))
+    fprintf(out, "  uint32_t target;\n");
+  fprintf(out, "%s}\n\n", body);
+  free(body);
+  return true;
+}
+
+static int compare_blocks(const void *a, const void *b) {
+  uint32_t left = ((const TranslatedBlock_t *)a)->start_pc;
+  uint32_t right = ((const TranslatedBlock_t *)b)->start_pc;
+  return (left > right) - (left < right);
+}
+
+static bool emit_program(FILE *out, Translator_t *translator,
+                         const char *elf_path) {
+  qsort(translator->blocks, translator->block_count,
+        sizeof(TranslatedBlock_t), compare_blocks);
+
+  fprintf(out,
+          "// Generated by rv-aot from %s. Do not edit.\n\n"
+          "#include \"aot.h\"\n\n",
+          elf_path);
+
+  for (size_t i = 0; i < translator->block_count; i++) {
+    if (!emit_block(out, translator, &translator->blocks[i]))
+      return false;
+  }
+
+  fprintf(out, "static const AotBlock_t blocks[] = {\n");
+  for (size_t i = 0; i < translator->block_count; i++) {
+    const TranslatedBlock_t *block = &translator->blocks[i];
+    fprintf(out, "    {0x%08xu, 0x%08xu, %zu, block_%08x},\n",
+            block->start_pc, block->end_pc, block->count, block->start_pc);
+  }
+  fprintf(out, "};\n\nstatic const AotSegment_t segments[] = {\n");
+  for (size_t i = 0; i < translator->range_count; i++) {
+    const Range_t *range = &translator->ranges[i];
+    uint8_t *bytes;
+    if (!memory_get_pointer(&translator->memory, range->start,
+                            range->end - range->start, &bytes)) {
+      fprintf(stderr, "Error: Executable segment is outside guest memory\n");
+      return false;
+    }
+    fprintf(out, "    {0x%08xu, 0x%08xu, 0x%016llxull},\n", range->start,
+            range->end - range->start,
+            (unsigned long long)hash_bytes(HASH_SEED, bytes,
+                                           range->end - range->start));
+  }
+  fprintf(out,
+          "};\n\n"
+          "const AotProgram_t rv_aot_program = {\n"
+          "    blocks, sizeof(blocks) / sizeof(blocks[0]),\n"
+          "    segments, sizeof(segments) / sizeof(segments[0])};\n");
+  return true;
+}
+
+static void free_translator(Translator_t *translator) {
+  free(translator->worklist);
+  free(translator->seen);
+  free(translator->blocks);
+  free(translator->insns);
+  free_memory(&translator->memory);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s <program.elf> <output.c>\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  Translator_t translator;
+  memset(&translator, 0, sizeof(translator));
+  init_cpu(&translator.cpu);
+  if (!init_memory(&translator.memory, MEMORY_SIZE_BYTES))
+    return EXIT_FAILURE;
+
+  load_elf(&translator.cpu, &translator.memory, argv[1], NULL);
+  bool ok = !translator.cpu.halt && collect_entry_points(&translator, argv[1]);
+
+  while (ok && translator.work_count > 0)
+    ok = translate_block(&translator,
+                         translator.worklist[--translator.work_count]);
+
+  FILE *out = ok ? fopen(argv[2], "w") : NULL;
+  if (ok && !out) {
+    perror("Error: Failed to open output file");
+    ok = false;
+  }
+  if (ok)
+    ok = emit_program(out, &translator, argv[1]);
+  if (out && fclose(out) != 0)
+    ok = false;
+
+  free_translator(&translator);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}